@@ -0,0 +1,40 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Audio band detection, Q14 Goertzel bank (host tested)
+// *****************************************************************************
+#include <math.h>
+#include "lamp_audio.h"
+
+
+int32_t audio_coeff(uint8_t bin, uint8_t block){
+    return lround(2.0 * cos((2.0 * M_PI * bin) / block) * (1 << AUDIO_Q));
+}
+
+
+uint32_t audio_magnitude(int32_t coeff, int32_t s1, int32_t s2){
+    int64_t     power;
+
+    power = (int64_t)s1 * s1 + (int64_t)s2 * s2 - (((int64_t)coeff * s1 * s2) >> AUDIO_Q);
+    return audio_isqrt((power > 0) ? power : 0);
+}
+
+
+uint32_t audio_isqrt(uint64_t value){
+    uint64_t    bit     = 1ULL << 62;
+    uint64_t    result  = 0;
+
+    while (bit > value){
+        bit >>= 2;
+    }
+    while (0 != bit){
+        if (value >= (result + bit)){
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        }
+        else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
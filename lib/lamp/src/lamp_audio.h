@@ -0,0 +1,41 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Audio band detection, Q14 Goertzel bank (host tested)
+// *****************************************************************************
+#ifndef LAMP_AUDIO_H
+#define LAMP_AUDIO_H
+
+#include <stdint.h>
+
+
+#define AUDIO_Q                         14                                      // coefficient fraction bits
+
+
+// 2cos(2 pi bin / block) in Q14 for a block of that many samples
+int32_t audio_coeff(uint8_t bin, uint8_t block);
+
+// Removes the running mean from a raw ADC sample, dc is Q4 (start at mid scale << 4)
+static inline int32_t audio_dc(int32_t x, int32_t *dc){
+    *dc += ((x << 4) - *dc) >> 6;                                               // ~64 sample DC tracker
+    return x - (*dc >> 4);
+}
+
+// One sample through every band. s1/s2 start at 0 for each block.
+static inline void audio_goertzel(int32_t x, const int32_t *coeff, int32_t *s1, int32_t *s2, uint8_t bands){
+    int32_t     s0;
+
+    for (uint8_t b = 0; b < bands; b++){
+        s0 = x + ((coeff[b] * s1[b]) >> AUDIO_Q) - s2[b];
+        s2[b] = s1[b];
+        s1[b] = s0;
+    }
+}
+
+// Magnitude of a band at the end of a block: amplitude * block / 2 for a
+// tone centred on the bin
+uint32_t audio_magnitude(int32_t coeff, int32_t s1, int32_t s2);
+
+// Integer square root, digit by digit, no float on the hot path
+uint32_t audio_isqrt(uint64_t value);
+
+#endif
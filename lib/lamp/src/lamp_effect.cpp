@@ -0,0 +1,386 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Effect expression compiler and bytecode VM (host tested)
+// *****************************************************************************
+#include <stdlib.h>
+#include <string.h>
+#include "lamp_effect.h"
+
+
+#define EFFECT_COST_BASE                16                                      // (cycles) fetch, dispatch, stack access
+#define EFFECT_COST_MUL                 20
+#define EFFECT_COST_DIV                 96                                      // no divider on the LX106, libgcc __divsi3
+#define EFFECT_COST_SIN                 40
+#define EFFECT_COST_OUT                 24                                      // clamp and store
+
+
+typedef struct {
+    const char  *src;
+    uint8_t     *code;
+    uint8_t     size;
+    uint8_t     len;
+    uint8_t     nest;
+    bool        error;
+} EffectCompiler;
+
+
+static void effect_parseExpr(EffectCompiler *cc);
+static void effect_parseTerm(EffectCompiler *cc);
+static void effect_parseUnary(EffectCompiler *cc);
+static void effect_parsePrimary(EffectCompiler *cc);
+static void effect_emit(EffectCompiler *cc, uint8_t op);
+static void effect_skipSpace(EffectCompiler *cc);
+
+
+bool effect_compile(const char *src, uint8_t *code, uint8_t size, uint8_t *len, uint16_t leds, uint32_t budget){
+    EffectCompiler  cc;
+
+    cc.src = src;
+    cc.code = code;
+    cc.size = size;
+    cc.len = 0;
+    cc.nest = 0;
+    cc.error = false;
+    *len = 0;
+
+    for (uint8_t channel = 0; channel < 3; channel++){                          // program = r ; g ; b
+        effect_parseExpr(&cc);
+        effect_emit(&cc, OP_OUT);
+        effect_skipSpace(&cc);
+        if (channel < 2){
+            if (';' != *cc.src){
+                cc.error = true;
+            }
+            cc.src += 1;
+        }
+        if (cc.error){
+            return false;
+        }
+    }
+    effect_skipSpace(&cc);
+    if ('\0' != *cc.src){
+        return false;
+    }
+    effect_emit(&cc, OP_END);
+    *len = cc.len;
+    return !cc.error && (effect_verify(code, cc.len, leds, budget) > 0);
+}
+
+
+static void effect_parseExpr(EffectCompiler *cc){
+    char    c;
+
+    effect_parseTerm(cc);
+    while (!cc->error){
+        effect_skipSpace(cc);
+        c = *cc->src;
+        if (('+' != c) && ('-' != c) && ('&' != c) && ('|' != c) && ('^' != c)){
+            return;
+        }
+        cc->src += 1;
+        effect_parseTerm(cc);
+        effect_emit(cc, ('+' == c) ? OP_ADD : ('-' == c) ? OP_SUB : ('&' == c) ? OP_AND : ('|' == c) ? OP_OR : OP_XOR);
+    }
+}
+
+
+static void effect_parseTerm(EffectCompiler *cc){
+    uint8_t     op;
+
+    effect_parseUnary(cc);
+    while (!cc->error){
+        effect_skipSpace(cc);
+        if ('*' == cc->src[0]){
+            op = OP_MUL;
+        }
+        else if ('/' == cc->src[0]){
+            op = OP_DIV;
+        }
+        else if ('%' == cc->src[0]){
+            op = OP_MOD;
+        }
+        else if (('<' == cc->src[0]) && ('<' == cc->src[1])){
+            op = OP_SHL;
+            cc->src += 1;
+        }
+        else if (('>' == cc->src[0]) && ('>' == cc->src[1])){
+            op = OP_SHR;
+            cc->src += 1;
+        }
+        else {
+            return;
+        }
+        cc->src += 1;
+        effect_parseUnary(cc);
+        effect_emit(cc, op);
+    }
+}
+
+
+static void effect_parseUnary(EffectCompiler *cc){
+    effect_skipSpace(cc);
+    if ('-' == *cc->src){
+        cc->src += 1;
+        if (++cc->nest > EFFECT_NEST_MAX){                                      // bounds the parser recursion
+            cc->error = true;
+            return;
+        }
+        effect_parseUnary(cc);
+        cc->nest -= 1;
+        effect_emit(cc, OP_NEG);
+    }
+    else {
+        effect_parsePrimary(cc);
+    }
+}
+
+
+static void effect_parsePrimary(EffectCompiler *cc){
+    static const struct {
+        const char  *name;
+        uint8_t     op;
+        uint8_t     args;
+    } funcs[] = {
+        {"sin", OP_SIN, 1}, {"tri", OP_TRI, 1}, {"abs", OP_ABS, 1},
+        {"scale", OP_SCALE, 2}, {"min", OP_MIN, 2}, {"max", OP_MAX, 2},
+    };
+    char        *end;
+    long        value;
+    size_t      len;
+
+    effect_skipSpace(cc);
+    if ((*cc->src >= '0') && (*cc->src <= '9')){
+        value = strtol(cc->src, &end, 0);
+        cc->src = end;
+        if ((value < -32768) || (value > 32767)){
+            cc->error = true;
+        }
+        else if ((value >= -128) && (value <= 127)){
+            effect_emit(cc, OP_PUSH8);
+            effect_emit(cc, (uint8_t)value);
+        }
+        else {
+            effect_emit(cc, OP_PUSH16);
+            effect_emit(cc, value & 0xFF);
+            effect_emit(cc, (value >> 8) & 0xFF);
+        }
+        return;
+    }
+    if ('(' == *cc->src){
+        cc->src += 1;
+        if (++cc->nest > EFFECT_NEST_MAX){
+            cc->error = true;
+            return;
+        }
+        effect_parseExpr(cc);
+        cc->nest -= 1;
+        effect_skipSpace(cc);
+        if (')' != *cc->src){
+            cc->error = true;
+            return;
+        }
+        cc->src += 1;
+        return;
+    }
+    for (uint8_t f = 0; f < (sizeof(funcs) / sizeof(funcs[0])); f++){
+        len = strlen(funcs[f].name);
+        if ((0 == strncmp(cc->src, funcs[f].name, len)) && ('(' == cc->src[len])){
+            cc->src += len + 1;
+            if (++cc->nest > EFFECT_NEST_MAX){
+                cc->error = true;
+                return;
+            }
+            for (uint8_t a = 0; a < funcs[f].args; a++){
+                if (a > 0){
+                    effect_skipSpace(cc);
+                    if (',' != *cc->src){
+                        cc->error = true;
+                        return;
+                    }
+                    cc->src += 1;
+                }
+                effect_parseExpr(cc);
+            }
+            cc->nest -= 1;
+            effect_skipSpace(cc);
+            if (')' != *cc->src){
+                cc->error = true;
+                return;
+            }
+            cc->src += 1;
+            effect_emit(cc, funcs[f].op);
+            return;
+        }
+    }
+    if (('t' == *cc->src) || ('i' == *cc->src) || ('n' == *cc->src)){
+        effect_emit(cc, ('t' == *cc->src) ? OP_T : ('i' == *cc->src) ? OP_I : OP_N);
+        cc->src += 1;
+        return;
+    }
+    cc->error = true;
+}
+
+
+static void effect_emit(EffectCompiler *cc, uint8_t op){
+    if (cc->len >= cc->size){
+        cc->error = true;
+        return;
+    }
+    cc->code[cc->len] = op;
+    cc->len += 1;
+}
+
+
+static void effect_skipSpace(EffectCompiler *cc){
+    while ((' ' == *cc->src) || ('\t' == *cc->src) || ('\n' == *cc->src) || ('\r' == *cc->src)){
+        cc->src += 1;
+    }
+}
+
+
+int effect_verify(const uint8_t *code, uint8_t len, uint16_t leds, uint32_t budget){
+    int         depth   = 0;
+    int         outs    = 0;
+    int         ops     = 0;
+    uint8_t     pc      = 0;
+    uint8_t     op;
+
+    while (pc < len){
+        op = code[pc];
+        pc += 1;
+        ops += 1;
+        if (op >= OP_COUNT){
+            return -1;
+        }
+        if (OP_END == op){
+            break;
+        }
+        if ((OP_PUSH8 == op) || (OP_PUSH16 == op)){
+            pc += (OP_PUSH8 == op) ? 1 : 2;
+            if (pc > len){
+                return -1;
+            }
+            depth += 1;
+        }
+        else if ((OP_T == op) || (OP_I == op) || (OP_N == op)){
+            depth += 1;
+        }
+        else if ((OP_NEG == op) || (OP_ABS == op) || (OP_SIN == op) || (OP_TRI == op)){
+            if (depth < 1){
+                return -1;
+            }
+        }
+        else if (OP_OUT == op){
+            depth -= 1;
+            outs += 1;
+        }
+        else {                                                                  // binary operators
+            if (depth < 2){
+                return -1;
+            }
+            depth -= 1;
+        }
+        if ((depth < 0) || (depth > EFFECT_STACK)){
+            return -1;
+        }
+    }
+    if ((0 != depth) || (3 != outs) || ((effect_cost(code, len) * leds) > budget)){
+        return -1;
+    }
+    return ops;
+}
+
+
+uint32_t effect_cost(const uint8_t *code, uint8_t len){
+    uint32_t    cycles  = 0;
+    uint8_t     pc      = 0;
+    uint8_t     op;
+
+    while (pc < len){
+        op = code[pc++];
+        if (OP_END == op){
+            break;
+        }
+        switch (op){
+            case OP_PUSH8:  pc += 1;    cycles += EFFECT_COST_BASE;     break;
+            case OP_PUSH16: pc += 2;    cycles += EFFECT_COST_BASE;     break;
+            case OP_MUL:
+            case OP_SCALE:              cycles += EFFECT_COST_MUL;      break;
+            case OP_DIV:
+            case OP_MOD:                cycles += EFFECT_COST_DIV;      break;
+            case OP_SIN:                cycles += EFFECT_COST_SIN;      break;
+            case OP_OUT:                cycles += EFFECT_COST_OUT;      break;
+            default:                    cycles += EFFECT_COST_BASE;     break;
+        }
+    }
+    return cycles;
+}
+
+
+void effect_run(const uint8_t *code, uint8_t len, int32_t t, uint8_t *rgb, uint16_t leds){
+    int32_t         stack[EFFECT_STACK];
+    uint8_t         sp;
+    uint8_t         pc;
+    uint8_t         channel;
+    int32_t         a;
+    int32_t         b;
+
+    // wrapping arithmetic is done on uint32_t: user code must not reach signed overflow
+    for (uint16_t i = 0; i < leds; i++){
+        sp = 0;
+        pc = 0;
+        channel = 0;
+        while (pc < len){                                                       // verified: no under/overflow
+            switch (code[pc++]){
+                case OP_PUSH8:  stack[sp++] = (int8_t)code[pc++];                                           break;
+                case OP_PUSH16: stack[sp++] = (int16_t)(code[pc] | (code[pc + 1] << 8));
+                                pc += 2;                                                                    break;
+                case OP_T:      stack[sp++] = t;                                                            break;
+                case OP_I:      stack[sp++] = i;                                                            break;
+                case OP_N:      stack[sp++] = leds;                                                         break;
+                case OP_ADD:    sp--; stack[sp - 1] = (uint32_t)stack[sp - 1] + (uint32_t)stack[sp];        break;
+                case OP_SUB:    sp--; stack[sp - 1] = (uint32_t)stack[sp - 1] - (uint32_t)stack[sp];        break;
+                case OP_MUL:    sp--; stack[sp - 1] = (uint32_t)stack[sp - 1] * (uint32_t)stack[sp];        break;
+                case OP_DIV:    sp--; a = stack[sp - 1]; b = stack[sp];                                     // x / 0 = 0, MIN / -1 wraps
+                                stack[sp - 1] = (0 == b) ? 0 : (-1 == b) ? (int32_t)(0U - (uint32_t)a) : (a / b);  break;
+                case OP_MOD:    sp--; a = stack[sp - 1]; b = stack[sp];
+                                stack[sp - 1] = ((0 == b) || (-1 == b)) ? 0 : (a % b);                      break;
+                case OP_AND:    sp--; stack[sp - 1] &= stack[sp];                                           break;
+                case OP_OR:     sp--; stack[sp - 1] |= stack[sp];                                           break;
+                case OP_XOR:    sp--; stack[sp - 1] ^= stack[sp];                                           break;
+                case OP_SHL:    sp--; stack[sp - 1] = (uint32_t)stack[sp - 1] << (stack[sp] & 31);          break;
+                case OP_SHR:    sp--; stack[sp - 1] >>= (stack[sp] & 31);                                   break;
+                case OP_NEG:    stack[sp - 1] = 0U - (uint32_t)stack[sp - 1];                               break;
+                case OP_ABS:    a = stack[sp - 1];
+                                stack[sp - 1] = (a < 0) ? (int32_t)(0U - (uint32_t)a) : a;                  break;
+                case OP_SIN:    stack[sp - 1] = effect_sin8(stack[sp - 1] & 0xFF);                          break;
+                case OP_TRI:    a = stack[sp - 1] & 0xFF;
+                                stack[sp - 1] = (a < 128) ? (a * 2) : ((255 - a) * 2);                      break;
+                case OP_SCALE:  sp--; stack[sp - 1] = (int32_t)((uint32_t)stack[sp - 1] * (uint32_t)stack[sp]) >> 8;  break;
+                case OP_MIN:    sp--; stack[sp - 1] = (stack[sp] < stack[sp - 1]) ? stack[sp] : stack[sp - 1];  break;
+                case OP_MAX:    sp--; stack[sp - 1] = (stack[sp] > stack[sp - 1]) ? stack[sp] : stack[sp - 1];  break;
+                case OP_OUT:    sp--; a = stack[sp];
+                                rgb[(i * 3) + channel++] = (a < 0) ? 0 : (a > 255) ? 255 : a;              break;
+                default:        pc = len;                                                                   break;
+            }
+        }
+    }
+}
+
+
+uint8_t effect_sin8(uint8_t theta){
+    static const uint8_t    interleave[8]   = {0, 49, 49, 41, 90, 27, 117, 10};   // (base, slope * 16) per 16 steps
+    uint8_t         offset      = (theta & 0x40) ? (255 - theta) : theta;
+    uint8_t         step;
+    uint8_t         section;
+    int8_t          y;
+
+    offset &= 0x3F;
+    step = (offset & 0x0F) + ((theta & 0x40) ? 1 : 0);
+    section = offset >> 4;
+    y = interleave[section * 2] + ((interleave[(section * 2) + 1] * step) >> 4);
+    if (theta & 0x80){
+        y = -y;
+    }
+    return y + 128;
+}
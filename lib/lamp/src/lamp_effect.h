@@ -0,0 +1,62 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Effect expression compiler and bytecode VM (host tested)
+// *****************************************************************************
+#ifndef LAMP_EFFECT_H
+#define LAMP_EFFECT_H
+
+#include <stdint.h>
+
+
+#define EFFECT_STACK                    12                                      // VM stack depth
+#define EFFECT_NEST_MAX                 8                                       // parentheses/call nesting in source
+
+
+typedef enum {
+    OP_END                              = 0,
+    OP_PUSH8,                                                                   // + int8 immediate
+    OP_PUSH16,                                                                  // + int16 immediate, little endian
+    OP_T,
+    OP_I,
+    OP_N,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_SHL,
+    OP_SHR,
+    OP_NEG,
+    OP_ABS,
+    OP_SIN,                                                                     // sin8(x & 255)
+    OP_TRI,                                                                     // triangle wave, period 256
+    OP_SCALE,                                                                   // (a * b) >> 8, fixed point 0.8 multiply
+    OP_MIN,
+    OP_MAX,
+    OP_OUT,                                                                     // pop into the next channel r, g, b
+    OP_COUNT
+} EffectOp;
+
+
+// Compiles "<r>;<g>;<b>" into code[size]. Fails on syntax errors and on
+// programs verify rejects for that many LEDs and budget.
+bool effect_compile(const char *src, uint8_t *code, uint8_t size, uint8_t *len, uint16_t leds, uint32_t budget);
+
+// Straight-line code only, so one pass proves stack bounds and run time.
+// Returns the instructions run per pixel, or -1 when the code is malformed
+// or its estimated cost for all pixels exceeds budget (CPU cycles).
+int effect_verify(const uint8_t *code, uint8_t len, uint16_t leds, uint32_t budget);
+
+// Estimated CPU cycles per pixel on the ESP8266 (verified code only)
+uint32_t effect_cost(const uint8_t *code, uint8_t len);
+
+// Runs verified code once per pixel into rgb (leds * 3 bytes), t = time
+void effect_run(const uint8_t *code, uint8_t len, int32_t t, uint8_t *rgb, uint16_t leds);
+
+// Same curve as FastLED sin8(): 0..255 -> 1..255, sin8(0) = 128
+uint8_t effect_sin8(uint8_t theta);
+
+#endif
@@ -0,0 +1,76 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Log line formatting, ring buffer and syslog packets (host tested)
+// *****************************************************************************
+#include <stdio.h>
+#include <string.h>
+#include "lamp_log.h"
+
+
+uint16_t log_format(char *line, uint16_t size, unsigned long stamp, uint8_t level, const char *format, va_list args){
+    static const char   tags[][6]   = {"", "ERROR", "WARN", "INFO", "DEBUG"};
+    int                 len;
+    int                 count;
+
+    len = snprintf(line, size, "%lu [%s] ", stamp, tags[(level <= LOG_LEVEL_DEBUG) ? level : LOG_LEVEL_NONE]);
+    count = vsnprintf(line + len, size - len, format, args);
+    if (count > 0){
+        len += (count < (size - len - 2)) ? count : (size - len - 2);          // truncate, keep room for the newline
+    }
+    line[len] = '\n';
+    return len + 1;
+}
+
+
+uint32_t log_append(char *ring, uint32_t size, uint32_t head, const char *line, uint16_t len){
+    uint32_t    index   = head & (size - 1);                                    // single producer, overwrite oldest
+    uint32_t    count   = (len < (size - index)) ? len : (size - index);
+
+    memcpy(ring + index, line, count);
+    memcpy(ring, line + count, len - count);
+    return head + len;
+}
+
+
+void log_catchUp(uint32_t size, uint32_t *tail, uint32_t head, unsigned long *dropped){
+    if ((head - *tail) > size){                                                 // lapped by the producer
+        *dropped += (head - *tail) - size;
+        *tail = head - size;
+    }
+}
+
+
+uint16_t log_syslog(const char *ring, uint32_t size, uint32_t *tail, uint32_t head, const char *host, char *packet,
+                    uint16_t packetSize){
+    uint8_t     severity    = 6;                                                // info
+    uint32_t    pos;
+    uint16_t    len;
+    char        c;
+
+    if (*tail == head){
+        return 0;
+    }
+    // the tag follows the stamp: "123 [WARN] ..."
+    for (pos = *tail; (pos != head) && ((pos - *tail) < 16); pos++){
+        if ('[' == ring[pos & (size - 1)]){
+            c = ((pos + 1) != head) ? ring[(pos + 1) & (size - 1)] : '\0';
+            severity = ('E' == c) ? 3 : ('W' == c) ? 4 : ('D' == c) ? 7 : 6;
+            break;
+        }
+    }
+    len = snprintf(packet, packetSize, "<%u>%s: ", 8 + severity, host);         // facility 1 (user)
+    if (len >= packetSize){
+        len = packetSize - 1;
+    }
+    while (*tail != head){
+        c = ring[*tail & (size - 1)];
+        *tail += 1;
+        if ('\n' == c){
+            break;
+        }
+        if (len < packetSize){
+            packet[len++] = c;
+        }
+    }
+    return len;
+}
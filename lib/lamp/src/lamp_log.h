@@ -0,0 +1,40 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Log line formatting, ring buffer and syslog packets (host tested)
+// *****************************************************************************
+#ifndef LAMP_LOG_H
+#define LAMP_LOG_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+
+#define LOG_LEVEL_NONE                  0
+#define LOG_LEVEL_ERROR                 1
+#define LOG_LEVEL_WARN                  2
+#define LOG_LEVEL_INFO                  3
+#define LOG_LEVEL_DEBUG                 4
+
+
+// "<stamp> [TAG] message\n" into line, the message is cut so the newline
+// always fits. Returns the length with the newline. The format may sit in
+// flash (PSTR), the ESP8266 newlib printf reads it byte-wise.
+uint16_t log_format(char *line, uint16_t size, unsigned long stamp, uint8_t level, const char *format, va_list args);
+
+// Copies len bytes into the ring (size a power of 2) at head, overwriting
+// the oldest ones. Returns the new head, heads and tails count every byte
+// ever written.
+uint32_t log_append(char *ring, uint32_t size, uint32_t head, const char *line, uint16_t len);
+
+// Moves a reader lapped by the producer to the oldest byte still in the
+// ring and counts the bytes it lost
+void log_catchUp(uint32_t size, uint32_t *tail, uint32_t head, unsigned long *dropped);
+
+// Takes the line at *tail and writes it as "<pri>host: text" (facility
+// user, severity from the tag, no newline) into packet, without the heap.
+// Returns the packet length, 0 when no line is waiting. A line longer
+// than the packet is cut, the rest is skipped.
+uint16_t log_syslog(const char *ring, uint32_t size, uint32_t *tail, uint32_t head, const char *host, char *packet,
+                    uint16_t packetSize);
+
+#endif
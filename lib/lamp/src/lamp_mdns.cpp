@@ -0,0 +1,236 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             mDNS / DNS-SD answer building and query matching (host tested)
+// *****************************************************************************
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "lamp_mdns.h"
+
+
+uint16_t mdns_build(uint8_t *buf, const MdnsService *service){
+    char        http[MDNS_NAME_LEN];
+    char        eperly[MDNS_NAME_LEN];
+    char        host[MDNS_NAME_LEN];
+    uint16_t    pos;
+    uint16_t    rdata;
+
+    snprintf(host, sizeof(host), "%s.local", service->host);
+    snprintf(http, sizeof(http), "%s._http._tcp.local", service->host);
+    snprintf(eperly, sizeof(eperly), "%s._eperly._udp.local", service->host);
+
+    memset(buf, 0, MDNS_HEADER_SIZE);
+    buf[2] = 0x84;                                                              // response, authoritative
+    buf[7] = 9;                                                                 // answers, every record below
+    pos = MDNS_HEADER_SIZE;
+
+    pos = rdata = mdns_putRecord(buf, pos, host, MDNS_TYPE_A, true, MDNS_TTL_HOST);
+    memcpy(buf + pos, service->ip, 4);
+    pos += 4;
+    mdns_endRecord(buf, rdata, pos);
+
+    pos = rdata = mdns_putRecord(buf, pos, "_services._dns-sd._udp.local", MDNS_TYPE_PTR, false, MDNS_TTL_SERVICE);
+    pos = mdns_putName(buf, pos, "_http._tcp.local");
+    mdns_endRecord(buf, rdata, pos);
+    pos = rdata = mdns_putRecord(buf, pos, "_services._dns-sd._udp.local", MDNS_TYPE_PTR, false, MDNS_TTL_SERVICE);
+    pos = mdns_putName(buf, pos, "_eperly._udp.local");
+    mdns_endRecord(buf, rdata, pos);
+
+    pos = rdata = mdns_putRecord(buf, pos, "_http._tcp.local", MDNS_TYPE_PTR, false, MDNS_TTL_SERVICE);
+    pos = mdns_putName(buf, pos, http);
+    mdns_endRecord(buf, rdata, pos);
+    pos = rdata = mdns_putRecord(buf, pos, http, MDNS_TYPE_SRV, true, MDNS_TTL_HOST);
+    pos = mdns_putSrv(buf, pos, service->httpPort, host);
+    mdns_endRecord(buf, rdata, pos);
+    pos = rdata = mdns_putRecord(buf, pos, http, MDNS_TYPE_TXT, true, MDNS_TTL_SERVICE);
+    pos = mdns_putText(buf, pos, "path=/");
+    mdns_endRecord(buf, rdata, pos);
+
+    pos = rdata = mdns_putRecord(buf, pos, "_eperly._udp.local", MDNS_TYPE_PTR, false, MDNS_TTL_SERVICE);
+    pos = mdns_putName(buf, pos, eperly);
+    mdns_endRecord(buf, rdata, pos);
+    pos = rdata = mdns_putRecord(buf, pos, eperly, MDNS_TYPE_SRV, true, MDNS_TTL_HOST);
+    pos = mdns_putSrv(buf, pos, service->udpPort, host);
+    mdns_endRecord(buf, rdata, pos);
+    pos = rdata = mdns_putRecord(buf, pos, eperly, MDNS_TYPE_TXT, true, MDNS_TTL_SERVICE);
+    for (uint8_t i = 0; i < service->textCount; i++){
+        pos = mdns_putText(buf, pos, service->text[i]);
+    }
+    mdns_endRecord(buf, rdata, pos);
+    return pos;
+}
+
+
+bool mdns_matches(const uint8_t *buf, int len, const char *host, MdnsQuestion *question){
+    static const char   *services[]     = {"_http._tcp.local", "_eperly._udp.local", "_services._dns-sd._udp.local"};
+    const char          *rest;
+    uint16_t            count;
+    size_t              hostLen         = strlen(host);
+    int                 pos             = MDNS_HEADER_SIZE;
+
+    if ((len < MDNS_HEADER_SIZE) || (buf[2] & 0x80)){                          // short or a response
+        return false;
+    }
+    count = (buf[4] << 8) | buf[5];
+    for (uint16_t q = 0; q < count; q++){
+        pos = mdns_readName(buf, len, pos, question->name);
+        if ((pos < 0) || ((pos + 4) > len)){                                    // type and class follow the name
+            return false;
+        }
+        question->type = (buf[pos] << 8) | buf[pos + 1];
+        question->qclass = ((buf[pos + 2] << 8) | buf[pos + 3]) & ~MDNS_CLASS_FLUSH;
+        pos += 4;
+        for (uint8_t i = 0; i < (sizeof(services) / sizeof(services[0])); i++){
+            if (0 == strcasecmp(question->name, services[i])){
+                return true;
+            }
+        }
+        if (0 == strncasecmp(question->name, host, hostLen)){
+            rest = question->name + hostLen;
+            if ((0 == strcasecmp(rest, ".local")) || (0 == strcasecmp(rest, "._http._tcp.local")) ||
+                (0 == strcasecmp(rest, "._eperly._udp.local"))){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+uint16_t mdns_legacyReply(uint8_t *out, uint16_t size, const uint8_t *query, const MdnsQuestion *question,
+                          const uint8_t *answer, uint16_t answerLen){
+    uint16_t    count   = (answer[6] << 8) | answer[7];
+    uint16_t    pos;
+    uint16_t    rdlen;
+    uint32_t    ttl;
+
+    if ((answerLen < MDNS_HEADER_SIZE) || ((answerLen + strlen(question->name) + 6) > size)){   // question: name + 2, type, class
+        return 0;
+    }
+    memcpy(out, answer, MDNS_HEADER_SIZE);
+    out[0] = query[0];                                                          // same id, one question
+    out[1] = query[1];
+    out[4] = 0;
+    out[5] = 1;
+    pos = mdns_putName(out, MDNS_HEADER_SIZE, question->name);
+    out[pos++] = question->type >> 8;
+    out[pos++] = question->type;
+    out[pos++] = question->qclass >> 8;
+    out[pos++] = question->qclass;
+    memcpy(out + pos, answer + MDNS_HEADER_SIZE, answerLen - MDNS_HEADER_SIZE);
+    answerLen = pos + answerLen - MDNS_HEADER_SIZE;
+
+    for (uint16_t r = 0; r < count; r++){                                       // our own names, never compressed
+        while ((pos < answerLen) && (0 != out[pos])){
+            pos += 1 + out[pos];
+        }
+        if ((pos + 11) > answerLen){
+            return 0;
+        }
+        out[pos + 3] &= 0x7F;                                                   // no cache-flush for a legacy cache
+        ttl = ((uint32_t)out[pos + 5] << 24) | ((uint32_t)out[pos + 6] << 16) | (out[pos + 7] << 8) | out[pos + 8];
+        if (ttl > MDNS_TTL_LEGACY){
+            out[pos + 5] = 0;
+            out[pos + 6] = 0;
+            out[pos + 7] = 0;
+            out[pos + 8] = MDNS_TTL_LEGACY;
+        }
+        rdlen = (out[pos + 9] << 8) | out[pos + 10];
+        pos += 11 + rdlen;
+    }
+    return (pos == answerLen) ? answerLen : 0;
+}
+
+
+int mdns_readName(const uint8_t *buf, int len, int pos, char *name){
+    uint8_t     jumps   = 0;
+    uint8_t     out     = 0;
+    int         next    = -1;                                                   // position after the name in the question
+    uint8_t     label;
+
+    name[0] = '\0';
+    while (pos < len){
+        label = buf[pos];
+        if (0 == label){
+            return (next < 0) ? (pos + 1) : next;
+        }
+        if (0xC0 == (label & 0xC0)){                                            // compression pointer
+            if (((pos + 1) >= len) || (++jumps > MDNS_JUMPS_MAX)){
+                return -1;
+            }
+            if (next < 0){
+                next = pos + 2;
+            }
+            pos = ((label & 0x3F) << 8) | buf[pos + 1];
+            continue;
+        }
+        if ((label > 63) || ((pos + 1 + label) > len) || ((out + label + 2) > MDNS_NAME_LEN)){
+            return -1;
+        }
+        if (out > 0){
+            name[out++] = '.';
+        }
+        memcpy(name + out, buf + pos + 1, label);
+        out += label;
+        name[out] = '\0';
+        pos += 1 + label;
+    }
+    return -1;
+}
+
+
+uint16_t mdns_putName(uint8_t *buf, uint16_t pos, const char *name){
+    const char  *dot;
+    uint8_t     len;
+
+    while ('\0' != *name){
+        dot = strchr(name, '.');
+        len = (NULL != dot) ? (dot - name) : strlen(name);
+        buf[pos] = len;
+        memcpy(buf + pos + 1, name, len);
+        pos += 1 + len;
+        name += len;
+        if ('.' == *name){
+            name += 1;
+        }
+    }
+    buf[pos] = 0;
+    return pos + 1;
+}
+
+
+uint16_t mdns_putRecord(uint8_t *buf, uint16_t pos, const char *name, uint16_t type, bool unique, uint32_t ttl){
+    pos = mdns_putName(buf, pos, name);
+    buf[pos++] = type >> 8;
+    buf[pos++] = type;
+    buf[pos++] = unique ? 0x80 : 0x00;                                          // cache-flush: only this lamp owns it
+    buf[pos++] = MDNS_CLASS_IN;
+    buf[pos++] = ttl >> 24;
+    buf[pos++] = ttl >> 16;
+    buf[pos++] = ttl >> 8;
+    buf[pos++] = ttl;
+    return pos + 2;                                                             // rdata, length set by mdns_endRecord()
+}
+
+
+void mdns_endRecord(uint8_t *buf, uint16_t rdata, uint16_t pos){
+    buf[rdata - 2] = (pos - rdata) >> 8;
+    buf[rdata - 1] = pos - rdata;
+}
+
+
+uint16_t mdns_putSrv(uint8_t *buf, uint16_t pos, uint16_t port, const char *target){
+    memset(buf + pos, 0, 4);                                                    // priority, weight
+    buf[pos + 4] = port >> 8;
+    buf[pos + 5] = port;
+    return mdns_putName(buf, pos + 6, target);
+}
+
+
+uint16_t mdns_putText(uint8_t *buf, uint16_t pos, const char *text){
+    uint8_t     len     = strlen(text);
+
+    buf[pos] = len;
+    memcpy(buf + pos + 1, text, len);
+    return pos + 1 + len;
+}
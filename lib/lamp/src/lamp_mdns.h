@@ -0,0 +1,67 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             mDNS / DNS-SD answer building and query matching (host tested)
+// *****************************************************************************
+#ifndef LAMP_MDNS_H
+#define LAMP_MDNS_H
+
+#include <stdint.h>
+
+
+#define MDNS_HEADER_SIZE                12
+#define MDNS_NAME_LEN                   96                                      // longest dotted name handled
+#define MDNS_JUMPS_MAX                  8                                       // compression pointers per name
+#define MDNS_TYPE_A                     1
+#define MDNS_TYPE_PTR                   12
+#define MDNS_TYPE_TXT                   16
+#define MDNS_TYPE_SRV                   33
+#define MDNS_CLASS_IN                   0x0001
+#define MDNS_CLASS_FLUSH                0x8000                                  // cache-flush in answers, unicast-response in questions
+#define MDNS_TTL_HOST                   120                                     // (s) A and SRV
+#define MDNS_TTL_SERVICE                4500                                    // (s) PTR and TXT
+#define MDNS_TTL_LEGACY                 10                                      // (s) cap in unicast replies, RFC 6762 6.7
+
+
+typedef struct {
+    const char          *host;                                                  // <hostname>-<chip id>, .local is added
+    uint8_t             ip[4];
+    uint16_t            httpPort;                                               // _http._tcp
+    uint16_t            udpPort;                                                // _eperly._udp
+    const char * const  *text;                                                  // _eperly._udp TXT strings
+    uint8_t             textCount;
+} MdnsService;
+
+
+typedef struct {
+    char                name[MDNS_NAME_LEN];
+    uint16_t            type;
+    uint16_t            qclass;                                                 // without the unicast-response bit
+} MdnsQuestion;
+
+
+// The answer to every query: A, the DNS-SD enumeration PTRs and PTR/SRV/TXT
+// for both services, no compression. Returns its length, buf needs ~700 bytes.
+uint16_t mdns_build(uint8_t *buf, const MdnsService *service);
+
+// True if the query asks for one of our names or services, the first such
+// question is copied to question. Responses and malformed packets are false.
+bool mdns_matches(const uint8_t *buf, int len, const char *host, MdnsQuestion *question);
+
+// Reply to a legacy resolver (source port not 5353) from the multicast
+// answer: query id and question echoed, no cache-flush bits, TTLs capped at
+// MDNS_TTL_LEGACY. Returns its length, 0 if it does not fit size.
+uint16_t mdns_legacyReply(uint8_t *out, uint16_t size, const uint8_t *query, const MdnsQuestion *question,
+                          const uint8_t *answer, uint16_t answerLen);
+
+// Decodes a possibly compressed name at pos into name (MDNS_NAME_LEN, dotted).
+// Returns the position after the name in the packet, -1 if malformed.
+int mdns_readName(const uint8_t *buf, int len, int pos, char *name);
+
+// Record building, each returns the position after what it wrote
+uint16_t mdns_putName(uint8_t *buf, uint16_t pos, const char *name);
+uint16_t mdns_putRecord(uint8_t *buf, uint16_t pos, const char *name, uint16_t type, bool unique, uint32_t ttl);
+void mdns_endRecord(uint8_t *buf, uint16_t rdata, uint16_t pos);
+uint16_t mdns_putSrv(uint8_t *buf, uint16_t pos, uint16_t port, const char *target);
+uint16_t mdns_putText(uint8_t *buf, uint16_t pos, const char *text);
+
+#endif
@@ -0,0 +1,38 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Fused refresh pass, per channel (host tested)
+// *****************************************************************************
+#ifndef LAMP_MIX_H
+#define LAMP_MIX_H
+
+#include <stdint.h>
+
+
+#define MIX_CURVE_POINTS                17                                      // color 0, 16, .. 256
+
+
+// Color through its calibration curve (linearly interpolated between the
+// points), then the 16-bit brightness scale. Inline, it runs LED_NUM * 3
+// times per refresh.
+static inline uint16_t mix_level(uint8_t color, const uint16_t *curve, uint16_t scale){
+    const uint16_t  *point      = curve + (color >> 4);
+    uint32_t        value;
+
+    value = point[0] + ((((int32_t)point[1] - point[0]) * (color & 0x0F)) >> 4);
+    return (value * scale) >> 16;
+}
+
+
+// First order error diffusion in time: the 8-bit output, with the residual
+// carried in *err to the next refresh.
+static inline uint8_t mix_dither(uint16_t level, uint8_t *err){
+    uint32_t        value       = (uint32_t)level + *err;
+
+    if (value > 0xFFFF){                                                        // near full scale, 256 would wrap to off
+        value = 0xFFFF;
+    }
+    *err = value & 0xFF;
+    return value >> 8;
+}
+
+#endif
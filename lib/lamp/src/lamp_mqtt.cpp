@@ -0,0 +1,304 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             MQTT 3.1.1 packet encoding, parsing and client session (host tested)
+// *****************************************************************************
+#include <stdio.h>
+#include <string.h>
+#include "lamp_mqtt.h"
+
+
+uint16_t mqtt_putString(uint8_t *buf, uint16_t pos, const char *text){
+    uint16_t    len     = strlen(text);
+
+    buf[pos++] = len >> 8;
+    buf[pos++] = len & 0xFF;
+    memcpy(buf + pos, text, len);
+    return pos + len;
+}
+
+
+uint8_t mqtt_putHeader(uint8_t *buf, uint8_t header, uint16_t len){
+    uint8_t     n           = 0;
+
+    buf[n++] = header;
+    if (len > 127){                                                             // varint, bodies stay below 16K
+        buf[n++] = (len & 0x7F) | 0x80;
+        buf[n++] = len >> 7;
+    }
+    else {
+        buf[n++] = len;
+    }
+    return n;
+}
+
+
+int mqtt_frame(const uint8_t *buf, uint16_t len, uint32_t *remaining){
+    uint8_t     shift       = 0;
+    uint16_t    pos         = 1;
+
+    *remaining = 0;
+    do {
+        if (pos >= len){
+            return MQTT_FRAME_PARTIAL;
+        }
+        if (shift >= 28){
+            return MQTT_FRAME_BAD;                                              // fifth length byte
+        }
+        *remaining |= (uint32_t)(buf[pos] & 0x7F) << shift;
+        shift += 7;
+    } while (buf[pos++] & 0x80);
+    return pos;
+}
+
+
+uint16_t mqtt_connectBody(uint8_t *buf, const char *clientId, const char *willTopic, const char *willMessage,
+                          uint16_t keepalive){
+    uint16_t    len         = mqtt_putString(buf, 0, "MQTT");                   // protocol name, level 4 = 3.1.1
+
+    buf[len++] = 4;
+    buf[len++] = 0x02 | 0x04 | 0x20;                                            // clean session, will flag, will retain
+    buf[len++] = keepalive >> 8;
+    buf[len++] = keepalive & 0xFF;
+    len = mqtt_putString(buf, len, clientId);
+    len = mqtt_putString(buf, len, willTopic);
+    return mqtt_putString(buf, len, willMessage);
+}
+
+
+uint16_t mqtt_subscribeBody(uint8_t *buf, uint16_t id, const char *filter){
+    uint16_t    len;
+
+    buf[0] = id >> 8;
+    buf[1] = id & 0xFF;
+    len = mqtt_putString(buf, 2, filter);
+    buf[len++] = 0x00;                                                          // QoS 0
+    return len;
+}
+
+
+uint16_t mqtt_publishBody(uint8_t *buf, uint16_t size, const char *topic, const char *payload){
+    size_t      topicLen    = strlen(topic);
+    size_t      payloadLen  = strlen(payload);
+    uint16_t    len;
+
+    if ((2 + topicLen + payloadLen) > size){
+        return 0;
+    }
+    len = mqtt_putString(buf, 0, topic);
+    memcpy(buf + len, payload, payloadLen);
+    return len + payloadLen;
+}
+
+
+bool mqtt_parsePublish(uint8_t header, const uint8_t *data, uint16_t len, char *topic, uint16_t topicSize,
+                       char *payload, uint16_t payloadSize){
+    uint16_t    topicLen;
+    uint16_t    offset;
+
+    if (len < 2){
+        return false;
+    }
+    topicLen = (data[0] << 8) | data[1];
+    offset = 2 + topicLen + ((header & 0x06) ? 2 : 0);                          // skip a packet id if a broker upgraded QoS
+    if ((topicLen >= topicSize) || (offset > len) || ((len - offset) >= payloadSize)){
+        return false;
+    }
+    memcpy(topic, data + 2, topicLen);
+    topic[topicLen] = '\0';
+    memcpy(payload, data + offset, len - offset);
+    payload[len - offset] = '\0';
+    return true;
+}
+
+
+static bool mqtt_send(MqttSession *session, uint8_t header, const uint8_t *body, uint16_t len, unsigned long now){
+    uint8_t     fixed[MQTT_HEADER_MAX];
+    uint8_t     n           = mqtt_putHeader(fixed, header, len);
+
+    if (!session->write(session->ctx, fixed, n) || !session->write(session->ctx, body, len)){
+        mqtt_drop(session, now, "write failed");
+        return false;
+    }
+    session->stamp = now;
+    return true;
+}
+
+
+static void mqtt_command(MqttSession *session, const char *topic, const char *payload){
+    size_t      baseLen     = strlen(session->base);
+
+    if ((0 != strncmp(topic, session->base, baseLen)) || (0 != strncmp(topic + baseLen, "/set/", 5))){
+        return;
+    }
+    session->command(session->ctx, topic + baseLen + 5, payload);
+}
+
+
+static void mqtt_handle(MqttSession *session, uint8_t header, const uint8_t *data, uint16_t len, unsigned long now){
+    uint8_t     body[MQTT_TOPIC_LEN + 16];
+    char        topic[MQTT_TOPIC_LEN + 16];
+    char        payload[32];
+
+    switch (header & 0xF0){
+        case 0x20:                                                              // CONNACK
+            if ((len < 2) || (0 != data[1])){
+                snprintf(topic, sizeof(topic), "broker refused the connection (%u)", (len < 2) ? 0xFF : data[1]);
+                mqtt_drop(session, now, topic);
+                return;
+            }
+            session->state = MQTT_CONNECTED;
+            session->backoff = MQTT_BACKOFF_MIN;
+            session->reconnects += 1;
+            snprintf(topic, sizeof(topic), "%s/set/+", session->base);
+            if (!mqtt_send(session, 0x82, body, mqtt_subscribeBody(body, 1, topic), now)){  // SUBSCRIBE
+                return;
+            }
+            snprintf(topic, sizeof(topic), "%s/status", session->base);
+            mqtt_publish(session, topic, "online", true, now);
+            session->lastState[0] = '\0';                                       // republish the retained state
+            break;
+
+        case 0x30:                                                              // PUBLISH, QoS 0 only as subscribed
+            if (!mqtt_parsePublish(header, data, len, topic, sizeof(topic), payload, sizeof(payload))){
+                return;
+            }
+            session->rx += 1;
+            mqtt_command(session, topic, payload);
+            break;
+
+        default:                                                                // SUBACK, PINGRESP
+            break;
+    }
+}
+
+
+void mqtt_start(MqttSession *session, bool enabled, unsigned long now){
+    session->state = enabled ? MQTT_BACKOFF : MQTT_OFF;
+    session->backoff = 0;                                                       // first attempt right away
+    session->stamp = now;
+    session->bufLen = 0;
+}
+
+
+bool mqtt_due(const MqttSession *session, unsigned long now){
+    return (MQTT_BACKOFF == session->state) && ((now - session->stamp) >= session->backoff);
+}
+
+
+void mqtt_opening(MqttSession *session, unsigned long now){
+    session->state = MQTT_CONNECTING;
+    session->stamp = now;
+}
+
+
+void mqtt_opened(MqttSession *session, unsigned long now){
+    uint8_t     body[MQTT_BUF_SIZE];
+    char        topic[MQTT_TOPIC_LEN + 8];
+
+    snprintf(topic, sizeof(topic), "%s/status", session->base);
+    session->bufLen = 0;
+    session->state = MQTT_WAIT_CONNACK;
+    if (mqtt_send(session, 0x10, body, mqtt_connectBody(body, session->clientId, topic, "offline", MQTT_KEEPALIVE),
+                  now)){                                                        // CONNECT
+        session->rxStamp = now;
+    }
+}
+
+
+void mqtt_drop(MqttSession *session, unsigned long now, const char *why){
+    if (why != session->error){
+        snprintf(session->error, sizeof(session->error), "%s", why);
+    }
+    session->state = MQTT_BACKOFF;
+    session->stamp = now;
+    session->bufLen = 0;
+    session->backoff = session->backoff * 2;
+    if (session->backoff < MQTT_BACKOFF_MIN){
+        session->backoff = MQTT_BACKOFF_MIN;
+    }
+    else if (session->backoff > MQTT_BACKOFF_MAX){
+        session->backoff = MQTT_BACKOFF_MAX;
+    }
+    session->close(session->ctx);
+}
+
+
+void mqtt_process(MqttSession *session, unsigned long now){
+    uint32_t    remaining;
+    int         pos;
+
+    // handle every complete packet in the buffer, keep a partial one for the next run
+    while (session->bufLen >= 2){
+        pos = mqtt_frame(session->buf, session->bufLen, &remaining);
+        if (MQTT_FRAME_PARTIAL == pos){
+            return;
+        }
+        if ((MQTT_FRAME_BAD == pos) || ((pos + remaining) > MQTT_BUF_SIZE)){
+            mqtt_drop(session, now, "oversized packet");
+            return;
+        }
+        if ((pos + remaining) > session->bufLen){
+            return;
+        }
+        session->rxStamp = now;
+        mqtt_handle(session, session->buf[0], session->buf + pos, remaining, now);
+        if (MQTT_BACKOFF == session->state){                                    // handler dropped the link
+            return;
+        }
+        session->bufLen -= pos + remaining;
+        memmove(session->buf, session->buf + pos + remaining, session->bufLen);
+    }
+}
+
+
+bool mqtt_poll(MqttSession *session, unsigned long now){
+    uint8_t     ping[2]     = {0xC0, 0x00};                                     // PINGREQ
+
+    if (MQTT_WAIT_CONNACK == session->state){
+        if ((now - session->stamp) > MQTT_CONNACK_TIMEOUT){
+            mqtt_drop(session, now, "broker did not answer CONNECT");
+        }
+        return false;
+    }
+    if (MQTT_CONNECTED != session->state){
+        return false;
+    }
+    if ((now - session->rxStamp) > (MQTT_KEEPALIVE * 1500UL)){                  // 1.5x keep-alive, as a broker would
+        mqtt_drop(session, now, "broker timed out");
+        return false;
+    }
+    if ((now - session->stamp) > (MQTT_KEEPALIVE * 500UL)){
+        if (!session->write(session->ctx, ping, sizeof(ping))){
+            mqtt_drop(session, now, "write failed");
+            return false;
+        }
+        session->stamp = now;
+    }
+    return (now - session->publishStamp) >= MQTT_PUBLISH_INTERVAL;
+}
+
+
+void mqtt_publishState(MqttSession *session, const char *state, unsigned long now){
+    char        topic[MQTT_TOPIC_LEN + 8];
+
+    session->publishStamp = now;
+    if (0 == strcmp(state, session->lastState)){                                // changes in between are coalesced
+        return;
+    }
+    snprintf(topic, sizeof(topic), "%s/state", session->base);
+    if (mqtt_publish(session, topic, state, true, now)){
+        snprintf(session->lastState, sizeof(session->lastState), "%s", state);
+    }
+}
+
+
+bool mqtt_publish(MqttSession *session, const char *topic, const char *payload, bool retain, unsigned long now){
+    uint8_t     body[MQTT_BUF_SIZE];
+    uint16_t    len         = mqtt_publishBody(body, sizeof(body), topic, payload);
+
+    if ((0 == len) || !mqtt_send(session, retain ? 0x31 : 0x30, body, len, now)){
+        return false;
+    }
+    session->tx += 1;
+    return true;
+}
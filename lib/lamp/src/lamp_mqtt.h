@@ -0,0 +1,113 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             MQTT 3.1.1 packet encoding, parsing and client session (host tested)
+// *****************************************************************************
+#ifndef LAMP_MQTT_H
+#define LAMP_MQTT_H
+
+#include <stdint.h>
+
+
+#define MQTT_HEADER_MAX                 3                                       // fixed header, bodies below 16K
+#define MQTT_FRAME_PARTIAL              0                                       // mqtt_frame(): need more bytes
+#define MQTT_FRAME_BAD                  -1                                      // mqtt_frame(): length field over 4 bytes
+#define MQTT_TOPIC_LEN                  48
+#define MQTT_BUF_SIZE                   256                                     // largest packet handled, bigger ones drop the link
+#define MQTT_KEEPALIVE                  30                                      // (s)
+#define MQTT_CONNACK_TIMEOUT            5000                                    // (ms)
+#define MQTT_BACKOFF_MIN                1000                                    // (ms) reconnect delay, doubles per failure
+#define MQTT_BACKOFF_MAX                60000                                   // (ms)
+#define MQTT_PUBLISH_INTERVAL           100                                     // (ms) state publishes are coalesced to this
+#define MQTT_STATE_LEN                  96
+#define MQTT_ERROR_LEN                  96
+
+
+typedef enum {
+    MQTT_OFF                            = 0,                                    // no broker configured
+    MQTT_BACKOFF,                                                               // waiting to reconnect
+    MQTT_CONNECTING,                                                            // DNS and TCP connect in progress
+    MQTT_WAIT_CONNACK,
+    MQTT_CONNECTED
+} MqttState;
+
+
+// Client session over any byte stream: the owner opens the connection and
+// feeds received bytes into buf, the session does the protocol and calls
+// back to write, close and apply <base>/set/<key> commands
+typedef struct {
+    MqttState       state;
+    char            base[MQTT_TOPIC_LEN];                                       // topic prefix, eperly/<chip id>
+    char            clientId[16];
+    uint8_t         buf[MQTT_BUF_SIZE];                                         // receive buffer, one packet at a time
+    uint16_t        bufLen;
+    char            lastState[MQTT_STATE_LEN];                                  // last retained state sent
+    unsigned long   backoff;                                                    // (ms)
+    unsigned long   stamp;                                                      // (ms) state entry / last send
+    unsigned long   rxStamp;                                                    // (ms) last packet from the broker
+    unsigned long   publishStamp;                                               // (ms)
+    unsigned long   rx;                                                         // messages received
+    unsigned long   tx;                                                         // messages published
+    unsigned long   reconnects;
+    char            error[MQTT_ERROR_LEN];                                      // why the link was last dropped
+    void            *ctx;
+    bool            (*write)(void *ctx, const uint8_t *data, uint16_t len);     // false drops the link
+    void            (*close)(void *ctx);                                        // link dropped, error[] says why
+    void            (*command)(void *ctx, const char *key, const char *payload);
+} MqttSession;
+
+
+// Appends a length-prefixed UTF-8 string at pos, returns the new position
+uint16_t mqtt_putString(uint8_t *buf, uint16_t pos, const char *text);
+
+// Writes the fixed header for a body of len bytes (< 16K), returns its size
+uint8_t mqtt_putHeader(uint8_t *buf, uint8_t header, uint16_t len);
+
+// Splits the next packet off a receive buffer. Returns the fixed header
+// size with *remaining = body length, MQTT_FRAME_PARTIAL or MQTT_FRAME_BAD.
+// The packet is complete once len >= return value + *remaining.
+int mqtt_frame(const uint8_t *buf, uint16_t len, uint32_t *remaining);
+
+// CONNECT body: level 4, clean session, retained QoS 0 last will
+uint16_t mqtt_connectBody(uint8_t *buf, const char *clientId, const char *willTopic, const char *willMessage,
+                          uint16_t keepalive);
+
+// SUBSCRIBE body for one QoS 0 topic filter
+uint16_t mqtt_subscribeBody(uint8_t *buf, uint16_t id, const char *filter);
+
+// PUBLISH body (topic + payload), 0 if it does not fit size
+uint16_t mqtt_publishBody(uint8_t *buf, uint16_t size, const char *topic, const char *payload);
+
+// Copies topic and payload of a PUBLISH body out as C strings. Skips the
+// packet id a broker adds when it upgrades QoS. False if malformed or
+// either part does not fit its buffer.
+bool mqtt_parsePublish(uint8_t header, const uint8_t *data, uint16_t len, char *topic, uint16_t topicSize,
+                       char *payload, uint16_t payloadSize);
+
+// Enables (BACKOFF, first attempt right away) or disables the session.
+// base, clientId and the callbacks are set by the caller beforehand.
+void mqtt_start(MqttSession *session, bool enabled, unsigned long now);
+
+// True in BACKOFF once the reconnect delay is over: open the connection
+// and call mqtt_opening()
+bool mqtt_due(const MqttSession *session, unsigned long now);
+void mqtt_opening(MqttSession *session, unsigned long now);
+
+// Connection is up: sends CONNECT and waits for the CONNACK
+void mqtt_opened(MqttSession *session, unsigned long now);
+
+// Closes the link and doubles the reconnect delay (MIN..MAX)
+void mqtt_drop(MqttSession *session, unsigned long now, const char *why);
+
+// Handles every complete packet in buf, keeps a partial one
+void mqtt_process(MqttSession *session, unsigned long now);
+
+// CONNACK and keep-alive timeouts, pings. True when the state is due for
+// publishing, the caller then formats it for mqtt_publishState().
+bool mqtt_poll(MqttSession *session, unsigned long now);
+
+// Retained state to <base>/state, skipped if unchanged since the last one
+void mqtt_publishState(MqttSession *session, const char *state, unsigned long now);
+
+bool mqtt_publish(MqttSession *session, const char *topic, const char *payload, bool retain, unsigned long now);
+
+#endif
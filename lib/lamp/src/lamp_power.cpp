@@ -0,0 +1,51 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             LED power model, hardware independent (host tested)
+// *****************************************************************************
+#include "lamp_power.h"
+
+
+#define POWER_FULL_SCALE                (255ULL * 0xFFFF * 0xFFFF)              // color * curve peak * brightness scale
+
+
+uint64_t power_weight(const uint8_t *rgb, const uint8_t *profile, const uint16_t *curves, uint8_t points, uint16_t leds){
+    const uint16_t  *peak;
+    uint64_t        weight      = 0;
+
+    for (uint16_t i = 0; i < leds; i++){                                        // single pass over the color frame
+        peak = curves + ((uint32_t)profile[i] * 3 * points) + points - 1;       // curves are monotonic, the last point is the peak
+        weight += (uint32_t)rgb[0] * peak[0];
+        weight += (uint32_t)rgb[1] * peak[points];
+        weight += (uint32_t)rgb[2] * peak[2 * points];
+        rgb += 3;
+    }
+    return weight;
+}
+
+
+uint32_t power_current(const PowerModel *model, uint64_t weight, uint16_t scale){
+    return ((uint32_t)model->leds * model->idle) + ((weight * model->channel * scale) / POWER_FULL_SCALE);
+}
+
+
+uint16_t power_limit(const PowerModel *model, uint64_t weight, uint16_t scale){
+    uint32_t        idle        = (uint32_t)model->leds * model->idle;
+
+    if (power_current(model, weight, scale) <= model->budget){
+        return scale;
+    }
+    if (model->budget <= idle){
+        return 0;
+    }
+    return ((uint64_t)(model->budget - idle) * POWER_FULL_SCALE) / (weight * model->channel);
+}
+
+
+uint32_t power_chargeMAh(uint64_t charge){
+    return charge / 3600000000ULL;                                              // 1mAh = 3.6e9 mA*us
+}
+
+
+uint32_t power_energyMWh(uint64_t charge, uint16_t millivolts){
+    return (charge / 3600000ULL) * millivolts / 1000000ULL;
+}
@@ -0,0 +1,33 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             LED power model, hardware independent (host tested)
+// *****************************************************************************
+#ifndef LAMP_POWER_H
+#define LAMP_POWER_H
+
+#include <stdint.h>
+
+
+typedef struct {
+    uint16_t        leds;
+    uint16_t        budget;                                                     // (mA) LEDs only
+    uint8_t         idle;                                                       // (mA) per LED, all channels off
+    uint8_t         channel;                                                    // (mA) one channel at full scale
+} PowerModel;
+
+
+// Sum of color * calibrated peak over every channel of an RGB frame.
+// curves is [profile][3][points], pixel i uses the curves of profile[i].
+uint64_t power_weight(const uint8_t *rgb, const uint8_t *profile, const uint16_t *curves, uint8_t points, uint16_t leds);
+
+// Current (mA) drawn by a frame of that weight at a 16-bit brightness scale
+uint32_t power_current(const PowerModel *model, uint64_t weight, uint16_t scale);
+
+// Largest scale up to the requested one that keeps the frame within budget
+uint16_t power_limit(const PowerModel *model, uint64_t weight, uint16_t scale);
+
+// Charge accumulated in mA*us, converted for reporting
+uint32_t power_chargeMAh(uint64_t charge);
+uint32_t power_energyMWh(uint64_t charge, uint16_t millivolts);
+
+#endif
@@ -0,0 +1,47 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Per-client token buckets for web server admission (host tested)
+// *****************************************************************************
+#include "lamp_rate.h"
+
+
+RateClient *rate_client(RateClient *clients, uint8_t count, uint32_t ip, unsigned long now){
+    RateClient  *oldest = &clients[0];
+
+    for (uint8_t i = 0; i < count; i++){
+        if (clients[i].ip == ip){
+            return &clients[i];
+        }
+        if ((now - clients[i].stamp) > (now - oldest->stamp)){
+            oldest = &clients[i];
+        }
+    }
+    // least recently seen client makes room, a new bucket starts full
+    oldest->ip = ip;
+    oldest->tokens = RATE_BURST * RATE_TOKEN;
+    oldest->stamp = now;
+    oldest->requests = 0;
+    oldest->throttled = 0;
+    return oldest;
+}
+
+
+bool rate_take(RateClient *client, unsigned long now){
+    unsigned long   elapsed = now - client->stamp;
+
+    if (elapsed > (RATE_BURST * RATE_TOKEN / RATE_PER_SECOND)){                 // long idle, bucket is full anyway
+        elapsed = RATE_BURST * RATE_TOKEN / RATE_PER_SECOND;
+    }
+    client->tokens += elapsed * RATE_PER_SECOND;
+    if (client->tokens > (RATE_BURST * RATE_TOKEN)){
+        client->tokens = RATE_BURST * RATE_TOKEN;
+    }
+    client->stamp = now;
+    client->requests += 1;
+    if (client->tokens >= RATE_TOKEN){
+        client->tokens -= RATE_TOKEN;
+        return true;
+    }
+    client->throttled += 1;
+    return false;
+}
@@ -0,0 +1,34 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Per-client token buckets for web server admission (host tested)
+// *****************************************************************************
+#ifndef LAMP_RATE_H
+#define LAMP_RATE_H
+
+#include <stdint.h>
+
+
+#define RATE_CLIENTS                    8                                       // clients with their own bucket
+#define RATE_TOKEN                      1000                                    // bucket units per request
+#define RATE_PER_SECOND                 10                                      // sustained requests/s per client
+#define RATE_BURST                      20                                      // requests a client can send at once
+
+
+typedef struct {
+    uint32_t        ip;
+    unsigned long   tokens;                                                     // RATE_TOKEN per request
+    unsigned long   stamp;                                                      // (ms) last request, bucket refilled to here
+    unsigned long   requests;
+    unsigned long   throttled;                                                  // answered with 429
+} RateClient;
+
+
+// Bucket of ip (0 = unused slot); a new client recycles the least recently
+// seen one and starts with a full bucket
+RateClient *rate_client(RateClient *clients, uint8_t count, uint32_t ip, unsigned long now);
+
+// Refills the bucket up to now (ms), counts the request and takes a token.
+// False when the bucket is empty: answer 429, counted in throttled.
+bool rate_take(RateClient *client, unsigned long now);
+
+#endif
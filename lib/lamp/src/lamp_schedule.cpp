@@ -0,0 +1,41 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Schedule next-event computation (host tested)
+// *****************************************************************************
+#include "lamp_schedule.h"
+
+
+int8_t schedule_next(const ScheduleEntry *entries, uint8_t count, time_t from, int8_t after, time_t *when){
+    struct tm       today;
+    struct tm       event;
+    time_t          at;
+    int8_t          next    = -1;
+
+    localtime_r(&from, &today);
+    for (uint8_t i = 0; i < count; i++){
+        if (!entries[i].enabled || (0 == (entries[i].days & 0x7F))){
+            continue;
+        }
+        for (uint8_t d = 0; d < 8; d++){                                        // today .. same weekday next week
+            if (0 == (entries[i].days & (1 << ((today.tm_wday + d) % 7)))){
+                continue;
+            }
+            event = today;
+            event.tm_mday += d;
+            event.tm_hour = entries[i].hour;
+            event.tm_min = entries[i].minute;
+            event.tm_sec = 0;
+            event.tm_isdst = -1;                                                // mktime() resolves DST for that day
+            at = mktime(&event);
+            if ((at < from) || ((at == from) && (i <= after))){                 // already fired
+                continue;
+            }
+            if ((next < 0) || (at < *when)){                                    // ties keep the lower index
+                next = i;
+                *when = at;
+            }
+            break;
+        }
+    }
+    return next;
+}
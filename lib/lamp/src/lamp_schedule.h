@@ -0,0 +1,28 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Schedule next-event computation (host tested)
+// *****************************************************************************
+#ifndef LAMP_SCHEDULE_H
+#define LAMP_SCHEDULE_H
+
+#include <stdint.h>
+#include <time.h>
+
+
+typedef struct __attribute__((packed)) {
+    uint8_t     enabled;
+    uint8_t     hour;
+    uint8_t     minute;
+    uint8_t     days;                                                           // bit 0 = Sunday ... bit 6 = Saturday
+    uint8_t     state;                                                          // 0 = fade out and switch off, 1 = on
+    uint8_t     brightness;                                                     // target when switching on
+    uint16_t    fade;                                                           // (s)
+} ScheduleEntry;
+
+
+// Next event strictly after (from, after) in (local time, index) order, so
+// entries sharing a minute fire one after another. after = -1 includes events
+// due at from itself. Returns the entry index and sets *when, -1 if none.
+int8_t schedule_next(const ScheduleEntry *entries, uint8_t count, time_t from, int8_t after, time_t *when);
+
+#endif
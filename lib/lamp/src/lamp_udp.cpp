@@ -0,0 +1,98 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Binary UDP control protocol codec (host tested)
+// *****************************************************************************
+#include <string.h>
+#include "lamp_udp.h"
+
+
+bool udp_parse(const uint8_t *buf, int len, UdpPacket *packet){
+    if ((len < UDP_HEADER_SIZE) || (len >= UDP_PACKET_MAX) || ('E' != buf[0]) || ('P' != buf[1]) ||
+        (UDP_CTRL_VERSION != buf[2])){
+        return false;
+    }
+    packet->flags = buf[3];
+    packet->seq = buf[4] | (buf[5] << 8);
+    packet->ops = buf + UDP_HEADER_SIZE;
+    packet->len = len - UDP_HEADER_SIZE;
+    return true;
+}
+
+
+uint8_t udp_decode(const uint8_t *ops, uint8_t len, uint8_t patternMax, uint8_t paletteSize, UdpCommand *cmd){
+    uint8_t     pos         = 0;
+
+    cmd->has = 0;
+    // validate the whole packet first, so a malformed one changes nothing
+    while (pos < len){
+        switch (ops[pos]){
+            case UDP_OP_STATE:
+            case UDP_OP_BRIGHTNESS:
+            case UDP_OP_PALETTE_COLOR:  pos += 2;   break;
+            case UDP_OP_PATTERN:        if (((pos + 1) < len) && (ops[pos + 1] > patternMax)){
+                                            return UDP_STATUS_BAD;
+                                        }
+                                        pos += 2;   break;
+            case UDP_OP_RGB:            pos += 4;   break;
+            default:                    return UDP_STATUS_BAD;
+        }
+    }
+    if (pos != len){
+        return UDP_STATUS_BAD;
+    }
+
+    for (pos = 0; pos < len; ){
+        switch (ops[pos]){
+            case UDP_OP_STATE:
+                cmd->state = (0 != ops[pos + 1]);
+                cmd->has |= UDP_HAS_STATE;
+                pos += 2;
+                break;
+            case UDP_OP_BRIGHTNESS:
+                cmd->brightness = ops[pos + 1];
+                cmd->has |= UDP_HAS_BRIGHTNESS;
+                pos += 2;
+                break;
+            case UDP_OP_PALETTE_COLOR:
+                if (ops[pos + 1] < paletteSize){
+                    cmd->index = ops[pos + 1];
+                    cmd->has |= UDP_HAS_COLOR | UDP_HAS_PALETTE;
+                }
+                pos += 2;
+                break;
+            case UDP_OP_PATTERN:
+                cmd->pattern = ops[pos + 1];
+                cmd->has |= UDP_HAS_PATTERN;
+                pos += 2;
+                break;
+            case UDP_OP_RGB:
+                memcpy(cmd->rgb, ops + pos + 1, 3);
+                cmd->has = (cmd->has | UDP_HAS_COLOR) & ~UDP_HAS_PALETTE;
+                pos += 4;
+                break;
+        }
+    }
+    return UDP_STATUS_OK;
+}
+
+
+void udp_reply(const uint8_t *request, uint8_t status, uint8_t *reply){
+    memcpy(reply, request, UDP_HEADER_SIZE);
+    reply[3] = UDP_FLAG_ACK;
+    reply[UDP_HEADER_SIZE] = status;
+}
+
+
+uint8_t udp_build(uint8_t *buf, uint8_t flags, uint16_t seq, const uint8_t *ops, uint8_t len){
+    if ((UDP_HEADER_SIZE + len) >= UDP_PACKET_MAX){
+        return 0;
+    }
+    buf[0] = 'E';
+    buf[1] = 'P';
+    buf[2] = UDP_CTRL_VERSION;
+    buf[3] = flags;
+    buf[4] = seq & 0xFF;
+    buf[5] = seq >> 8;
+    memcpy(buf + UDP_HEADER_SIZE, ops, len);
+    return UDP_HEADER_SIZE + len;
+}
@@ -0,0 +1,71 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Module:             Binary UDP control protocol codec (host tested)
+// *****************************************************************************
+#ifndef LAMP_UDP_H
+#define LAMP_UDP_H
+
+#include <stdint.h>
+
+
+#define UDP_CTRL_VERSION                1
+#define UDP_PACKET_MAX                  64                                      // (bytes) larger datagrams are rejected
+#define UDP_HEADER_SIZE                 6                                       // 'E' 'P' version flags seq(le16)
+#define UDP_REPLY_SIZE                  (UDP_HEADER_SIZE + 1)                   // header + status
+#define UDP_FLAG_ACK_REQ                0x01                                    // sender wants a status reply
+#define UDP_FLAG_ACK                    0x80                                    // set in replies
+#define UDP_OP_STATE                    0x01                                    // + 0/1
+#define UDP_OP_BRIGHTNESS               0x02                                    // + level
+#define UDP_OP_RGB                      0x03                                    // + r g b
+#define UDP_OP_PATTERN                  0x04                                    // + LEDPattern (STATIC..ROTATE)
+#define UDP_OP_PALETTE_COLOR            0x05                                    // + index into the active palette
+#define UDP_STATUS_OK                   0
+#define UDP_STATUS_STALE                1                                       // sequence older than the last applied
+#define UDP_STATUS_BAD                  2                                       // malformed, nothing applied
+#define UDP_HAS_STATE                   0x01                                    // UdpCommand.has
+#define UDP_HAS_BRIGHTNESS              0x02
+#define UDP_HAS_COLOR                   0x04                                    // rgb, from UDP_OP_RGB or the palette
+#define UDP_HAS_PALETTE                 0x08                                    // color is palette index, not rgb
+#define UDP_HAS_PATTERN                 0x10
+
+
+typedef struct {
+    uint8_t         flags;
+    uint16_t        seq;
+    const uint8_t   *ops;                                                       // points into the datagram
+    uint8_t         len;
+} UdpPacket;
+
+
+typedef struct {
+    uint8_t         has;                                                        // UDP_HAS_*
+    bool            state;
+    uint8_t         brightness;
+    uint8_t         rgb[3];
+    uint8_t         index;                                                      // palette color, with UDP_HAS_PALETTE
+    uint8_t         pattern;
+} UdpCommand;
+
+
+// Checks magic, version and size of a datagram, len = bytes read into a
+// UDP_PACKET_MAX buffer (a full buffer means it was truncated).
+bool udp_parse(const uint8_t *buf, int len, UdpPacket *packet);
+
+// Validates the whole op list before anything is applied. Later ops win,
+// a palette index at or past paletteSize is ignored like the op was absent.
+// Returns UDP_STATUS_OK, or UDP_STATUS_BAD with cmd->has = 0.
+uint8_t udp_decode(const uint8_t *ops, uint8_t len, uint8_t patternMax, uint8_t paletteSize, UdpCommand *cmd);
+
+// Sequence comparison with 16-bit wrap: true if seq supersedes last
+static inline bool udp_newer(uint16_t seq, uint16_t last){
+    return (int16_t)(uint16_t)(seq - last) > 0;
+}
+
+// Ack for a request header: same magic, version and seq, UDP_REPLY_SIZE bytes
+void udp_reply(const uint8_t *request, uint8_t status, uint8_t *reply);
+
+// Request builder, as sent by the sliders. Returns the datagram length,
+// 0 if the ops do not fit UDP_PACKET_MAX.
+uint8_t udp_build(uint8_t *buf, uint8_t flags, uint16_t seq, const uint8_t *ops, uint8_t len);
+
+#endif
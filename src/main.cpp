@@ -1,10 +1,10 @@
 // *****************************************************************************
 //  Project:            Eperly - Lite
-//  Firmware Version:   1.1
+//  Firmware Version:   1.2
 //  MCU:                diyMore ESP8266 with 0.99" OLED LCD Module
 //  Author:             Mark Angelo Tarvina (Tarvs' Hobbytronics)
 //  Email:              mttarvina@gmail.com
-//  Last Updated:       09.Jan.2024
+//  Last Updated:       19.Oct.2026
 // *****************************************************************************
 
 
@@ -26,44 +26,497 @@
 //          - Now checks the uri link and determines what color index is present
 //          - in the hyperlink
 //          - Removed typedef enum ColorSheme
+//
+// v1.2
+//      + LED frames are now kept at 16-bit per channel and refreshed at a fixed
+//          rate (LED_REFRESH_PERIOD) with temporal error-diffusion dithering
+//          - Brightness follows a perceptual (squared) curve down to near zero
+//          - Color correction is folded into the 16-bit frame
+//          - Refresh rate, CPU load and show() time are reported at /stats
+//      + Added a per-frame power model and supply budget limiter
+//          - Frames estimated above LED_POWER_BUDGET are scaled down
+//          - Current, peak current, limited frames and mAh/mWh are at /stats
+//      + Added user palettes and scenes stored in LittleFS
+//          - Fixed-size records, recalled by ID with a single seek
+//          - Palette grid in the webpage is generated from the active palette
+//          - Rotate and heartbeat delays are now runtime scene parameters
+//          - Edits answer with a 303 and only change RAM once the write succeeded
+//      + Webpages are streamed from PROGMEM templates with chunked transfer
+//          - {{placeholders}} are formatted into a fixed stack buffer
+//          - Active page shows brightness, RGB values and the selected color
+//          - Peak heap used per render is reported at /stats
+//          - Outputs cut at HTML_CHUNK_SIZE are logged and counted (renderTruncated)
+//      + Added SoftAP captive portal provisioning when no WiFi info is saved
+//          - Runs as a non-blocking state machine in loop(), LEDs keep running
+//          - Networks are scanned asynchronously and listed in the portal
+//          - Credentials are saved to EEPROM once the lamp joins the network
+//          - Time from power-on to provisioned is reported at /stats
+//      + Serial WiFi wizard and EEPROM reader are now bounds checked
+//      + Replaced blocking Serial prints with a buffered, leveled log
+//          - LOG_LEVEL strips disabled levels at compile time (replaces DEBUG)
+//          - Lines go to a ring buffer drained from loop() without blocking
+//          - Sinks: UART at 115200 baud, UDP syslog and the /log tail page
+//          - Bytes lost to a slow sink are counted per sink at /stats
+//          - Syslog packets are built on the stack, no printf() allocations
+//      + loop() now runs a cooperative scheduler with prioritized tasks
+//          - LED frame, network, display, persistence and telemetry tasks
+//          - Due tasks run by priority, then earliest deadline
+//          - Idles with yield()/delay() when nothing is due
+//          - Per-task runs, CPU time, worst lateness and missed deadlines at /stats
+//          - OLED updates and palette selection writes are deferred to tasks
+//      + Control commands are coalesced, last writer wins
+//          - Handlers only update the target state and answer 303 -> /
+//          - The LED task applies the latest state once per frame
+//          - Received and merged command counts are reported at /stats
+//          - Fixed r/g/b fine tuning wrapping around at 0 and 255
+//          - Every color source sets the r/g/b tuning values too, and they
+//          - are kept while the lamp is off
+//      + Added binary full-frame upload for per-pixel control (FRAME pattern)
+//          - HTTP POST /frame with an application/octet-stream body
+//          - Raw TCP stream of packed frames on FRAME_TCP_PORT
+//          - Body is streamed into a double buffer, committed at the next frame
+//          - Received frames, frame rate and rejected frames at /stats
+//          - tools/frame_stream.py measures sustained frames/s over HTTP and TCP
+//      + Added user effects (EFFECT pattern) run by a small bytecode VM
+//          - Per-pixel expressions for r;g;b over t (time), i (index), n
+//          - Compiled and verified on upload, stored in LittleFS
+//          - Static budget: estimated CPU cycles per op x pixels must fit
+//          - EFFECT_FRAME_BUDGET, so slow code is refused at upload
+//          - 32-bit arithmetic wraps, x / 0 = 0, no traps on overflow
+//          - VM cycles per frame and ns per pixel-instruction at /stats
+//      + Hardware variants are selected with build flags instead of forks
+//          - LED_NUM, LED_PIN, LED_CHIPSET, LED_POWER_BUDGET, LCD_* override
+//          - LCD_ENABLED=0 compiles out the OLED, its task and splash delays
+//          - One platformio.ini environment per variant, variant at /stats
+//      + Added a loop-stall watchdog with post-mortems kept in RTC memory
+//          - Stalls, exceptions and WDT resets record route, task, stack
+//          - pointer, max loop/handler latency and heap low-water mark
+//          - Last post-mortem and reset counters at /diag and /stats
+//          - Boot-time WiFi connect gives up and starts the setup portal
+//      + Added signed OTA updates, pushed (POST /ota) or pulled (/ota/pull)
+//          - Image streams into the spare flash in chunks while LEDs animate
+//          - Pull DNS and connect are polled, /ota/pull answers at once
+//          - SHA-256 + RSA signature checked before the update is applied,
+//          - public key from include/ota_key.h (OTA off if it is missing)
+//          - New firmware must stay up for 30s; after 3 failed boots the
+//          - last confirmed pulled image is fetched again (rollback)
+//          - Throughput and LED refresh jitter during updates at /stats
+//      + Added a non-blocking MQTT client (/mqtt?host=&port= to configure)
+//          - Commands on eperly/<chip id>/set/{state,brightness,color,pattern}
+//          - Retained JSON state, coalesced to at most 10 publishes/s
+//          - Retained online/offline status with a last will
+//          - Reconnects with exponential backoff from a state machine (lib/lamp)
+//          - DNS and TCP connect finish in lwIP callbacks, loop() never waits
+//          - on the broker
+//          - Command-to-light latency and MQTT message rates at /stats
+//      + Added a binary UDP control protocol on port 7778 for sliders
+//          - Header "EP", version, flags, 16-bit sequence; stale packets
+//          - from the same sender are dropped, optional acks
+//          - Absolute ops: state, brightness, RGB, pattern, palette color
+//          - Parsed in place, applied at the next LED refresh
+//          - tools/udp_latency.py compares ack round trips with HTTP (p50/p99)
+//      + Web server keeps HTTP/1.1 connections open between requests
+//          - Max requests per connection is configurable; the server closes
+//          - idle ones itself, at once when another client is waiting
+//          - Pipelined requests are served in order from the same socket
+//          - Connection reuse counters at /stats, tools/http_keepalive.py
+//      + Added an audio-reactive pattern (/audio) driven from the A0 ADC
+//          - 200Hz sampling paced by the scheduler, the rate the core keeps
+//          - WiFi safe at (analogRead() is cached for 5ms while WiFi runs)
+//          - Streaming Q14 Goertzel bank over 16-sample blocks: 25, 50 and
+//          - 88Hz bins; feed A0 through a ~90Hz low-pass, higher content
+//          - aliases into them. Late samples restart the block (audioGaps)
+//          - Low band drives brightness, mid hue drift, high rotate speed
+//          - Cycles per block and audio-to-light latency at /stats
+//      + Added SNTP time and an on-device schedule table in LittleFS
+//          - Entries: time of day, weekday mask, on/off, brightness, fade
+//          - Fades run in the LED task, no requests needed
+//          - Next event is precomputed, the task sleeps until it is due
+//      + ROTATE now moves smoothly at the LED refresh rate
+//          - 8.8 fixed point head position, light split between neighbours
+//          - Linear tail of configurable length (/rotate/config)
+//          - Integer only, render cycles at /stats
+//      + Runtime paths no longer build temporary Strings
+//          - Error replies and OLED lines are formatted into static buffers
+//          - nodemcuv2-heaptrap wraps malloc/calloc/realloc at link time;
+//          - HEAP_TRAP=1 counts allocations after boot per call site (/heap),
+//          - HEAP_TRAP=2 also aborts on one from the LED/audio tasks (opt-in, the
+//          - web server, lwIP and LittleFS still allocate per request)
+//          - Heap soak against a running lamp: tools/heap_soak.py
+//          - Free heap, largest block and fragmentation low-water at /stats
+//      + Added a request trace recorder, downloaded as binary from /trace
+//          - Fixed RAM ring of the last TRACE_RECORDS requests: time, route,
+//          - handler duration, body bytes, heap before/after, LED show time
+//          - Registered route names are interned and sent with the records,
+//          - 404s and probes share one "other" route
+//          - tools/trace_replay.py replays a download against a lamp or a native build
+//          - /trace?clear=1 starts a new recording
+//      + Added a push button and rotary encoder for local control
+//          - Button toggles the lamp, encoder steps the brightness
+//          - Edge interrupts feed a lock-free queue, the button is debounced
+//          - by the input task, changes are shown within one LED frame
+//          - INPUT_* build flags select the pins, 0 disables the inputs
+//      + The lamp announces itself over mDNS as eperly-lite-<chip id>.local
+//          - DNS-SD services _http._tcp and _eperly._udp (UDP control)
+//          - TXT: firmware version, variant, pixel count, protocol, features
+//          - Answers are built once per IP lease and sent from that buffer
+//          - Legacy resolvers (source port not 5353) get a unicast reply with
+//          - the question echoed, no cache-flush bits and TTLs capped at 10s
+//          - Also used as the DHCP hostname; query/reply counters at /stats
+//      + Added per-pixel color calibration for mixed LED batches
+//          - 4 calibration profiles, 17-point 16-bit curve per channel,
+//          - each pixel is assigned a profile, stored in LittleFS
+//          - Set from measured points or white balance gains and gamma
+//          - Replaces the global correction in the fused refresh pass
+//          - (curve, brightness, dither), cycles per frame at /stats
+//          - Curves must be non-decreasing; the power limiter weighs each
+//          - pixel with the peak of its own curves
+//      + Web server admission control keeps abusive clients off the LED frame
+//          - Per-IP token buckets, empty bucket = bare 429 before any parsing
+//          - At most SERVER_ADMIT_PER_FRAME requests start per LED frame,
+//          - the rest wait in their sockets for the next frame
+//          - Throttled/deferred counts and per-client figures at /stats
+//          - tools/http_flood.py replays an abusive client on the bench
+//      + Hardware independent logic lives in lib/lamp, unit tested on the
+//          host with pio test -e native (test/)
+//          - Power model and limiter, curve/brightness/dither pass
+//          - Effect compiler, verifier and VM (with a host ns/op benchmark)
+//          - UDP control codec: parse, validate, ack (round trip benchmark)
+//          - MQTT packet encoding, framing and PUBLISH parsing
+//          - Goertzel bank on synthesized tones and a recorded-style clip
+//          - Schedule next event: weekdays, same-minute entries, DST days
+//          - mDNS answers, query matching, legacy replies (50 lamp discovery benchmark)
+//          - Token buckets, and LED frame deadlines under an abusive client
+//          - MQTT session against a broker stand-in, 50 lamps (command to light
+//          - latency, broker message rate)
+//          - Log lines, ring and syslog packets (hot path cost benchmark)
 // *****************************************************************************
 
 
 #include <Arduino.h>
+#define FASTLED_ALLOW_INTERRUPTS        1                                       // re-enable interrupts between pixels
 #include <FastLED.h>
 #include <ESP8266WiFi.h>
 #include <ESP8266WebServer.h>
+#include <DNSServer.h>
+#include <WiFiUdp.h>
 #include <EEPROM.h>
+#include <LittleFS.h>
+#include <Ticker.h>
+#include <Updater.h>
+#include <BearSSLHelpers.h>
+#include <coredecls.h>                                                          // settimeofday_cb()
+#include <lwip/tcp.h>                                                           // raw API, connects without blocking loop()
+#include <lwip/dns.h>
 #include <Wire.h>
 #include "SSD1306Wire.h"
+#include "lamp_power.h"                                                         // lib/lamp, hardware independent, host tested
+#include "lamp_mix.h"
+#include "lamp_effect.h"
+#include "lamp_udp.h"
+#include "lamp_mqtt.h"
+#include "lamp_audio.h"
+#include "lamp_schedule.h"
+#include "lamp_mdns.h"
+#include "lamp_rate.h"
+#include "lamp_log.h"
+#if __has_include("ota_key.h")
+#include "ota_key.h"                                                            // defines OTA_PUBLIC_KEY (PEM), not in git
+#endif
+
+
+// Hardware variant, override with build_flags in platformio.ini
+#ifndef LAMP_VARIANT
+#define LAMP_VARIANT                    "nodemcuv2"
+#endif
+#ifndef LED_NUM
+#define LED_NUM                         8                                       // 8 LEDs in Neopixel ring
+#endif
+#ifndef LED_PIN
+#define LED_PIN                         D1                                      // D5
+#endif
+#ifndef LED_CHIPSET
+#define LED_CHIPSET                     NEOPIXEL                                // FastLED chipset, sets color order
+#endif
+#ifndef LED_POWER_BUDGET
+#define LED_POWER_BUDGET                400                                     // (mA) LEDs only, leaves room for the MCU on 500mA USB
+#endif
+#ifndef LCD_ENABLED
+#define LCD_ENABLED                     1                                       // 0 = no OLED fitted
+#endif
+#ifndef LCD_SDA_PIN
+#define LCD_SDA_PIN                     D5
+#endif
+#ifndef LCD_SCL_PIN
+#define LCD_SCL_PIN                     D6
+#endif
+#ifndef LCD_ADDR
+#define LCD_ADDR                        0x3c
+#endif
+#ifndef INPUT_ENABLED
+#define INPUT_ENABLED                   1                                       // 0 = no button or encoder fitted
+#endif
+#ifndef INPUT_BUTTON_PIN
+#define INPUT_BUTTON_PIN                D3                                      // on-board FLASH button, active low
+#endif
+#ifndef INPUT_ENC_A_PIN
+#define INPUT_ENC_A_PIN                 D2                                      // rotary encoder, common pin to GND
+#endif
+#ifndef INPUT_ENC_B_PIN
+#define INPUT_ENC_B_PIN                 D7
+#endif
+#ifndef HEAP_TRAP
+#define HEAP_TRAP                       0                                       // 0 = off, 1 = count allocations after boot, 2 = also abort in urgent tasks
+#endif
+
+#if (LED_NUM < 1) || (LED_NUM > 255)
+#error "LED_NUM must fit the uint8_t pixel indices (1..255)"
+#endif
 
 
 // Definitions
-#define DEBUG                           false
+#define LOG_LEVEL                       LOG_LEVEL_INFO                          // levels above this are compiled out
+#define LOG_SINK_UART                   0x01
+#define LOG_SINK_SYSLOG                 0x02
+#define LOG_SINKS                       LOG_SINK_UART                           // default sinks, /log is always available
+#define LOG_BUFFER_SIZE                 2048                                    // power of 2
+#define LOG_LINE_LEN                    128
+#define LOG_SYSLOG_LEN                  (LOG_LINE_LEN + 32)                     // line plus "<pri>host: "
+#define LOG_UART_BAUD                   115200
+#define LOG_SYSLOG_PORT                 514
+#define LOG_SYSLOG_LINES                4                                       // max packets sent per loop()
 #define SERIAL_TIMEOUT                  8000
 #define WIFI_PORT                       80
 #define SERVER_TIMEOUT                  5000                                    // (ms)
+#define HTTP_KEEPALIVE                  1                                       // 0 = close after every response
+#define HTTP_KEEPALIVE_MAX              32                                      // requests per connection, the last one closes
+#define SERVER_ADMIT_PER_FRAME          1                                       // requests started between two LED frames
+#define DNS_PORT                        53
+#define PROV_AP_PREFIX                  "Eperly-Lite-"                          // SoftAP SSID = prefix + chip id
+#define PROV_CONNECT_TIMEOUT            20000                                   // (ms)
 #define LED_MAX_BRIGHTNESS              255
-#define LED_MIN_BRIGHTNESS              15
-#define LED_NUM                         8                                       // 8 LEDs in Neopixel ring
-#define LED_PIN                         D1                                      // D5
-#define LED_ROT_TRANS_DELAY             1000                                    // (ms)
+#define LED_MIN_BRIGHTNESS              5
+#define LED_ROT_TRANS_DELAY             1000                                    // (ms) per pixel
+#define LED_ROT_TAIL                    2                                       // (pixels) fading trail behind the head
 #define LED_HRTBT_TRANS_DELAY           50                                      // (ms)
 #define LED_HRTBT_BRIGHTNESS_INC        2                                       
 #define LED_BRIGHTNESS_INC              25
 #define LED_COLOR_TUNE_INC              5                                      
+#define LED_REFRESH_PERIOD              2500                                    // (us) 400Hz dithered refresh
+#define LED_COLOR_CORRECTION            TypicalSMD5050
+#define LED_STATS_WINDOW                1000                                    // (ms)
+#define LED_SUPPLY_VOLTAGE              5000                                    // (mV)
+#define LED_CHANNEL_CURRENT             20                                      // (mA) one channel at full scale
+#define LED_IDLE_CURRENT                1                                       // (mA) per LED, all channels off
 #define EEPROM_SIZE                     259                                     // 3 character indicators + 256 bytes for wifi ssid and password
-#define LCD_SDA_PIN                     D5
-#define LCD_SCL_PIN                     D6
+#define STORE_NAME_LEN                  16
+#define PALETTE_FILE                    "/palettes.bin"
+#define PALETTE_MAGIC                   0x4C415045                              // "EPAL"
+#define PALETTE_MAX                     4                                       // palette slots in flash
+#define PALETTE_SIZE                    40                                      // colors per palette, one /color/<n> route each
+#define SCENE_FILE                      "/scenes.bin"
+#define SCENE_MAGIC                     0x4E435345                              // "ESCN"
+#define SCENE_MAX                       16                                      // scene slots in flash
+#define CAL_FILE                        "/cal.bin"
+#define CAL_MAGIC                       0x4C414345                              // "ECAL"
+#define CAL_PROFILES                    4                                       // LED batches with their own curves
+#define CAL_POINTS                      MIX_CURVE_POINTS                        // curve points, color 0, 16, .. 256
+#define HTML_CHUNK_SIZE                 512                                     // fits one TCP segment (MSS 536)
+#define HTML_KEY_LEN                    16                                      // longest {{placeholder}} name
+#define SCHED_SLEEP_MIN                 2000                                    // (us) idle time worth a delay(1)
+#define LED_CMD_STATE                   0x01                                    // pending changes for led_apply()
+#define LED_CMD_PATTERN                 0x02
+#define LED_CMD_COLOR                   0x04
+#define LED_CMD_BRIGHTNESS              0x08
+#define LED_CMD_FRAME                   0x10
+#define FRAME_SIZE                      (LED_NUM * 3)                           // packed RGB, pixel 0 first
+#define FRAME_TCP_PORT                  7777
+#define FRAME_TCP_BURST                 4                                       // max frames read per poll
+#define AUDIO_PIN                       A0
+#define AUDIO_SAMPLE_PERIOD             5000                                    // (us) 200Hz, analogRead() is cached for 5ms while WiFi runs
+#define AUDIO_JITTER_MAX                500                                     // (us) later samples restart the block (the task deadline)
+#define AUDIO_IDLE_PERIOD               100000                                  // (us) task period while not in use
+#define AUDIO_BLOCK                     16                                      // samples per Goertzel block, 12.5Hz bins, 80ms
+#define AUDIO_BANDS                     3
+#define AUDIO_NOISE_FLOOR               64                                      // band magnitude treated as silence
+#define AUDIO_PEAK_MIN                  512                                     // AGC never amplifies beyond this
+#define AUDIO_PEAK_DECAY                4                                       // peak -= peak >> 4 per block (~1.3s)
+#define AUDIO_ROTATE_MIN                1                                       // (1/256 pixel per frame)
+#define SCHEDULE_FILE                   "/schedule.bin"
+#define SCHEDULE_MAGIC                  0x4C484353                              // "SCHL"
+#define SCHEDULE_MAX                    8
+#define SCHEDULE_TZ                     "UTC0"                                  // POSIX TZ, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+#define SCHEDULE_NTP_SERVER             "pool.ntp.org"
+#define SCHEDULE_EPOCH_VALID            1600000000                              // earlier clock = not synced yet
+#define SCHEDULE_SLEEP_MAX              60                                      // (s) longest task sleep, bounds clock jumps
+#define SCHEDULE_FADE_MAX               3600                                    // (s)
+#define UDP_CTRL_PORT                   7778
+#define UDP_BURST                       8                                       // max datagrams read per poll
+#define EFFECT_FILE                     "/effects.bin"
+#define EFFECT_MAGIC                    0x58464645                              // "EFFX"
+#define EFFECT_MAX                      4                                       // effect slots in flash
+#define EFFECT_CODE_SIZE                64                                      // (bytes) bytecode per effect
+#define EFFECT_SRC_LEN                  160                                     // longest expression source
+#define EFFECT_FRAME_BUDGET             16000                                   // (CPU cycles) all pixels, 200us of a frame at 80MHz
+#define EFFECT_TIME_SHIFT               2                                       // t = millis() >> 2, sin(t) ~ 1s period
+#define DIAG_MAGIC                      0x47414944                              // "DIAG"
+#define DIAG_RTC_OFFSET                 32                                      // (words) first 128 bytes belong to eboot
+#define DIAG_ROUTE_LEN                  32
+#define DIAG_TASK_LEN                   12
+#define DIAG_CHECK_PERIOD               500                                     // (ms) stall check, runs while loop() yields
+#define DIAG_STALL_TIMEOUT              5000                                    // (ms) no loop() iteration = stall
+#define DIAG_LOOP_SLOW                  100000                                  // (us) loop() iterations counted as slow
+#define DIAG_EVENT_NONE                 0
+#define DIAG_EVENT_STALL                1                                       // loop() stopped, restarted by the watchdog
+#define DIAG_EVENT_CRASH                2                                       // exception or hardware/software WDT reset
+#define NET_HOST_LEN                    64
+#define OTA_MAGIC                       0x5F41544F                              // "OTA_"
+#define OTA_RTC_OFFSET                  64                                      // (words) after the diag record
+#define OTA_FILE                        "/ota.bin"
+#define OTA_URL_LEN                     96
+#define OTA_LINE_LEN                    128                                     // longest HTTP header line kept
+#define OTA_CHUNK                       512                                     // (bytes) flash write per network task run
+#define OTA_TIMEOUT                     10000                                   // (ms) without data
+#define OTA_CONNECT_TIMEOUT             3000                                    // (ms) DNS and TCP connect, polled
+#define OTA_TRIAL_BOOTS                 3                                       // unconfirmed boots before rollback
+#define OTA_CONFIRM_DELAY               30000                                   // (ms) uptime that confirms a new image
+#define OTA_REBOOT_DELAY                1000                                    // (ms) lets the response go out
+#define SCHED_URGENT_PRIORITY           0                                       // tasks run by sched_runUrgent()
+#define MQTT_FILE                       "/mqtt.bin"
+#define MQTT_PORT                       1883
+#define MQTT_HOST_LEN                   64
+#define MQTT_CONNECT_TIMEOUT            5000                                    // (ms) DNS and TCP connect, polled
+#define HEAP_SITES                      8                                       // call sites tracked after boot
+#define HEAP_SAMPLE_PERIOD              1000                                    // (ms) largest block/fragmentation sampling
+#define SERVER_MSG_LEN                  96                                      // longest error reply text
+#define LCD_LINE_LEN                    32
+#define TRACE_MAGIC                     0x45435254                              // "TRCE"
+#define TRACE_VERSION                   2                                       // 2: 32 bit heap fields
+#define TRACE_RECORDS                   128                                     // ring size, 24 bytes each
+#define TRACE_ROUTES                    96                                      // registered routes interned, 80 today
+#define TRACE_ROUTE_LEN                 16                                      // longest registered path + NUL
+#define TRACE_ROUTE_OTHER               0xFF                                    // unregistered path, or route table full
+#define INPUT_QUEUE_LEN                 16                                      // power of 2
+#define INPUT_DEBOUNCE                  20                                      // (ms) quiet time before the button level is read
+#define INPUT_ENC_STEPS                 4                                       // quadrature steps per detent
+#define INPUT_ENC_BRIGHTNESS            10                                      // brightness change per detent
+#define INPUT_EV_EDGE                   1                                       // button changed, not debounced yet
+#define INPUT_EV_UP                     2                                       // encoder one detent clockwise
+#define INPUT_EV_DOWN                   3
+#define MDNS_PORT                       5353
+#define MDNS_PACKET_MAX                 1024                                    // precomputed answer, ~700 bytes used
+#define MDNS_QUERY_MAX                  256                                     // (bytes) of a query read
+#define MDNS_TEXT_LEN                   96                                      // one TXT string
+#define MDNS_ANNOUNCE_COUNT             2                                       // unsolicited answers after joining
+#define MDNS_ANNOUNCE_INTERVAL          1000                                    // (ms)
+#define MDNS_MIN_INTERVAL               1000                                    // (ms) between multicast answers
+
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...)          log_write(LOG_LEVEL_ERROR, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...)          do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...)           log_write(LOG_LEVEL_WARN, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...)           do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...)           log_write(LOG_LEVEL_INFO, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...)           do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...)          log_write(LOG_LEVEL_DEBUG, PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...)          do {} while (0)
+#endif
 
 
 typedef enum {
     STATIC                              = 0,
     HEARTBEAT,
-    ROTATE 
+    ROTATE,
+    FRAME,                                                                      // per-pixel frame uploaded by a client
+    EFFECT,                                                                     // user bytecode effect
+    AUDIO                                                                       // reacts to the A0 audio input
 } LEDPattern;
 
 
+typedef enum {
+    PROV_OFF                            = 0,                                    // station mode, normal operation
+    PROV_SCANNING,
+    PROV_WAITING,                                                               // portal up, waiting for credentials
+    PROV_CONNECTING
+} ProvState;
+
+
+typedef struct __attribute__((packed)) {
+    uint32_t    magic;
+    uint8_t     count;                                                          // number of record slots
+    uint8_t     active;                                                         // palettes only: selected slot
+    uint16_t    reserved;
+} StoreHeader;
+
+
+typedef struct __attribute__((packed)) {
+    char        name[STORE_NAME_LEN];                                           // empty = unused slot
+    uint8_t     size;
+    uint8_t     rgb[PALETTE_SIZE][3];
+} Palette;
+
+
+typedef struct __attribute__((packed)) {
+    char        name[STORE_NAME_LEN];                                           // empty = unused slot
+    uint8_t     rgb[3];
+    uint8_t     brightness;
+    uint8_t     pattern;
+    uint16_t    rotateDelay;                                                    // (ms)
+    uint16_t    heartbeatDelay;                                                 // (ms)
+} Scene;
+
+
+typedef struct __attribute__((packed)) {
+    char        name[STORE_NAME_LEN];                                           // empty = unused slot
+    uint8_t     len;
+    uint8_t     code[EFFECT_CODE_SIZE];
+} Effect;
+
+
+typedef struct {                                                                // aligned: curves are read every frame
+    uint32_t    magic;
+    uint8_t     leds;                                                           // LED_NUM the pixel map was made for
+    uint8_t     reserved[3];
+    uint16_t    curve[CAL_PROFILES][3][CAL_POINTS];                             // 8-bit color -> 16-bit output
+    uint8_t     pixel[LED_NUM];                                                 // profile of each pixel
+} CalTable;
+
+
+typedef struct {
+    char        buf[HTML_CHUNK_SIZE];
+    size_t      len;
+    size_t      total;                                                          // bytes sent for this render
+    uint32_t    heapMin;                                                        // lowest free heap seen while sending
+} HtmlStream;
+
+
+typedef struct {
+    const char      *name;
+    void            (*run)(void);
+    unsigned long   period;                                                     // (us)
+    unsigned long   deadline;                                                   // (us) allowed lateness after release
+    uint8_t         priority;                                                   // 0 = most urgent
+    unsigned long   release;                                                    // (us) next time the task is due
+    unsigned long   runs;
+    unsigned long   busy;                                                       // (us) total CPU time
+    unsigned long   maxTime;                                                    // (us) longest single run
+    unsigned long   maxLate;                                                    // (us) worst start lateness
+    unsigned long   missed;                                                     // runs started after their deadline
+} Task;
+
+
+#if LCD_ENABLED
 const unsigned char logo [] PROGMEM = {
 	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
 	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
@@ -130,9 +583,10 @@ const unsigned char logo [] PROGMEM = {
 	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
 	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
+#endif
 
 
-const int           colorTable[40]      = {
+const int           colorTable[PALETTE_SIZE] = {                               // factory default palette
     // Common room lighting colors according to color temperature
     0xFF9329,                                                                   // Candle
     0xFFC58F,                                                                   // tungsten 40w
@@ -183,13 +637,121 @@ const int           colorTable[40]      = {
 };
 
 
+typedef struct {
+    uint32_t    magic;
+    uint32_t    boots;
+    uint32_t    stalls;
+    uint32_t    crashes;
+    uint32_t    event;                                                          // DIAG_EVENT_* not yet reported
+    uint32_t    reason;                                                         // rst_info reason
+    uint32_t    exccause;
+    uint32_t    epc1;
+    uint32_t    sp;
+    uint32_t    uptime;                                                         // (ms)
+    uint32_t    loopMax;                                                        // (us)
+    uint32_t    handlerMax;                                                     // (us)
+    uint32_t    heapMin;
+    char        route[DIAG_ROUTE_LEN];                                          // last HTTP request
+    char        task[DIAG_TASK_LEN];                                            // last scheduled task
+} DiagRecord;                                                                   // RTC memory, survives everything but power loss
+
+
+typedef enum {
+    NET_IDLE                            = 0,
+    NET_RESOLVING,                                                              // DNS query out
+    NET_CONNECTING,                                                             // SYN sent
+    NET_CONNECTED,
+    NET_CLOSED,                                                                 // peer closed, buffered data still readable
+    NET_FAILED                                                                  // error holds the reason
+} NetState;
+
+
+typedef struct {
+    NetState        state;                                                      // moved by the lwIP callbacks
+    struct tcp_pcb  *pcb;
+    struct pbuf     *rx;                                                        // received, not read yet
+    uint16_t        rxOffset;                                                   // (bytes) read from the first pbuf
+    ip_addr_t       ip;
+    uint16_t        port;
+    char            host[NET_HOST_LEN];
+    unsigned long   stamp;                                                      // (ms) open
+    unsigned long   timeout;                                                    // (ms) DNS and connect
+    const char      *error;
+} NetConn;                                                                      // raw lwIP TCP client, never blocks loop()
+
+
+typedef enum {
+    OTA_IDLE                            = 0,
+    OTA_PUSH,                                                                   // POST /ota body streaming in
+    OTA_PULL_CONNECT,                                                           // DNS and TCP connect in progress
+    OTA_PULL_HEADERS,
+    OTA_PULL_BODY,
+    OTA_REBOOT                                                                  // verified, restart pending
+} OtaState;
+
+
+typedef struct {
+    uint32_t    magic;
+    uint32_t    trial;                                                          // running image not confirmed yet
+    uint32_t    boots;                                                          // unconfirmed boots so far
+} OtaRtc;
+
+
+typedef struct {
+    char        current[OTA_URL_LEN];                                           // url of the installed image, "" if pushed
+    char        good[OTA_URL_LEN];                                              // last image that confirmed, rollback target
+} OtaConfig;
+
+
+typedef struct {
+    char        host[MQTT_HOST_LEN];                                            // empty = disabled
+    uint16_t    port;
+} MqttConfig;
+
+
+typedef struct {
+    uint32_t    caller;                                                         // return address of the allocation
+    uint32_t    count;
+} HeapSite;
+
+
+typedef struct __attribute__((packed)) {
+    uint32_t    stamp;                                                          // (ms) request line received
+    uint32_t    duration;                                                       // (us) until handleClient() returned
+    uint32_t    bytes;                                                          // streamed response body
+    uint32_t    heapBefore;
+    uint32_t    heapAfter;
+    uint16_t    showTime;                                                       // (us) last LED show() when it finished
+    uint8_t     route;                                                          // index into the route names
+    uint8_t     method;                                                         // HTTPMethod
+} TraceRecord;
+
+
+typedef struct __attribute__((packed)) {
+    uint32_t    magic;
+    uint8_t     version;
+    uint8_t     recordSize;
+    uint8_t     routeLen;
+    uint8_t     routeCount;
+    uint16_t    count;                                                          // records that follow the route names
+    uint16_t    reserved;
+    uint32_t    dropped;                                                        // overwritten before this download
+    uint32_t    uptime;                                                         // (ms) at download
+} TraceHeader;
+
+
 // Variables
-const float         infoVersion         = 1.1;
+const float         infoVersion         = 1.2;
 const char          *infoAuthor         = "mtt4rv1n4";
 const char          *wifiHostname       = "eperly-lite";
 char                wifiSSID[128]       = "";
 char                wifiPassword[128]   = "";
 bool                wifiInfoPresent     = true;
+ProvState           provState           = PROV_OFF;
+bool                provFailed          = false;                                // last connection attempt timed out
+unsigned long       provStamp           = 0;
+unsigned long       provTime            = 0;                                    // (ms) power-on to provisioned
+int                 provNetworks        = 0;                                    // scan results available
 unsigned long       timeStamp           = 0;
 bool                timerEn             = false; 
 int                 ledBrightness       = 128;                                  // LED default brightness (50%)
@@ -202,26 +764,304 @@ LEDPattern          ledPattern          = STATIC;
 volatile uint8_t    ledIndex            = 0;
 int                 ledBrightnessInc    = 0;
 bool                heartbeatDir        = false;                                // true = increasing, false = decreasing
+unsigned int        ledRotateDelay      = LED_ROT_TRANS_DELAY;                  // (ms) per pixel
+uint8_t             ledRotateTail       = LED_ROT_TAIL;                         // (pixels)
+unsigned long       rotateCycles        = 0;                                    // CPU cycles of the last rotate frame
+unsigned long       rotateCyclesMax     = 0;
+unsigned int        ledHeartbeatDelay   = LED_HRTBT_TRANS_DELAY;                // (ms)
+Palette             palette;                                                    // active palette, cached from flash
+uint8_t             paletteActive       = 0;
+bool                paletteDirty        = false;                                // active selection not yet in flash
+CalTable            calTable;                                                   // calibration, cached from flash
+bool                calDirty            = false;                                // not yet in flash
+unsigned long       ledMixCycles        = 0;                                    // CPU cycles of the last calibrate/dither pass
+unsigned long       ledMixCyclesMax     = 0;
+#if LCD_ENABLED
+bool                lcdDirty            = false;                                // OLED buffer not yet sent
+#endif
+uint8_t             ledPending          = 0;                                    // LED_CMD_* not yet applied to the frame
+unsigned long       cmdCount            = 0;                                    // control commands received
+unsigned long       cmdMerged           = 0;                                    // commands superseded before a frame
+CRGB                frameBuf[2][LED_NUM];                                       // upload double buffer
+uint8_t             frameWrite          = 0;                                    // buffer being filled
+uint8_t             frameRead           = 1;                                    // last committed buffer
+size_t              frameOffset         = 0;                                    // bytes written to frameBuf[frameWrite]
+bool                frameLastOk         = false;
+unsigned long       frameCount          = 0;                                    // frames committed
+unsigned long       frameErrors         = 0;                                    // short or aborted uploads
+unsigned long       frameWindowCount    = 0;
+unsigned long       frameRate           = 0;                                    // (fps) over the last stats window
+Effect              effect;                                                     // selected effect, cached from flash
+uint8_t             effectOps           = 0;                                    // instructions per pixel
+unsigned long       effectCyclesMax     = 0;                                    // CPU cycles of the slowest effect frame
+unsigned long       effectNsPerOp       = 0;                                    // (ns) last frame
+DiagRecord          diagRtc;                                                    // mirror of the RTC record
+DiagRecord          diagLast;                                                   // post-mortem of the previous boot
+bool                diagLastValid       = false;
+bool                diagArmed           = false;
+const char          *diagTask           = "setup";                              // task running now
+Task                *schedCurrent       = NULL;                                 // task being dispatched
+volatile unsigned long diagFeed         = 0;                                    // (ms) last loop() iteration
+unsigned long       diagLoopStamp       = 0;                                    // (us)
+unsigned long       diagLoopMax         = 0;                                    // (us)
+unsigned long       diagHandlerMax      = 0;                                    // (us) slowest handleClient()
+unsigned long       diagHeapMin         = 0xFFFFFFFF;
+unsigned long       diagSlowLoops       = 0;
+OtaState            otaState            = OTA_IDLE;
+OtaRtc              otaRtc;
+OtaConfig           otaConfig;
+bool                otaRecovery         = false;                                // too many failed boots, roll back
+bool                otaLastOk           = false;
+const char          *otaError           = "";
+char                otaUrl[OTA_URL_LEN];                                        // pull: image being fetched
+char                otaLine[OTA_LINE_LEN];                                      // pull: header line being read
+uint8_t             otaLineLen          = 0;
+uint8_t             otaLineCount        = 0;
+unsigned long       otaSize             = 0;                                    // (bytes) image incl. signature
+unsigned long       otaWritten          = 0;
+unsigned long       otaStart            = 0;                                    // (ms)
+unsigned long       otaStamp            = 0;                                    // (ms) last data or state change
+unsigned long       otaRate             = 0;                                    // (B/s) last update
+unsigned long       otaJitterMax        = 0;                                    // (us) LED refresh jitter during the last update
+unsigned long       ledJitterMax        = 0;                                    // (us) LED refresh jitter otherwise
+unsigned long       ledLastRun          = 0;                                    // (us)
+unsigned long       ledCmdStamp         = 0;                                    // (us) oldest pending command
+unsigned long       cmdLatency          = 0;                                    // (us) command to refreshed frame
+unsigned long       cmdLatencyMax       = 0;                                    // (us)
+MqttSession         mqttSession;                                                // protocol state, lib/lamp
+MqttConfig          mqttConfig;
+unsigned long       mqttWindowRx        = 0;                                    // mqttSession.rx at the window start
+unsigned long       mqttWindowTx        = 0;
+unsigned long       mqttRxRate          = 0;                                    // (msg/s) over the last stats window
+unsigned long       mqttTxRate          = 0;
+const uint8_t       audioBins[AUDIO_BANDS]  = {2, 4, 7};                        // 25Hz low, 50Hz mid, 88Hz high (Nyquist 100Hz)
+int32_t             audioCoeff[AUDIO_BANDS];                                    // 2cos(2 pi k / N), Q14
+int32_t             audioS1[AUDIO_BANDS];                                       // Goertzel state
+int32_t             audioS2[AUDIO_BANDS];
+uint32_t            audioPeak[AUDIO_BANDS];                                     // AGC reference per band
+uint8_t             audioLevel[AUDIO_BANDS];                                    // 0..255 of the last block
+int32_t             audioDc             = 512 << 4;                             // running ADC mean, Q4
+uint8_t             audioCount          = 0;                                    // samples in the current block
+uint16_t            audioRotate         = 0;                                    // (8.8 pixels)
+uint16_t            audioHue            = 0;                                    // (8.8)
+bool                audioFresh          = false;                                // block not yet shown
+unsigned long       audioLastSample     = 0;                                    // (us)
+unsigned long       audioBlockStamp     = 0;                                    // (us) first sample of the block
+unsigned long       audioReadyStamp     = 0;                                    // (us) first sample of the last finished block
+unsigned long       audioBlockCycles    = 0;
+unsigned long       audioCyclesMax      = 0;                                    // CPU cycles of one block, sampling included
+unsigned long       audioLatency        = 0;                                    // (us) first sample to first frame showing it
+unsigned long       audioLatencyMax     = 0;
+unsigned long       audioGaps           = 0;                                    // blocks dropped for late samples
+ScheduleEntry       schedule[SCHEDULE_MAX];
+int8_t              scheduleNext        = -1;                                   // entry due next, -1 = none
+time_t              scheduleNextTime    = 0;
+bool                scheduleDirty       = true;                                 // table or clock changed, recompute
+unsigned long       scheduleFired       = 0;
+bool                fadeActive          = false;
+bool                fadeOff             = false;                                // switch off when the fade ends
+int                 fadeFrom            = 0;
+int                 fadeTo              = 0;
+unsigned long       fadeStart           = 0;                                    // (ms)
+unsigned long       fadeDuration        = 0;                                    // (ms)
+uint32_t            httpConnIp          = 0;                                    // connection of the last request
+uint16_t            httpConnPort        = 0;
+uint8_t             httpConnRequests    = 0;                                    // served on that connection
+bool                httpConnLast        = false;                                // request HTTP_KEEPALIVE_MAX, answer closes
+unsigned long       httpConnections     = 0;
+unsigned long       httpRequests        = 0;
+unsigned long       httpIdleClosed      = 0;                                    // keep-alive connections ended between requests
+uint8_t             httpAdmitted        = 0;                                    // requests started since the last LED frame
+unsigned long       httpThrottled       = 0;
+unsigned long       httpDeferred        = 0;                                    // network runs that left requests waiting
+RateClient          rateClients[RATE_CLIENTS];
+uint32_t            udpLastIp           = 0;                                    // sender of the last applied packet
+uint16_t            udpLastPort         = 0;
+uint16_t            udpLastSeq          = 0;
+unsigned long       udpPackets          = 0;
+unsigned long       udpStale            = 0;
+unsigned long       udpErrors           = 0;
+unsigned long       schedIdle           = 0;                                    // (us) time spent idling
+int                 ledFrameBrightness  = 0;                                    // brightness applied by the refresh loop
+unsigned long       ledStatsStamp       = 0;
+unsigned long       ledStatsFrames      = 0;                                    // frames in the current stats window
+unsigned long       ledStatsBusy        = 0;                                    // (us) refresh time in the current window
+unsigned long       ledRefreshRate      = 0;                                    // (Hz) measured over the last window
+unsigned long       ledRefreshLoad      = 0;                                    // (0.1%) CPU share of the last window
+unsigned long       ledShowTimeLast     = 0;                                    // (us)
+unsigned long       ledShowTimeMax      = 0;                                    // (us)
+unsigned long       powerStamp          = 0;                                    // (us) last energy accumulation
+unsigned long       powerCurrent        = 0;                                    // (mA) estimate for the last frame
+unsigned long       powerCurrentMax     = 0;                                    // (mA)
+unsigned long       powerLimitedFrames  = 0;
+unsigned long       powerCyclesMax      = 0;                                    // CPU cycles spent in led_powerLimit()
+uint64_t            powerCharge         = 0;                                    // (mA*us) accumulated since boot
+unsigned long       renderBytesLast     = 0;
+unsigned long       renderHeapLast      = 0;                                    // (bytes) heap used by the last render
+unsigned long       renderHeapMax       = 0;                                    // (bytes)
+unsigned long       renderTruncated     = 0;                                    // render_printf() outputs over HTML_CHUNK_SIZE
+char                serverMsg[SERVER_MSG_LEN];                                  // formatted error replies
+#if LCD_ENABLED
+char                lcdLine[LCD_LINE_LEN];                                      // formatted OLED line
+#endif
+bool                heapArmed           = false;                                // setup() finished, allocations are counted
+HeapSite            heapSites[HEAP_SITES];
+unsigned long       heapAllocs          = 0;                                    // allocations after boot
+unsigned long       heapUntracked       = 0;                                    // from sites beyond HEAP_SITES
+unsigned long       heapStamp           = 0;                                    // (ms) last sample
+unsigned long       heapBoot            = 0;                                    // (bytes) free when setup() finished
+unsigned long       heapBlockMin        = 0xFFFFFFFF;                           // (bytes) largest free block low-water
+unsigned long       heapFragMax         = 0;                                    // (%)
+TraceRecord         traceRing[TRACE_RECORDS];
+uint32_t            traceHead           = 0;                                    // records ever written
+char                traceRoutes[TRACE_ROUTES][TRACE_ROUTE_LEN];
+uint8_t             traceRouteCount     = 0;
+bool                traceOpen           = false;                                // request seen by the hook, not finished
+unsigned long       traceStart          = 0;                                    // (us)
+unsigned long       traceStamp          = 0;                                    // (ms)
+uint32_t            traceHeap           = 0;
+uint32_t            traceBytes          = 0;
+char                tracePath[TRACE_ROUTE_LEN];
+bool                traceRouted         = false;                                // a registered handler (may) serve it
+#if INPUT_ENABLED
+volatile uint8_t    inputQueue[INPUT_QUEUE_LEN];                                // INPUT_EV_* from the ISRs
+volatile uint8_t    inputHead           = 0;                                    // moved by the ISRs only
+volatile uint8_t    inputTail           = 0;                                    // moved by task_input() only
+volatile uint8_t    inputEncState       = 0;                                    // previous and current AB levels
+volatile int8_t     inputEncSteps       = 0;                                    // towards the next detent
+bool                inputButtonDown     = false;                                // debounced level
+bool                inputBouncing       = false;
+unsigned long       inputEdgeStamp      = 0;                                    // (ms) last button edge
+#endif
+unsigned long       inputEvents         = 0;
+char                mdnsHost[32]        = "";                                   // <wifiHostname>-<chip id>
+uint8_t             mdnsPacket[MDNS_PACKET_MAX];                                // answer with every record
+uint16_t            mdnsPacketLen       = 0;
+uint8_t             mdnsLegacy[MDNS_PACKET_MAX];                                // unicast reply, question + capped TTLs
+uint32_t            mdnsIp              = 0;                                    // address the answer was built for
+uint8_t             mdnsAnnounce        = 0;                                    // announcements left
+unsigned long       mdnsStamp           = 0;                                    // (ms) last multicast
+unsigned long       mdnsQueries         = 0;
+unsigned long       mdnsReplies         = 0;
+unsigned long       mdnsReplyTime       = 0;                                    // (us) query read to answer sent
+unsigned long       mdnsReplyMax        = 0;                                    // (us)
+volatile unsigned long inputDropped     = 0;                                    // queue was full
+char                logBuffer[LOG_BUFFER_SIZE];                                 // ring of text lines
+volatile uint32_t   logHead             = 0;                                    // bytes ever written, only log_write() moves it
+uint32_t            logUartTail         = 0;                                    // bytes ever read by each sink
+uint32_t            logSyslogTail       = 0;
+uint8_t             logSinks            = LOG_SINKS;
+IPAddress           logSyslogHost;
+unsigned long       logUartDropped      = 0;                                    // bytes overwritten before each sink read them
+unsigned long       logSyslogDropped    = 0;
+unsigned long       logCyclesMax        = 0;                                    // CPU cycles of the slowest log_write()
+
+
+// Function definitions --> Scheduler tasks
+void task_led(void);
+void task_network(void);
+#if LCD_ENABLED
+void task_display(void);
+#endif
+void task_persist(void);
+void task_telemetry(void);
+void task_audio(void);
+void task_schedule(void);
+#if INPUT_ENABLED
+void task_input(void);
+#endif
+
+
+Task                tasks[]             = {
+    // name         run             period (us)         deadline (us)   priority
+    {"led",         task_led,       LED_REFRESH_PERIOD, 1000,           0},
+    {"network",     task_network,   LED_REFRESH_PERIOD, 20000,          1},
+#if LCD_ENABLED
+    {"display",     task_display,   50000,              50000,          2},
+#endif
+    {"persist",     task_persist,   1000000,            1000000,        3},
+    {"telemetry",   task_telemetry, 5000,               50000,          4},
+    {"audio",       task_audio,     AUDIO_IDLE_PERIOD,  500,            0},
+    {"schedule",    task_schedule,  1000000,            1000000,        3},
+#if INPUT_ENABLED
+    {"input",       task_input,     LED_REFRESH_PERIOD, 1000,           0},
+#endif
+};
 
 
-CRGB                leds[LED_NUM];
+CRGB                leds[LED_NUM];                                              // pattern frame (color only)
+uint16_t            ledFrame[LED_NUM][3];                                       // 16-bit frame (color * brightness * correction)
+uint8_t             ledDitherErr[LED_NUM][3];                                   // residual carried to the next refresh
+CRGB                ledsOut[LED_NUM];                                           // dithered 8-bit frame sent to the strip
 ESP8266WebServer    webServer(WIFI_PORT);
-SSD1306Wire         lcd(0x3c, LCD_SDA_PIN, LCD_SCL_PIN);
+WiFiServer          frameServer(FRAME_TCP_PORT);
+WiFiClient          frameClient;
+DNSServer           dnsServer;
+WiFiUDP             logUdp;
+WiFiUDP             ctrlUdp;
+WiFiUDP             mdnsUdp;
+Ticker              diagTicker;
+NetConn             otaConn;
+NetConn             mqttConn;
+#ifdef OTA_PUBLIC_KEY
+BearSSL::PublicKey  otaKey(OTA_PUBLIC_KEY);
+BearSSL::HashSHA256 otaHash;
+BearSSL::SigningVerifier otaVerifier(&otaKey);
+#endif
+#if LCD_ENABLED
+SSD1306Wire         lcd(LCD_ADDR, LCD_SDA_PIN, LCD_SCL_PIN);
+#endif
+
+
+// Function definitions --> Scheduler
+void sched_init(void);
+void sched_run(void);
+void sched_runUrgent(void);
+void sched_dispatch(Task *next, unsigned long now);
 
 
 // Function definitions --> LED Patterns
+void led_command(uint8_t change);
+void led_queue(uint8_t change);
+void led_apply(void);
+void led_animate(void);
+void led_refresh(void);
+uint16_t led_brightnessTo16(int level);
+uint16_t led_powerLimit(uint16_t scale);
+void led_storeColor(uint32_t color);
 void led_setColor(void);
 void led_setToStatic(void);
 void led_setToRotate(void);
 void led_setToHeartbeat(void);
+void led_setToAudio(void);
+void led_rotateRender(void);
+void led_rotateConfig(void);
 
 
 // Function definitions --> Web Server
 void server_htmlRender(void);
+void server_statsRender(void);
+void server_renderTemplate(PGM_P tmpl);
+void render_begin(HtmlStream *out, const char *contentType);
+void render_placeholder(HtmlStream *out, const char *key);
+void render_printf(HtmlStream *out, const char *format, ...);
+void render_flush(HtmlStream *out);
+void render_escaped(HtmlStream *out, const char *text);
 void render_inactive(void);
 void render_active(void);
+void render_provision(void);
+void server_notFound(void);
+void server_commandDone(void);
+void server_send(int code, const char *contentType, const char *content);
+ESP8266WebServer::ClientFuture server_keepAliveHook(const String &method, const String &url, WiFiClient *client,
+                                                    ESP8266WebServer::ContentTypeFunction contentType);
+void server_trackConnection(void);
+ESP8266WebServer::ClientFuture server_admitHook(const String &method, const String &url, WiFiClient *client,
+                                                ESP8266WebServer::ContentTypeFunction contentType);
 void lamp_on(void);
 void lamp_off(void);
+uint8_t lamp_set(bool on);
+void led_stepBrightness(int delta);
 void increase_brightness(void);
 void decrease_brightness(void);
 void increase_redVal(void);
@@ -233,6 +1073,177 @@ void decrease_blueVal(void);
 void color_set(void);
 
 
+// Function definitions --> Frame Upload
+void frame_receive(void);
+void frame_done(void);
+void frame_write(const uint8_t *data, size_t len);
+bool frame_commit(void);
+void frame_pollTcp(void);
+
+
+// Function definitions --> Schedules
+void schedule_init(void);
+void schedule_timeSet(void);
+void schedule_fire(const ScheduleEntry *entry);
+void schedule_fade(void);
+bool schedule_save(void);
+void schedule_render(void);
+void schedule_set(void);
+
+
+// Function definitions --> Audio
+void audio_init(void);
+void audio_finishBlock(void);
+void audio_render(void);
+
+
+// Function definitions --> UDP Control
+void udp_poll(void);
+uint8_t udp_apply(const uint8_t *ops, uint8_t len);
+
+
+// Function definitions --> mDNS
+void mdns_init(void);
+void mdns_poll(void);
+void mdns_multicast(void);
+void mdns_legacy(const uint8_t *query, const MdnsQuestion *question);
+void mdns_answer(IPAddress ip);
+
+
+// Function definitions --> Local Controls
+#if INPUT_ENABLED
+void input_init(void);
+void input_push(uint8_t event);
+void input_buttonIsr(void);
+void input_encoderIsr(void);
+#endif
+
+
+// Function definitions --> Effects
+void effect_render(void);
+bool effect_read(uint8_t id, Effect *dst);
+bool effect_write(uint8_t id, const Effect *src);
+void effect_select(void);
+void effect_save(void);
+
+
+// Function definitions --> Palettes and Scenes
+void storage_init(void);
+bool palette_read(uint8_t id, Palette *dst);
+bool palette_write(uint8_t id, const Palette *src);
+bool palette_writeActive(uint8_t id);
+bool scene_read(uint8_t id, Scene *dst);
+bool scene_write(uint8_t id, const Scene *src);
+void palette_select(void);
+void palette_colorSet(void);
+void palette_saveAs(void);
+void scene_recall(void);
+void scene_save(void);
+
+
+// Function definitions --> Calibration
+void cal_init(void);
+void cal_generate(uint8_t profile, uint8_t channel, uint8_t gain, float gamma);
+bool cal_valid(void);
+bool cal_monotonic(const uint16_t *points);
+bool cal_write(void);
+void cal_render(void);
+void cal_curve(void);
+void cal_pixels(void);
+
+
+// Function definitions --> WiFi Provisioning
+void wifi_showConnected(void);
+void wifi_startProvisioning(void);
+void wifi_provision(void);
+void wifi_scan(void);
+void wifi_submit(void);
+#if LCD_ENABLED
+void lcd_printf(int16_t y, const char *format, ...);
+#endif
+
+
+// Function definitions --> Diagnostics
+void diag_init(void);
+void diag_arm(void);
+void diag_feed(void);
+void diag_check(void);
+void diag_snapshot(uint32_t event, uint32_t sp);
+void diag_render(void);
+ESP8266WebServer::ClientFuture diag_routeHook(const String &method, const String &url, WiFiClient *client,
+                                              ESP8266WebServer::ContentTypeFunction contentType);
+extern "C" void custom_crash_callback(struct rst_info *info, uint32_t stack, uint32_t stackEnd);
+
+
+// Function definitions --> Heap
+void heap_arm(void);
+void heap_sample(void);
+void heap_note(uint32_t caller);
+void heap_render(void);
+extern "C" void *__real_malloc(size_t size);
+extern "C" void *__real_calloc(size_t count, size_t size);
+extern "C" void *__real_realloc(void *ptr, size_t size);
+extern "C" void *__wrap_malloc(size_t size);
+extern "C" void *__wrap_calloc(size_t count, size_t size);
+extern "C" void *__wrap_realloc(void *ptr, size_t size);
+
+
+// Function definitions --> Request Trace
+ESP8266WebServer::ClientFuture trace_hook(const String &method, const String &url, WiFiClient *client,
+                                          ESP8266WebServer::ContentTypeFunction contentType);
+void trace_finish(void);
+uint8_t trace_route(const char *path, bool intern);
+void trace_render(void);
+
+
+// Function definitions --> Network connections
+bool net_open(NetConn *conn, const char *host, uint16_t port, unsigned long timeout);
+void net_connect(NetConn *conn);
+void net_dnsFound(const char *name, const ip_addr_t *ip, void *arg);
+err_t net_tcpConnected(void *arg, struct tcp_pcb *pcb, err_t err);
+err_t net_tcpRecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err);
+void net_tcpError(void *arg, err_t err);
+void net_fail(NetConn *conn, const char *error);
+void net_poll(NetConn *conn);
+size_t net_available(NetConn *conn);
+size_t net_read(NetConn *conn, uint8_t *buf, size_t len);
+bool net_write(NetConn *conn, const uint8_t *data, size_t len);
+void net_close(NetConn *conn);
+
+
+// Function definitions --> OTA
+void ota_init(void);
+void ota_service(void);
+bool ota_begin(unsigned long size);
+bool ota_write(uint8_t *data, size_t len);
+void ota_finish(void);
+void ota_abort(const char *reason);
+void ota_receive(void);
+void ota_done(void);
+void ota_pull(void);
+bool ota_pullStart(const char *url);
+void ota_poll(void);
+
+
+// Function definitions --> MQTT
+void mqtt_init(void);
+void mqtt_service(void);
+void mqtt_connect(void);
+bool mqtt_write(void *ctx, const uint8_t *data, uint16_t len);
+void mqtt_close(void *ctx);
+void mqtt_command(void *ctx, const char *key, const char *payload);
+void mqtt_stateJson(char *state, size_t size);
+void mqtt_config(void);
+
+
+// Function definitions --> Logging
+void log_write(uint8_t level, PGM_P format, ...);
+void log_drain(void);
+void log_flush(void);
+void log_tail(void);
+void log_config(void);
+
+
 // Function definitions --> EEPROM
 void eeprom_init(void);
 void eeprom_read(void);
@@ -248,14 +1259,18 @@ void setup(){
     uint8_t         i2cAddr     = 0;
     String          buf         = "";
 
-    FastLED.addLeds<NEOPIXEL, LED_PIN>(leds, LED_NUM);                          // GRB ordering is assumed
-    FastLED.setCorrection(TypicalSMD5050);
-    FastLED.setDither(BINARY_DITHER);
+    FastLED.addLeds<LED_CHIPSET, LED_PIN>(ledsOut, LED_NUM);
+    FastLED.setCorrection(UncorrectedColor);                                    // correction is applied in led_refresh()
+    FastLED.setDither(DISABLE_DITHER);                                          // dithering is done in led_refresh()
+    FastLED.setBrightness(LED_MAX_BRIGHTNESS);
+    FastLED.setMaxRefreshRate(0);                                               // refresh is paced by loop()
     FastLED.showColor(CRGB::Black, LED_MAX_BRIGHTNESS);                         // set all LEDs to Black
     FastLED.showColor(CRGB::Black, LED_MAX_BRIGHTNESS);                         // set all LEDs to Black
 
-    Serial.begin(9600);
+    Serial.begin(LOG_UART_BAUD);
+    diag_init();                                                                // collect the previous post-mortem
 
+#if LCD_ENABLED
     lcd.init();
     lcd.setI2cAutoInit(true);
     lcd.flipScreenVertically();
@@ -268,56 +1283,59 @@ void setup(){
     delay(5000);
 
     lcd.clear();
+#endif
 
-    Serial.println("\n\n[INFO] Project: \t\tEperly-Lite");
+    LOG_INFO("Project: Eperly-Lite (%s)", LAMP_VARIANT);
+    LOG_INFO("Firmware Version: %.1f", infoVersion);
+    LOG_INFO("Author: Tarvs' Hobbytronics");
+    LOG_INFO("Email: mttarvina@gmail.com");
+#if LCD_ENABLED
     lcd.drawString(0, 0, "> Eperly-Lite");
     lcd.display();
     delay(200);
 
-
-    Serial.printf("[INFO] Firmware Version: \t%.1f\n", infoVersion);
     lcd.drawString(0, 15, "> Firmware Ver.: " + String(infoVersion));
     lcd.display();
     delay(200);
 
-    Serial.println("[INFO] Author: \t\t\tTarvs' Hobbytronics");
     lcd.drawString(0, 25, "> By: Tarvs' Hobbytronics");
     lcd.display();
     delay(200);
 
-    Serial.printf("[INFO] Email: \t\t\tmttarvina@gmail.com\n\n");
     lcd.drawString(0, 35, "> mttarvina@gmail.com");
     lcd.display();
     delay(5000);
+#endif
 
     eeprom_init();
     eeprom_read();                                                              // extract wifi info from eeprom
+    storage_init();                                                             // mount flash and load the active palette
+    cal_init();
+    led_storeColor(ledColor);                                                   // r/g/b tuning values of the startup color
+    ota_init();                                                                 // count trial boots of a new image
+    mqtt_init();
+    schedule_init();
 
     if (!wifiInfoPresent){
-        Serial.println("Wifi info not present in EEPROM.");
-        lcd.clear();
-        lcd.drawString(0, 0, "> No WiFi info saved.");
-        lcd.drawString(0, 15, "> Configure through USB");
-        lcd.drawString(0, 25, "> Baud Rate = 9600");
-        lcd.display();
-        serial_getWifiInfo();
-        eeprom_write();                                                         // save wifi info to eeprom
+        LOG_WARN("Wifi info not present in EEPROM.");
+        wifi_startProvisioning();                                               // finished in loop() by wifi_provision()
     }
 
     else {
-        Serial.printf("Found WiFi credentials saved on EEPROM for SSID: %s\n", wifiSSID);
-        #if DEBUG
-            Serial.printf("[DEBUG] Wifi Password: %s\n", wifiPassword);
-        #endif
+        LOG_INFO("Found WiFi credentials saved on EEPROM for SSID: %s", wifiSSID);
+        LOG_DEBUG("Wifi Password: %u characters", (unsigned)strlen(wifiPassword));  // /log and syslog are not authenticated
 
+        log_flush();                                                            // console prompts below are not buffered
         Serial.println("Would you like to update WiFi credentials? (Y/N):");
 
+#if LCD_ENABLED
         lcd.clear();
         lcd.drawString(0, 0, "> Wifi credentials found.");
         lcd.drawString(0, 15, "> " + String(wifiSSID));
         lcd.drawString(0, 35, "> Update through USB");
-        lcd.drawString(0, 45, "> Baud Rate = 9600");
+        lcd.drawString(0, 45, "> Baud Rate = " + String(LOG_UART_BAUD));
         lcd.display();
+#endif
 
         prevTime = millis();
         while (!flag){
@@ -356,32 +1374,55 @@ void setup(){
         }
     }
     
-    // Connect to WiFi
-    Serial.print("\nConnecting to ");
-    Serial.println(wifiSSID);
-    lcd.clear();
-    lcd.drawString(0, 0, "> Connecting to WiFi");
-    lcd.drawString(0, 15, "> " + String(wifiSSID));
-    lcd.display();
+    mdns_init();                                                                // before the first DHCP request
+    if (wifiInfoPresent){
+        // Connect to WiFi
+        LOG_INFO("Connecting to %s", wifiSSID);
+#if LCD_ENABLED
+        lcd.clear();
+        lcd.drawString(0, 0, "> Connecting to WiFi");
+        lcd.drawString(0, 15, "> " + String(wifiSSID));
+        lcd.display();
+#endif
 
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(wifiSSID, wifiPassword);
-    while (WiFi.status() != WL_CONNECTED) {
-        delay(200);
-        Serial.print(".");
+        WiFi.mode(WIFI_STA);
+        WiFi.begin(wifiSSID, wifiPassword);
+        prevTime = millis();
+        while ((WiFi.status() != WL_CONNECTED) && ((millis() - prevTime) < PROV_CONNECT_TIMEOUT)){
+            delay(200);
+            log_drain();
+        }
+        if (WiFi.status() == WL_CONNECTED){
+            wifi_showConnected();
+        }
+        else {
+            LOG_WARN("Could not join %s, starting setup portal", wifiSSID);
+            wifi_startProvisioning();
+        }
     }
-    Serial.println("\nWiFi connected.");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
-
-    lcd.clear();
-    lcd.drawString(0, 0, "> Wifi Connected");
-    lcd.drawString(0, 15, "> " + String(wifiSSID));
-    lcd.drawString(0, 35, "> " + WiFi.localIP().toString());
-    lcd.display();
     
     // Setup routes and start webserver
     webServer.on("/", server_htmlRender);                                       // render the default HTML view
+    webServer.on("/wifi", HTTP_GET, render_provision);
+    webServer.on("/wifi", HTTP_POST, wifi_submit);
+    webServer.on("/wifi/scan", wifi_scan);
+    webServer.onNotFound(server_notFound);
+    webServer.on("/frame", HTTP_POST, frame_done, frame_receive);               // raw body streamed to frame_receive()
+    webServer.on("/ota", HTTP_POST, ota_done, ota_receive);
+    webServer.on("/ota/pull", ota_pull);
+    webServer.on("/mqtt", mqtt_config);
+    webServer.on("/schedule", schedule_render);
+    webServer.on("/schedule/set", schedule_set);
+    webServer.on("/stats", server_statsRender);
+    webServer.on("/log", log_tail);
+    webServer.on("/diag", diag_render);
+    webServer.on("/heap", heap_render);
+    webServer.addHook(diag_routeHook);                                          // remembers the route before its handler runs
+    webServer.addHook(server_keepAliveHook);
+    webServer.addHook(trace_hook);
+    webServer.addHook(server_admitHook);                                        // last: throttled requests are still traced
+    webServer.on("/trace", trace_render);
+    webServer.on("/log/config", log_config);
     webServer.on("/on", lamp_on);
     webServer.on("/off", lamp_off);
     webServer.on("/brightness/dec", decrease_brightness);
@@ -389,6 +1430,8 @@ void setup(){
     webServer.on("/static", led_setToStatic);
     webServer.on("/rotate", led_setToRotate);
     webServer.on("/heartbeat", led_setToHeartbeat);
+    webServer.on("/audio", led_setToAudio);
+    webServer.on("/rotate/config", led_rotateConfig);
     webServer.on("/r/dec", decrease_redVal);
     webServer.on("/g/dec", decrease_greenVal);
     webServer.on("/b/dec", decrease_blueVal);
@@ -435,32 +1478,378 @@ void setup(){
     webServer.on("/color/37", color_set);
     webServer.on("/color/38", color_set);
     webServer.on("/color/39", color_set);
+    webServer.on("/palette", palette_select);
+    webServer.on("/palette/color", palette_colorSet);
+    webServer.on("/palette/save", palette_saveAs);
+    webServer.on("/scene", scene_recall);
+    webServer.on("/scene/save", scene_save);
+    webServer.on("/effect", effect_select);
+    webServer.on("/effect/save", effect_save);
+    webServer.on("/cal", cal_render);
+    webServer.on("/cal/curve", cal_curve);
+    webServer.on("/cal/pixels", cal_pixels);
     webServer.begin();
+    frameServer.begin();
+    frameServer.setNoDelay(true);
+    ctrlUdp.begin(UDP_CTRL_PORT);
+
+    ledStatsStamp = millis();
+    powerStamp = micros();
+    ledLastRun = micros();
+    audio_init();
+#if INPUT_ENABLED
+    input_init();
+#endif
+    sched_init();
+    diag_arm();
+    heap_arm();                                                                 // from here on allocations are counted
 }
 
 
 void loop(){
-    webServer.handleClient();
+    diag_feed();
+    sched_run();
+}
 
-    if (timerEn && (ledPattern == ROTATE) && ((millis() - timeStamp) > LED_ROT_TRANS_DELAY)){
-        timeStamp = millis();
-        ledIndex += 1;
-        if (ledIndex == LED_NUM){
-            ledIndex = 0;
+
+void sched_init(void){
+    unsigned long   now     = micros();
+
+    for (uint8_t i = 0; i < (sizeof(tasks) / sizeof(tasks[0])); i++){
+        tasks[i].release = now;
+    }
+}
+
+
+void sched_run(void){
+    unsigned long   now     = micros();
+    unsigned long   start;
+    unsigned long   wait    = 0xFFFFFFFF;                                       // (us) to the earliest release
+    Task            *next   = NULL;
+    Task            *task;
+
+    // pick the most urgent due task: lowest priority value, then earliest absolute deadline
+    for (uint8_t i = 0; i < (sizeof(tasks) / sizeof(tasks[0])); i++){
+        task = &tasks[i];
+        if ((long)(now - task->release) < 0){
+            wait = min(wait, task->release - now);
+            continue;
+        }
+        if ((NULL == next) || (task->priority < next->priority) ||
+            ((task->priority == next->priority) &&
+             ((long)((task->release + task->deadline) - (next->release + next->deadline)) < 0))){
+            next = task;
         }
-        if (0 == ledIndex){
-            leds[LED_NUM - 1] = CRGB::Black;
-            leds[ledIndex] = ledColor;   
+    }
+
+    if (NULL == next){                                                          // nothing due
+        start = micros();
+        if ((long)(wait - (start - now)) >= SCHED_SLEEP_MIN){                   // 1ms sleep still ends before the release
+            delay(1);                                                           // lets the SDK modem-sleep
         }
         else {
-            leds[ledIndex - 1] = CRGB::Black;
-            leds[ledIndex] = ledColor;        
+            yield();
+        }
+        schedIdle += micros() - start;
+        return;
+    }
+
+    sched_dispatch(next, now);
+}
+
+
+void sched_runUrgent(void){
+    unsigned long   now     = micros();
+    const char      *task   = diagTask;
+
+    // called from long-running handlers (OTA push) so the LED refresh keeps its period
+    for (uint8_t i = 0; i < (sizeof(tasks) / sizeof(tasks[0])); i++){
+        if ((tasks[i].priority <= SCHED_URGENT_PRIORITY) && ((long)(now - tasks[i].release) >= 0)){
+            sched_dispatch(&tasks[i], now);
+        }
+    }
+    diagTask = task;
+}
+
+
+void sched_dispatch(Task *next, unsigned long now){
+    Task            *outer      = schedCurrent;                                 // set when sched_runUrgent() runs inside a task
+    unsigned long   start;
+    unsigned long   elapsed;
+    unsigned long   late;
+
+    late = now - next->release;
+    if (late > next->maxLate){
+        next->maxLate = late;
+    }
+    if (late > next->deadline){
+        next->missed += 1;
+    }
+
+    diagTask = next->name;
+    schedCurrent = next;
+    start = micros();
+    next->run();
+    elapsed = micros() - start;
+    schedCurrent = outer;
+    if (NULL != outer){
+        diagTask = outer->name;
+    }
+
+    next->runs += 1;
+    next->busy += elapsed;
+    if (elapsed > next->maxTime){
+        next->maxTime = elapsed;
+    }
+    next->release += next->period;
+    if ((long)(micros() - next->release) > (long)next->deadline){               // overrun, skip missed releases
+        next->release = micros() + next->period;
+    }
+}
+
+
+void task_led(void){
+    unsigned long   now     = micros();
+    unsigned long   jitter  = abs((long)(now - ledLastRun) - LED_REFRESH_PERIOD);
+
+    ledLastRun = now;
+    httpAdmitted = 0;                                                           // new admission budget
+    if (OTA_IDLE != otaState){                                                  // added by flash writes and downloads
+        otaJitterMax = max(otaJitterMax, jitter);
+    }
+    else {
+        ledJitterMax = max(ledJitterMax, jitter);
+    }
+    if (ledPending){
+        led_apply();
+        led_animate();
+        led_refresh();
+        cmdLatency = micros() - ledCmdStamp;
+        cmdLatencyMax = max(cmdLatencyMax, cmdLatency);
+        return;
+    }
+    led_animate();
+    led_refresh();
+}
+
+
+void task_network(void){
+    unsigned long   start   = micros();
+
+    if (httpAdmitted < SERVER_ADMIT_PER_FRAME){
+        webServer.handleClient();                                               // one request per call, pipelined ones follow
+        start = micros() - start;
+        if (start > diagHandlerMax){
+            diagHandlerMax = start;
+        }
+        trace_finish();
+        server_trackConnection();
+    }
+    else {
+        httpDeferred += 1;                                                      // admission budget of this frame is used up
+    }
+    frame_pollTcp();
+    udp_poll();
+    mdns_poll();
+    if ((OTA_PULL_CONNECT == otaState) || (OTA_PULL_HEADERS == otaState) || (OTA_PULL_BODY == otaState)){
+        ota_poll();
+    }
+    if (provState != PROV_OFF){
+        wifi_provision();
+    }
+    mqtt_service();
+}
+
+
+#if LCD_ENABLED
+void task_display(void){
+    if (lcdDirty){
+        lcdDirty = false;
+        lcd.display();
+    }
+}
+#endif
+
+
+void task_persist(void){
+    if (paletteDirty && palette_writeActive(paletteActive)){
+        paletteDirty = false;
+    }
+    if (calDirty && cal_write()){
+        calDirty = false;
+    }
+    ota_service();
+}
+
+
+void task_telemetry(void){
+    log_drain();
+    heap_sample();
+}
+
+
+void task_audio(void){
+    uint32_t        cycles;
+    unsigned long   now;
+
+    if (!ledState || (ledPattern != AUDIO)){
+        schedCurrent->period = AUDIO_IDLE_PERIOD;                               // keeps the idle loop able to sleep
+        audioCount = 0;
+        return;
+    }
+    schedCurrent->period = AUDIO_SAMPLE_PERIOD;
+
+    now = micros();
+    if ((audioCount > 0) && ((now - audioLastSample) > (AUDIO_SAMPLE_PERIOD + AUDIO_JITTER_MAX))){
+        audioGaps += 1;                                                         // uneven spacing would smear the bins
+        audioCount = 0;
+    }
+    audioLastSample = now;
+    cycles = ESP.getCycleCount();
+    if (0 == audioCount){
+        memset(audioS1, 0, sizeof(audioS1));
+        memset(audioS2, 0, sizeof(audioS2));
+        audioBlockStamp = now;
+        audioBlockCycles = 0;
+    }
+
+    audio_goertzel(audio_dc(analogRead(AUDIO_PIN), &audioDc), audioCoeff, audioS1, audioS2, AUDIO_BANDS);
+    audioCount += 1;
+    if (AUDIO_BLOCK == audioCount){
+        audio_finishBlock();
+        audioCount = 0;
+    }
+    audioBlockCycles += ESP.getCycleCount() - cycles;
+    if (0 == audioCount){
+        audioCyclesMax = max(audioCyclesMax, audioBlockCycles);
+    }
+}
+
+
+#if INPUT_ENABLED
+void task_input(void){
+    uint8_t     change  = 0;
+    uint8_t     event;
+    bool        down;
+
+    while (inputTail != inputHead){
+        event = inputQueue[inputTail & (INPUT_QUEUE_LEN - 1)];
+        inputTail += 1;                                                         // frees the slot for the ISRs
+        inputEvents += 1;
+        switch (event){
+            case INPUT_EV_EDGE:
+                inputEdgeStamp = millis();                                      // restart the debounce window
+                inputBouncing = true;
+                break;
+            case INPUT_EV_UP:
+            case INPUT_EV_DOWN:
+                if (ledState){
+                    led_stepBrightness((INPUT_EV_UP == event) ? INPUT_ENC_BRIGHTNESS : -INPUT_ENC_BRIGHTNESS);
+                    change |= LED_CMD_BRIGHTNESS;
+                }
+                break;
+        }
+    }
+    if (inputBouncing && ((millis() - inputEdgeStamp) >= INPUT_DEBOUNCE)){      // no edge for a while, level is stable
+        inputBouncing = false;
+        down = (LOW == digitalRead(INPUT_BUTTON_PIN));
+        if (down != inputButtonDown){
+            inputButtonDown = down;
+            if (down){
+                change |= lamp_set(!ledState);
+            }
+        }
+    }
+    if (change){
+        led_queue(change);                                                      // shown by the next task_led(), published by MQTT
+    }
+}
+#endif
+
+
+void led_command(uint8_t change){
+    led_queue(change);
+    server_commandDone();
+}
+
+
+void led_queue(uint8_t change){
+    if (ledPending){                                                            // previous command not shown yet
+        cmdMerged += 1;
+    }
+    else {
+        ledCmdStamp = micros();
+    }
+    ledPending |= change;
+    cmdCount += 1;
+    fadeActive = false;                                                         // an explicit command wins over a fade
+}
+
+
+void led_apply(void){
+    uint8_t     pending     = ledPending;
+
+    ledPending = 0;
+    if (!ledState){
+        timerEn = false;
+        for (uint8_t i = 0; i < LED_NUM; i++){
+            leds[i] = CRGB::Black;
+        }
+        return;
+    }
+
+    if (pending & (LED_CMD_STATE | LED_CMD_PATTERN)){                           // restart the pattern
+        ledIndex = 0;
+        ledBrightnessInc = ledBrightness;
+        heartbeatDir = false;
+        timerEn = (ledPattern == ROTATE) || (ledPattern == HEARTBEAT);
+        timeStamp = millis();
+    }
+
+    if (ledPattern == ROTATE){
+        led_rotateRender();
+    }
+    else if (ledPattern == FRAME){
+        memcpy(leds, frameBuf[frameRead], sizeof(leds));
+    }
+    else if (ledPattern == EFFECT){
+        effect_render();
+    }
+    else if (ledPattern == AUDIO){
+        audio_render();
+    }
+    else {
+        for (uint8_t i = 0; i < LED_NUM; i++){
+            leds[i] = ledColor;
         }
-        FastLED.show();
-        FastLED.show();
     }
 
-    if (timerEn && (ledPattern == HEARTBEAT) && ((millis() - timeStamp) > LED_HRTBT_TRANS_DELAY)){
+    if (ledPattern == HEARTBEAT){
+        ledBrightnessInc = min(ledBrightnessInc, ledBrightness);
+        ledFrameBrightness = ledBrightnessInc;
+    }
+    else {
+        ledFrameBrightness = ledBrightness;
+    }
+}
+
+
+void led_animate(void){
+    if (ledState && (ledPattern == EFFECT)){
+        effect_render();
+    }
+    else if (ledState && (ledPattern == AUDIO)){
+        audio_render();
+    }
+    if (fadeActive){
+        schedule_fade();
+    }
+
+    if (timerEn && (ledPattern == ROTATE)){                                     // every refresh, sub-pixel steps
+        led_rotateRender();
+    }
+
+    if (timerEn && (ledPattern == HEARTBEAT) && ((millis() - timeStamp) > ledHeartbeatDelay)){
         timeStamp = millis();
         if (heartbeatDir){
             ledBrightnessInc += LED_HRTBT_BRIGHTNESS_INC;
@@ -476,22 +1865,349 @@ void loop(){
             ledBrightnessInc = 0;
             heartbeatDir = true;
         }
-        FastLED.showColor(ledColor, ledBrightnessInc);
+        ledFrameBrightness = ledBrightnessInc;
     }
 }
 
 
-void server_htmlRender(void){
-    if (ledState){
-        render_active();
+void led_refresh(void){
+    unsigned long   start       = micros();
+    unsigned long   elapsed;
+    uint16_t        scale       = led_brightnessTo16(ledFrameBrightness);
+    uint32_t        cycles;
+
+    scale = led_powerLimit(scale);
+    powerCharge += (uint64_t)powerCurrent * (start - powerStamp);
+    powerStamp = start;
+
+    cycles = ESP.getCycleCount();
+    for (uint8_t i = 0; i < LED_NUM; i++){
+        for (uint8_t c = 0; c < 3; c++){                                        // calibration curve, 16-bit brightness, dither
+            ledFrame[i][c] = mix_level(leds[i][c], calTable.curve[calTable.pixel[i]][c], scale);
+            ledsOut[i][c] = mix_dither(ledFrame[i][c], &ledDitherErr[i][c]);
+        }
     }
-    else {
-        render_inactive();
+    ledMixCycles = ESP.getCycleCount() - cycles;
+    ledMixCyclesMax = max(ledMixCyclesMax, ledMixCycles);
+
+    ledShowTimeLast = micros();
+    FastLED.show();
+    ledShowTimeLast = micros() - ledShowTimeLast;
+    if (ledShowTimeLast > ledShowTimeMax){
+        ledShowTimeMax = ledShowTimeLast;
+    }
+
+    ledStatsBusy += micros() - start;
+    ledStatsFrames += 1;
+    elapsed = millis() - ledStatsStamp;
+    if (elapsed >= LED_STATS_WINDOW){
+        ledRefreshRate = (ledStatsFrames * 1000) / elapsed;
+        ledRefreshLoad = ledStatsBusy / elapsed;                                // us per ms = 0.1% units
+        ledStatsFrames = 0;
+        frameRate = (frameWindowCount * 1000) / elapsed;
+        frameWindowCount = 0;
+        mqttRxRate = ((mqttSession.rx - mqttWindowRx) * 1000) / elapsed;
+        mqttTxRate = ((mqttSession.tx - mqttWindowTx) * 1000) / elapsed;
+        mqttWindowRx = mqttSession.rx;
+        mqttWindowTx = mqttSession.tx;
+        ledStatsBusy = 0;
+        ledStatsStamp = millis();
     }
 }
 
+
+uint16_t led_brightnessTo16(int level){
+    if (level <= 0){
+        return 0;
+    }
+    if (level >= LED_MAX_BRIGHTNESS){
+        return 0xFFFF;
+    }
+    return level * (level + 2);                                                 // squared curve, 255 -> 65535
+}
+
+
+uint16_t led_powerLimit(uint16_t scale){
+    static const PowerModel model   = {LED_NUM, LED_POWER_BUDGET, LED_IDLE_CURRENT, LED_CHANNEL_CURRENT};
+    uint32_t        cycles      = ESP.getCycleCount();
+    uint64_t        weight;
+    uint16_t        limited;
+
+    weight = power_weight((const uint8_t *)leds, calTable.pixel, &calTable.curve[0][0][0], CAL_POINTS, LED_NUM);
+    limited = power_limit(&model, weight, scale);
+    if (limited < scale){
+        powerLimitedFrames += 1;
+    }
+    scale = limited;
+
+    powerCurrent = power_current(&model, weight, scale);
+    if (powerCurrent > powerCurrentMax){
+        powerCurrentMax = powerCurrent;
+    }
+
+    cycles = ESP.getCycleCount() - cycles;
+    if (cycles > powerCyclesMax){
+        powerCyclesMax = cycles;
+    }
+    return scale;
+}
+
+
+void server_htmlRender(void){
+    if (provState != PROV_OFF){
+        render_provision();
+    }
+    else if (ledState){
+        render_active();
+    }
+    else {
+        render_inactive();
+    }
+}
+
+void server_statsRender(void){
+    HtmlStream      out;
+    unsigned long   chargeMAh   = power_chargeMAh(powerCharge);
+    unsigned long   energyMWh   = power_energyMWh(powerCharge, LED_SUPPLY_VOLTAGE);
+
+    // one render_printf per subsystem, each well below HTML_CHUNK_SIZE formatted
+    render_begin(&out, "application/json");
+    render_printf(&out,
+        "{\"variant\":\"%s\",\"leds\":%u,\"refreshRate\":%lu,\"refreshLoad\":%lu.%lu,\"showTime\":%lu,\"showTimeMax\":%lu,"
+        "\"mixCycles\":%lu,\"mixCyclesMax\":%lu,\"rotateCycles\":%lu,\"rotateCyclesMax\":%lu,\"ledJitterMax\":%lu,",
+        LAMP_VARIANT, LED_NUM, ledRefreshRate, ledRefreshLoad / 10, ledRefreshLoad % 10, ledShowTimeLast, ledShowTimeMax,
+        ledMixCycles, ledMixCyclesMax, rotateCycles, rotateCyclesMax, ledJitterMax);
+    render_printf(&out,
+        "\"current\":%lu,\"currentMax\":%lu,\"budget\":%u,\"limitedFrames\":%lu,"
+        "\"powerCyclesMax\":%lu,\"charge\":%lu,\"energy\":%lu,",
+        powerCurrent, powerCurrentMax, LED_POWER_BUDGET, powerLimitedFrames,
+        powerCyclesMax, chargeMAh, energyMWh);
+    render_printf(&out,
+        "\"renderBytes\":%lu,\"renderHeap\":%lu,\"renderHeapMax\":%lu,\"renderTruncated\":%lu,\"provisionTime\":%lu,"
+        "\"logUartDropped\":%lu,\"logSyslogDropped\":%lu,\"logCyclesMax\":%lu,",
+        renderBytesLast, renderHeapLast, renderHeapMax, renderTruncated, provTime,
+        logUartDropped, logSyslogDropped, logCyclesMax);
+    render_printf(&out,
+        "\"commands\":%lu,\"merged\":%lu,\"cmdLatency\":%lu,\"cmdLatencyMax\":%lu,"
+        "\"frames\":%lu,\"frameRate\":%lu,\"frameErrors\":%lu,\"effectCyclesMax\":%lu,\"effectNsPerOp\":%lu,",
+        cmdCount, cmdMerged, cmdLatency, cmdLatencyMax,
+        frameCount, frameRate, frameErrors, effectCyclesMax, effectNsPerOp);
+    render_printf(&out,
+        "\"ota\":%u,\"otaBytes\":%lu,\"otaRate\":%lu,\"otaJitterMax\":%lu,\"otaTrial\":%lu,"
+        "\"mqtt\":%u,\"mqttRx\":%lu,\"mqttTx\":%lu,\"mqttRxRate\":%lu,\"mqttTxRate\":%lu,\"mqttReconnects\":%lu,",
+        otaState, otaWritten, otaRate, otaJitterMax, (unsigned long)otaRtc.trial,
+        mqttSession.state, mqttSession.rx, mqttSession.tx, mqttRxRate, mqttTxRate, mqttSession.reconnects);
+    render_printf(&out,
+        "\"audioCyclesMax\":%lu,\"audioLatency\":%lu,\"audioLatencyMax\":%lu,\"audioGaps\":%lu,"
+        "\"inputEvents\":%lu,\"inputDropped\":%lu,",
+        audioCyclesMax, audioLatency, audioLatencyMax, audioGaps,
+        inputEvents, inputDropped);
+    render_printf(&out,
+        "\"httpConnections\":%lu,\"httpRequests\":%lu,\"httpIdleClosed\":%lu,\"httpThrottled\":%lu,\"httpDeferred\":%lu,"
+        "\"udpPackets\":%lu,\"udpStale\":%lu,\"udpErrors\":%lu,\"mdnsQueries\":%lu,\"mdnsReplies\":%lu,\"mdnsReplyMax\":%lu,",
+        httpConnections, httpRequests, httpIdleClosed, httpThrottled, httpDeferred,
+        udpPackets, udpStale, udpErrors, mdnsQueries, mdnsReplies, mdnsReplyMax);
+    render_printf(&out,
+        "\"heapFree\":%lu,\"heapMin\":%lu,\"heapBlockMin\":%lu,\"heapFragMax\":%lu,\"heapAllocs\":%lu,"
+        "\"boots\":%lu,\"stalls\":%lu,\"crashes\":%lu,\"slowLoops\":%lu,\"loopMax\":%lu,"
+        "\"micros\":%lu,\"idle\":%lu,\"tasks\":[",
+        (unsigned long)ESP.getFreeHeap(), diagHeapMin, heapBlockMin, heapFragMax, heapAllocs,
+        (unsigned long)diagRtc.boots, (unsigned long)diagRtc.stalls, (unsigned long)diagRtc.crashes,
+        diagSlowLoops, diagLoopMax, micros(), schedIdle);
+    for (uint8_t i = 0; i < (sizeof(tasks) / sizeof(tasks[0])); i++){
+        render_printf(&out,
+            "%s{\"name\":\"%s\",\"runs\":%lu,\"busy\":%lu,\"maxTime\":%lu,\"maxLate\":%lu,\"missed\":%lu}",
+            (i > 0) ? "," : "", tasks[i].name, tasks[i].runs, tasks[i].busy,
+            tasks[i].maxTime, tasks[i].maxLate, tasks[i].missed);
+    }
+    render_printf(&out, "],\"clients\":[");
+    for (uint8_t i = 0, n = 0; i < RATE_CLIENTS; i++){
+        if (0 == rateClients[i].ip){
+            continue;
+        }
+        render_printf(&out, "%s{\"ip\":\"%u.%u.%u.%u\",\"requests\":%lu,\"throttled\":%lu}", (n++ > 0) ? "," : "",
+            (unsigned int)(rateClients[i].ip & 0xFF), (unsigned int)((rateClients[i].ip >> 8) & 0xFF),
+            (unsigned int)((rateClients[i].ip >> 16) & 0xFF), (unsigned int)(rateClients[i].ip >> 24),
+            rateClients[i].requests, rateClients[i].throttled);
+    }
+    render_printf(&out, "]}");
+    render_flush(&out);
+}
+
+
+void server_renderTemplate(PGM_P tmpl){
+    HtmlStream      out;
+    char            key[HTML_KEY_LEN];
+    uint8_t         keyLen;
+    char            c;
+    uint32_t        heapStart   = ESP.getFreeHeap();
+
+    render_begin(&out, "text/html");
+
+    while (0 != (c = pgm_read_byte(tmpl))){
+        tmpl += 1;
+        if (('{' == c) && ('{' == pgm_read_byte(tmpl))){
+            tmpl += 1;
+            keyLen = 0;
+            while ((0 != (c = pgm_read_byte(tmpl))) && ('}' != c)){
+                if (keyLen < (HTML_KEY_LEN - 1)){
+                    key[keyLen] = c;
+                    keyLen += 1;
+                }
+                tmpl += 1;
+            }
+            key[keyLen] = '\0';
+            if ('}' == pgm_read_byte(tmpl)){
+                tmpl += 1;
+            }
+            if ('}' == pgm_read_byte(tmpl)){
+                tmpl += 1;
+            }
+            render_placeholder(&out, key);
+        }
+        else {
+            if (out.len == sizeof(out.buf)){
+                render_flush(&out);
+            }
+            out.buf[out.len] = c;
+            out.len += 1;
+        }
+    }
+    render_flush(&out);
+
+    renderBytesLast = out.total;
+    renderHeapLast = heapStart - out.heapMin;
+    if (renderHeapLast > renderHeapMax){
+        renderHeapMax = renderHeapLast;
+    }
+}
+
+
+void render_begin(HtmlStream *out, const char *contentType){
+    out->len = 0;
+    out->total = 0;
+    out->heapMin = ESP.getFreeHeap();
+
+    webServer.setContentLength(CONTENT_LENGTH_UNKNOWN);                         // HTTP/1.1 -> Transfer-Encoding: chunked
+    server_send(200, contentType, "");
+}
+
+
+void render_placeholder(HtmlStream *out, const char *key){
+    if (0 == strcmp(key, "version")){
+        render_printf(out, "%.1f", infoVersion);
+    }
+    else if (0 == strcmp(key, "brightness")){
+        render_printf(out, "%d", (ledBrightness * 100) / LED_MAX_BRIGHTNESS);
+    }
+    else if (0 == strcmp(key, "red")){
+        render_printf(out, "%u", redVal);
+    }
+    else if (0 == strcmp(key, "green")){
+        render_printf(out, "%u", greenVal);
+    }
+    else if (0 == strcmp(key, "blue")){
+        render_printf(out, "%u", blueVal);
+    }
+    else if (0 == strcmp(key, "color")){
+        render_printf(out, "%06X", ledColor & 0xFFFFFF);
+    }
+    else if (0 == strcmp(key, "palette")){
+        for (uint8_t i = 0; i < palette.size; i++){
+            render_printf(out,
+                "<a href='/color/%u'><button class='colorBtn%s' style='background-color: #%02X%02X%02X;'></button></a>\n",
+                i, (((palette.rgb[i][0] << 16) | (palette.rgb[i][1] << 8) | palette.rgb[i][2]) == ledColor) ? " selected" : "",
+                palette.rgb[i][0], palette.rgb[i][1], palette.rgb[i][2]);
+        }
+    }
+    else if (0 == strcmp(key, "networks")){
+        for (int i = 0; i < provNetworks; i++){
+            render_printf(out, "<option value='");
+            render_escaped(out, WiFi.SSID_cstr(i));
+            render_printf(out, "'>");
+            render_escaped(out, WiFi.SSID_cstr(i));
+            render_printf(out, " (%ld dBm%s)</option>\n", (long)WiFi.RSSI(i),
+                (ENC_TYPE_NONE == WiFi.encryptionType(i)) ? ", open" : "");
+        }
+    }
+    else if (0 == strcmp(key, "provStatus")){
+        if (PROV_SCANNING == provState){
+            render_printf(out, "Scanning for networks...");
+        }
+        else if (PROV_CONNECTING == provState){
+            render_printf(out, "Connecting to ");
+            render_escaped(out, wifiSSID);
+            render_printf(out, "... reload this page in a few seconds.");
+        }
+        else if (provFailed){
+            render_printf(out, "Could not connect to ");
+            render_escaped(out, wifiSSID);
+            render_printf(out, ". Check the password and try again.");
+        }
+        else {
+            render_printf(out, "Select your WiFi network.");
+        }
+    }
+}
+
+
+void render_escaped(HtmlStream *out, const char *text){
+    for (; '\0' != *text; text++){
+        switch (*text){
+            case '&':   render_printf(out, "&amp;");    break;
+            case '<':   render_printf(out, "&lt;");     break;
+            case '>':   render_printf(out, "&gt;");     break;
+            case '\'':  render_printf(out, "&#39;");    break;
+            case '"':   render_printf(out, "&quot;");   break;
+            default:    render_printf(out, "%c", *text); break;
+        }
+    }
+}
+
+
+void render_printf(HtmlStream *out, const char *format, ...){
+    va_list     args;
+    int         len;
+
+    va_start(args, format);
+    len = vsnprintf(out->buf + out->len, sizeof(out->buf) - out->len, format, args);
+    va_end(args);
+    if ((len >= 0) && ((size_t)len >= (sizeof(out->buf) - out->len))){          // did not fit, flush and format again
+        render_flush(out);
+        va_start(args, format);
+        len = vsnprintf(out->buf, sizeof(out->buf), format, args);
+        va_end(args);
+        if ((size_t)len >= sizeof(out->buf)){
+            LOG_WARN("render_printf: %d bytes cut to %u, split the format", len, (unsigned int)(sizeof(out->buf) - 1));
+            renderTruncated += 1;
+            len = sizeof(out->buf) - 1;                                         // truncated
+        }
+    }
+    if (len > 0){
+        out->len += len;
+    }
+}
+
+
+void render_flush(HtmlStream *out){
+    uint32_t    heap;
+
+    if (0 == out->len){                                                         // an empty chunk would end the response
+        return;
+    }
+    webServer.sendContent(out->buf, out->len);
+    out->total += out->len;
+    traceBytes += out->len;
+    out->len = 0;
+    heap = ESP.getFreeHeap();
+    if (heap < out->heapMin){
+        out->heapMin = heap;
+    }
+}
+
+
 void render_inactive(void){
-    String strHtmlContent = R"""(
+    static const char html[] PROGMEM = R"""(
 <!DOCTYPE html>
 <html lang='en'>
 <head>
@@ -684,7 +2400,7 @@ margin-top: 50vh;
 position: absolute;
 }
 </style>
-<title>Eperly-Lite v1.1</title>
+<title>Eperly-Lite v{{version}}</title>
 </head>
 <body id='body'>
 <div id='building-container0'>
@@ -716,12 +2432,12 @@ position: absolute;
 </body>
 </html>
     )""";
-    webServer.send(200, "text/html", strHtmlContent);
+    server_renderTemplate(html);
 }
 
 
 void render_active(void){
-    String strHtmlContent = R"""(
+    static const char html[] PROGMEM = R"""(
 <!DOCTYPE html>
 <html lang='en'>
 <head>
@@ -850,6 +2566,9 @@ z-index: 1;
 height: 35px;
 width: 35px;
 }
+.colorBtn.selected {
+border: 3px solid black;
+}
 .adjustBtn {
 width: 100px;
 opacity: 100%;
@@ -967,11 +2686,11 @@ margin-top: 50vh;
 position: absolute;
 }
 </style>
-<title>Eperly-Lite v1.1</title>
+<title>Eperly-Lite v{{version}}</title>
 </head>
 <body id='body'>
 <div id='title'>
-Eperly-Lite v1.1
+Eperly-Lite v{{version}}
 </div>
 
 <div id='building-container0'>
@@ -992,7 +2711,7 @@ Eperly-Lite v1.1
 <div id='building-filter'></div>
 <div id='page-container'>
 <div class='lightBulb-container'>
-<a href='/off'><div id='lightBulb' class='lightBulb'>ON</div></a>
+<a href='/off'><div id='lightBulb' class='lightBulb' style='background-color: #{{color}};'>ON</div></a>
 </div>
 <div id='optionsMenu'>
 <a href='/static'><button type='button' class='optionMenu'>Static</button></a>
@@ -1003,184 +2722,257 @@ Eperly-Lite v1.1
 <div class='slider-container'>
 <div id='fineTuneBtn' class='quantizable'>
 <a href='/brightness/dec'><button class='adjustBtn'>-</button></a>
-<p>Brightness</p>
+<p>Brightness {{brightness}}%</p>
 <a href='/brightness/inc'><button class='adjustBtn'>+</button></a>
 </div>
 <div id='fineTuneBtn' class='quantizable'>
 <a href='/r/dec'><button class='adjustBtn'>-</button></a>
-<p>Red</p>
+<p>Red {{red}}</p>
 <a href='/r/inc'><button class='adjustBtn'>+</button></a>
 </div>
 <div id='fineTuneBtn' class='quantizable'>
 <a href='/g/dec'><button class='adjustBtn'>-</button></a>
-<p>Green</p>
+<p>Green {{green}}</p>
 <a href='/g/inc'><button class='adjustBtn'>+</button></a>
 </div>
 <div id='fineTuneBtn' class='quantizable'>
 <a href='/b/dec'><button class='adjustBtn'>-</button></a>
-<p>Blue</p>
+<p>Blue {{blue}}</p>
 <a href='/b/inc'><button class='adjustBtn'>+</button></a>
 </div>
 </div>
 <div class='paletteContainer'>
-<a href='/color/0'><button class='colorBtn' style='background-color: #FF9329;'></button></a>
-<a href='/color/1'><button class='colorBtn' style='background-color: #FFC58F;'></button></a>
-<a href='/color/2'><button class='colorBtn' style='background-color: #FFD6AA;'></button></a>
-<a href='/color/3'><button class='colorBtn' style='background-color: #FFF1E0;'></button></a>
-<a href='/color/4'><button class='colorBtn' style='background-color: #FFFAF4;'></button></a>
-<a href='/color/5'><button class='colorBtn' style='background-color: #FFFFF0;'></button></a>
-<a href='/color/6'><button class='colorBtn' style='background-color: #FFFFFB;'></button></a>
-<a href='/color/7'><button class='colorBtn' style='background-color: #FFFFFF;'></button></a>
-<a href='/color/8'><button class='colorBtn' style='background-color: #C9E2FF;'></button></a>
-<a href='/color/9'><button class='colorBtn' style='background-color: #409CFF;'></button></a>
-<a href='/color/10'><button class='colorBtn' style='background-color: #F2D68B;'></button></a>
-<a href='/color/11'><button class='colorBtn' style='background-color: #EF8A1B;'></button></a>
-<a href='/color/12'><button class='colorBtn' style='background-color: #ED583B;'></button></a>
-<a href='/color/13'><button class='colorBtn' style='background-color: #F4B8CE;'></button></a>
-<a href='/color/14'><button class='colorBtn' style='background-color: #EFA8A8;'></button></a>
-<a href='/color/15'><button class='colorBtn' style='background-color: #E85B94;'></button></a>
-<a href='/color/16'><button class='colorBtn' style='background-color: #C9245F;'></button></a>
-<a href='/color/17'><button class='colorBtn' style='background-color: #EF353F;'></button></a>
-<a href='/color/18'><button class='colorBtn' style='background-color: #BF1D29;'></button></a>
-<a href='/color/19'><button class='colorBtn' style='background-color: #89030D;'></button></a>
-<a href='/color/20'><button class='colorBtn' style='background-color: #D4EEEB;'></button></a>
-<a href='/color/21'><button class='colorBtn' style='background-color: #C6E4D9;'></button></a>
-<a href='/color/22'><button class='colorBtn' style='background-color: #85D0C6;'></button></a>
-<a href='/color/23'><button class='colorBtn' style='background-color: #73CDD1;'></button></a>
-<a href='/color/24'><button class='colorBtn' style='background-color: #00BDAE;'></button></a>
-<a href='/color/25'><button class='colorBtn' style='background-color: #1194A7;'></button></a>
-<a href='/color/26'><button class='colorBtn' style='background-color: #10686B;'></button></a>
-<a href='/color/27'><button class='colorBtn' style='background-color: #597C2B;'></button></a>
-<a href='/color/28'><button class='colorBtn' style='background-color: #0A5C36;'></button></a>
-<a href='/color/29'><button class='colorBtn' style='background-color: #14452F;'></button></a>
-<a href='/color/30'><button class='colorBtn' style='background-color: #C1E9FC;'></button></a>
-<a href='/color/31'><button class='colorBtn' style='background-color: #6ACDE6;'></button></a>
-<a href='/color/32'><button class='colorBtn' style='background-color: #0087BF;'></button></a>
-<a href='/color/33'><button class='colorBtn' style='background-color: #29338E;'></button></a>
-<a href='/color/34'><button class='colorBtn' style='background-color: #D69AC8;'></button></a>
-<a href='/color/35'><button class='colorBtn' style='background-color: #C28DE0;'></button></a>
-<a href='/color/36'><button class='colorBtn' style='background-color: #9990BA;'></button></a>
-<a href='/color/37'><button class='colorBtn' style='background-color: #7F4599;'></button></a>
-<a href='/color/38'><button class='colorBtn' style='background-color: #691D69;'></button></a>
-<a href='/color/39'><button class='colorBtn' style='background-color: #411E5C;'></button></a>
-</div>
+{{palette}}</div>
 </body>
 </html>
     )""";
-    webServer.send(200, "text/html", strHtmlContent);
+    server_renderTemplate(html);
 }
 
-void lamp_on(void){
-    ledState = true;
-    if (ledPattern == STATIC){
-        led_setToStatic();
+void render_provision(void){
+    static const char html[] PROGMEM = R"""(
+<!DOCTYPE html>
+<html lang='en'>
+<head>
+<meta charset='UTF-8'/>
+<meta name='viewport' content='width=device-width, initial-scale=1'/>
+<style>
+body {
+background: rgb(0, 0, 0);
+color: white;
+display: flex;
+flex-direction: column;
+align-items: center;
+font-family: fantasy, cursive;
+}
+form {
+display: flex;
+flex-direction: column;
+gap: 2vh;
+width: 80vw;
+max-width: 400px;
+}
+select, input, button {
+font-size: 150%;
+border-radius: 10px;
+}
+a {
+color: white;
+}
+</style>
+<title>Eperly-Lite v{{version}} Setup</title>
+</head>
+<body>
+<h2>Eperly-Lite WiFi Setup</h2>
+<p>{{provStatus}}</p>
+<form method='POST' action='/wifi'>
+<select name='ssid'>
+{{networks}}</select>
+<input type='text' name='other' placeholder='or type a hidden SSID' maxlength='32'/>
+<input type='password' name='password' placeholder='Password' maxlength='64'/>
+<button type='submit'>Connect</button>
+</form>
+<p><a href='/wifi/scan'>Scan again</a></p>
+</body>
+</html>
+    )""";
+    server_renderTemplate(html);
+}
+
+
+void server_notFound(void){
+    traceRouted = false;                                                        // not interned as a route
+    if (provState != PROV_OFF){                                                 // captive portal: send every probe to setup
+        snprintf(serverMsg, sizeof(serverMsg), "http://%u.%u.%u.%u/wifi",
+            WiFi.softAPIP()[0], WiFi.softAPIP()[1], WiFi.softAPIP()[2], WiFi.softAPIP()[3]);
+        webServer.sendHeader("Location", serverMsg, true);
+        server_send(302, "text/plain", "");
+    }
+    else {
+        server_send(404, "text/plain", "Not found");
+    }
+}
+
+
+void server_commandDone(void){
+    webServer.sendHeader("Location", "/", true);                                // cheap answer, the page renders on GET /
+    server_send(303, NULL, "");
+}
+
+
+void server_send(int code, const char *contentType, const char *content){
+    // every response goes out here, after the request headers are parsed: only ever turns keep-alive
+    // off, a "Connection: close" or HTTP/1.0 request stays closed
+    if (httpConnLast){
+        webServer.keepAlive(false);
     }
-    else if (ledPattern == ROTATE){
-        led_setToRotate();
+    webServer.send(code, contentType, content);
+}
+
+
+ESP8266WebServer::ClientFuture server_keepAliveHook(const String &method, const String &url, WiFiClient *client,
+                                                    ESP8266WebServer::ContentTypeFunction contentType){
+    uint32_t    ip      = client->remoteIP();
+    uint16_t    port    = client->remotePort();
+
+    (void)method;
+    (void)url;
+    (void)contentType;
+    if ((ip != httpConnIp) || (port != httpConnPort) || (0 == httpConnRequests)){
+        httpConnIp = ip;
+        httpConnPort = port;
+        httpConnRequests = 0;
+        httpConnections += 1;
     }
-    else if (ledPattern == HEARTBEAT){
-        led_setToHeartbeat();
+    httpConnRequests += 1;
+    httpRequests += 1;
+    // applied by server_send(): the core sets keep-alive from the request headers after the hooks
+    httpConnLast = !HTTP_KEEPALIVE || (httpConnRequests >= HTTP_KEEPALIVE_MAX);
+    if (httpConnRequests >= HTTP_KEEPALIVE_MAX){
+        httpConnRequests = 0;
     }
+    return ESP8266WebServer::CLIENT_REQUEST_CAN_CONTINUE;
 }
 
 
-void lamp_off(void){
-    if ((ledPattern == ROTATE) || (ledPattern == HEARTBEAT)){
-        timerEn = false;
+void server_trackConnection(void){
+    // ESP8266WebServer closes an idle keep-alive socket itself, after HTTP_MAX_DATA_WAIT or after
+    // HTTP_MAX_DATA_AVAILABLE_WAIT once another client has data, so it never holds the others up
+    if ((0 != httpConnRequests) && !webServer.client().connected()){
+        httpConnRequests = 0;                                                   // the next request opens a new connection
+        httpIdleClosed += 1;
     }
-    FastLED.setBrightness(ledBrightness);
-    for (uint8_t i = 0; i < LED_NUM; i++){
-        leds[i] = CRGB::Black;
+}
+
+
+ESP8266WebServer::ClientFuture server_admitHook(const String &method, const String &url, WiFiClient *client,
+                                                ESP8266WebServer::ContentTypeFunction contentType){
+    static const char   reply[]     = "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 1\r\n"
+                                      "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    RateClient          *rate       = rate_client(rateClients, RATE_CLIENTS, client->remoteIP(), millis());
+
+    (void)method;
+    (void)contentType;
+    httpAdmitted += 1;                                                          // counted against this LED frame
+    if (0 == strcmp(url.c_str(), "/frame")){                                    // streaming path, only the frame budget applies
+        rate->requests += 1;
+        return ESP8266WebServer::CLIENT_REQUEST_CAN_CONTINUE;
     }
-    FastLED.show();
-    FastLED.show();
-    redVal = 0x00;
-    greenVal = 0x00;
-    blueVal = 0x00; 
-    ledState = false;
-    server_htmlRender();
+    if (rate_take(rate, millis())){
+        return ESP8266WebServer::CLIENT_REQUEST_CAN_CONTINUE;
+    }
+    // answered before headers are parsed or a handler runs, the connection is closed
+    httpThrottled += 1;
+    traceRouted = false;                                                        // no handler ran, only known routes are named
+    client->write((const uint8_t *)reply, sizeof(reply) - 1);
+    return ESP8266WebServer::CLIENT_MUST_STOP;
+}
+
+
+void lamp_on(void){
+    led_command(lamp_set(true));
+}
+
+
+void lamp_off(void){
+    led_command(lamp_set(false));
+}
+
+
+uint8_t lamp_set(bool on){
+    ledState = on;
+    if (on){
+        led_storeColor(ledColor);                                               // r/g/b tuning values follow the kept color
+        return LED_CMD_PATTERN;                                                 // (re)start the current pattern
+    }
+    return LED_CMD_STATE;                                                       // color and r/g/b are kept for the next on
+}
+
+
+void led_stepBrightness(int delta){
+    ledBrightness = constrain(ledBrightness + delta, LED_MIN_BRIGHTNESS, LED_MAX_BRIGHTNESS);
 }
 
 
 void increase_brightness(void){
     if (ledState){
-        ledBrightness += LED_BRIGHTNESS_INC;
-        if (ledBrightness > LED_MAX_BRIGHTNESS){
-            ledBrightness = LED_MAX_BRIGHTNESS;
-        }
-        if ((ledPattern == STATIC) || (ledPattern == ROTATE)){
-            FastLED.setBrightness(ledBrightness);
-            FastLED.show();
-            FastLED.show();
-        }
+        led_stepBrightness(LED_BRIGHTNESS_INC);
+        led_command(LED_CMD_BRIGHTNESS);
+    }
+    else {
+        server_commandDone();
     }
-    server_htmlRender();
 }
 
 
 void decrease_brightness(void){
     if (ledState){
-        ledBrightness -= LED_BRIGHTNESS_INC;
-        if (ledBrightness < LED_MIN_BRIGHTNESS){
-            ledBrightness = LED_MIN_BRIGHTNESS;
-        }
-        if ((ledPattern == STATIC) || (ledPattern == ROTATE)){
-            FastLED.setBrightness(ledBrightness);
-            FastLED.show();
-            FastLED.show();
-        }
+        led_stepBrightness(-LED_BRIGHTNESS_INC);
+        led_command(LED_CMD_BRIGHTNESS);
     }
-    server_htmlRender();
+    else {
+        server_commandDone();
+    }
+}
+
+
+void led_storeColor(uint32_t color){
+    ledColor = color & 0xFFFFFF;                                                // every color source goes through here
+    redVal = (ledColor & 0xFF0000) >> 16;
+    greenVal = (ledColor & 0x00FF00) >> 8;
+    blueVal = ledColor & 0x0000FF;
 }
 
 
 void led_setColor(void){
     if (ledState){
-        if (ledPattern == STATIC){
-            FastLED.setBrightness(ledBrightness);
-            for (uint8_t i = 0; i < LED_NUM; i++){
-                leds[i] = ledColor;
-            }
-            FastLED.show();
-            FastLED.show();
-        }
-        else if (ledPattern == HEARTBEAT){
-            FastLED.showColor(ledColor, ledBrightnessInc);
-        }
-        redVal = (ledColor & 0xFF0000) >> 16;
-        greenVal = (ledColor & 0x00FF00) >> 8;
-        blueVal = ledColor & 0x0000FF;
+        led_command(LED_CMD_COLOR);
+    }
+    else {
+        server_commandDone();
     }
-    server_htmlRender();
 }
 
 
 void color_set(void){
-    uint8_t     index;
-    String      hyperlink = webServer.uri();
+    int         index   = atoi(webServer.uri().c_str() + strlen("/color/"));
 
-    index = 39;
-    while (index >= 0){
-        if (hyperlink.indexOf(String(index)) >= 0){
-            break;
-        }
-        index -= 1;
+    if ((index < 0) || (index >= palette.size)){
+        server_commandDone();
+        return;
     }
-    ledColor = colorTable[index];
-    led_setColor();        
+    led_storeColor((palette.rgb[index][0] << 16) | (palette.rgb[index][1] << 8) | palette.rgb[index][2]);
+    led_setColor();
 }
 
 
 void led_setToStatic(void){
     if (ledState){
-        if ((ledPattern == ROTATE) || (ledPattern == HEARTBEAT)){
-            timerEn = false;
-        }
         ledPattern = STATIC;
-        led_setColor();
+        led_command(LED_CMD_PATTERN);
     }
     else {
-        server_htmlRender();
+        server_commandDone();
     }
 }
 
@@ -1188,119 +2980,2515 @@ void led_setToStatic(void){
 void led_setToRotate(void){
     if (ledState){
         ledPattern = ROTATE;
-        ledIndex = 0;
-        FastLED.showColor(CRGB::Black, LED_MAX_BRIGHTNESS);
-        FastLED.showColor(CRGB::Black, LED_MAX_BRIGHTNESS);
-        leds[LED_NUM - 1] = CRGB::Black;
-        leds[ledIndex] = ledColor;
-        FastLED.show();
-        FastLED.show();
-
-        timerEn = true;
-        timeStamp = millis();
+        led_command(LED_CMD_PATTERN);
+    }
+    else {
+        server_commandDone();
     }
-    server_htmlRender();
 }
 
 
 void led_setToHeartbeat(void){
     if (ledState){
         ledPattern = HEARTBEAT;
-        ledBrightnessInc = ledBrightness;
-        heartbeatDir = false;
-        FastLED.showColor(ledColor, ledBrightnessInc);
-        timerEn = true;
-        timeStamp = millis();
+        led_command(LED_CMD_PATTERN);
     }
-    server_htmlRender();
+    else {
+        server_commandDone();
+    }
+}
+
+
+void led_setToAudio(void){
+    ledState = true;                                                            // also switches the lamp on
+    ledPattern = AUDIO;
+    led_command(LED_CMD_PATTERN);
+}
+
+
+void led_rotateRender(void){
+    uint32_t        cycles  = ESP.getCycleCount();
+    const uint32_t  ring    = LED_NUM << 8;
+    uint32_t        period  = max(ledRotateDelay, 1U);
+    uint32_t        span    = (ledRotateTail + 1) << 8;                         // head pixel plus tail, 8.8
+    uint32_t        pos;
+    uint32_t        rel;
+    uint16_t        weight;
+    CRGB            color   = ledColor;
+
+    // head position in 8.8 pixels from elapsed time, exact at any frame rate
+    pos = (((millis() - timeStamp) % (period * LED_NUM)) << 8) / period;
+    ledIndex = pos >> 8;
+
+    for (uint8_t i = 0; i < LED_NUM; i++){
+        rel = (pos + ring - (i << 8)) % ring;                                   // how far the head is past pixel i
+        if (rel < span){
+            weight = 256 - (rel << 8) / span;                                   // at or behind the head, fades along the tail
+        }
+        else if ((ring - rel) < 256){
+            weight = 256 - (ring - rel);                                        // leading pixel, the head's fraction
+        }
+        else {
+            weight = 0;
+        }
+        // weights are linear light. With the leading pixel they add up to 256 + 128 * tail (less rounding)
+        // wherever the head is, so the total light of the strip stays constant while it moves (the two head
+        // pixels alone only sum to 256 with no tail)
+        leds[i].r = (color.r * weight) >> 8;
+        leds[i].g = (color.g * weight) >> 8;
+        leds[i].b = (color.b * weight) >> 8;
+    }
+
+    rotateCycles = ESP.getCycleCount() - cycles;
+    rotateCyclesMax = max(rotateCyclesMax, rotateCycles);
+}
+
+
+void led_rotateConfig(void){
+    long    speed   = webServer.hasArg("speed") ? webServer.arg("speed").toInt() : ledRotateDelay;
+    long    tail    = webServer.hasArg("tail") ? webServer.arg("tail").toInt() : ledRotateTail;
+
+    if ((speed < 10) || (speed > 60000) || (tail < 0) || (tail > (LED_NUM - 2))){
+        snprintf(serverMsg, sizeof(serverMsg), "Expected speed=<10..60000 ms per pixel>&tail=<0..%u>", LED_NUM - 2);
+        server_send(400, "text/plain", serverMsg);
+        return;
+    }
+    ledRotateDelay = speed;
+    ledRotateTail = tail;
+    led_command(LED_CMD_PATTERN);
 }
 
 
 void increase_redVal(void){
-    redVal += LED_COLOR_TUNE_INC;
-    if (redVal > 255){
+    if (redVal > (255 - LED_COLOR_TUNE_INC)){
         redVal = 255;
     }
-    ledColor = (redVal << 16) | (greenVal << 8) | blueVal;
+    else {
+        redVal += LED_COLOR_TUNE_INC;
+    }
+    led_storeColor((redVal << 16) | (greenVal << 8) | blueVal);
     led_setColor();
 }
 
 
 void increase_greenVal(void){
-    greenVal += LED_COLOR_TUNE_INC;
-    if (greenVal > 255){
+    if (greenVal > (255 - LED_COLOR_TUNE_INC)){
         greenVal = 255;
     }
-    ledColor = (redVal << 16) | (greenVal << 8) | blueVal;
+    else {
+        greenVal += LED_COLOR_TUNE_INC;
+    }
+    led_storeColor((redVal << 16) | (greenVal << 8) | blueVal);
     led_setColor();
 }
 
 
 void increase_blueVal(void){
-    blueVal += LED_COLOR_TUNE_INC;
-    if (blueVal > 255){
+    if (blueVal > (255 - LED_COLOR_TUNE_INC)){
         blueVal = 255;
     }
-    ledColor = (redVal << 16) | (greenVal << 8) | blueVal;
+    else {
+        blueVal += LED_COLOR_TUNE_INC;
+    }
+    led_storeColor((redVal << 16) | (greenVal << 8) | blueVal);
     led_setColor();
 }
 
 
 void decrease_redVal(void){
-    redVal -= LED_COLOR_TUNE_INC;
-    if (redVal < 0){
+    if (redVal < LED_COLOR_TUNE_INC){
         redVal = 0;
     }
-    ledColor = (redVal << 16) | (greenVal << 8) | blueVal;
+    else {
+        redVal -= LED_COLOR_TUNE_INC;
+    }
+    led_storeColor((redVal << 16) | (greenVal << 8) | blueVal);
     led_setColor();
 }
 
 
 void decrease_greenVal(void){
-    greenVal -= LED_COLOR_TUNE_INC;
-    if (greenVal < 0){
+    if (greenVal < LED_COLOR_TUNE_INC){
         greenVal = 0;
     }
-    ledColor = (redVal << 16) | (greenVal << 8) | blueVal;
+    else {
+        greenVal -= LED_COLOR_TUNE_INC;
+    }
+    led_storeColor((redVal << 16) | (greenVal << 8) | blueVal);
     led_setColor();
 }
 
 
 void decrease_blueVal(void){
-    blueVal -= LED_COLOR_TUNE_INC;
-    if (blueVal < 0){
+    if (blueVal < LED_COLOR_TUNE_INC){
         blueVal = 0;
     }
-    ledColor = (redVal << 16) | (greenVal << 8) | blueVal;
+    else {
+        blueVal -= LED_COLOR_TUNE_INC;
+    }
+    led_storeColor((redVal << 16) | (greenVal << 8) | blueVal);
     led_setColor();
 }
 
 
-void eeprom_init(void){
-    Serial.println("Initializing EEPROM");
-    EEPROM.begin(EEPROM_SIZE);
+void task_schedule(void){
+    time_t          now     = time(NULL);
+    unsigned long   sleep   = SCHEDULE_SLEEP_MAX;
+
+    if (now < SCHEDULE_EPOCH_VALID){
+        return;                                                                 // SNTP has not answered yet
+    }
+    if (scheduleDirty){
+        scheduleDirty = false;
+        scheduleNext = schedule_next(schedule, SCHEDULE_MAX, now, -1, &scheduleNextTime);
+    }
+    while ((scheduleNext >= 0) && (now >= scheduleNextTime)){                   // O(1) per tick unless events are due
+        schedule_fire(&schedule[scheduleNext]);
+        scheduleNext = schedule_next(schedule, SCHEDULE_MAX, scheduleNextTime, scheduleNext, &scheduleNextTime);
+    }
+    if (scheduleNext >= 0){
+        sleep = constrain(scheduleNextTime - now, 1, SCHEDULE_SLEEP_MAX);
+    }
+    schedCurrent->period = sleep * 1000000UL;                                   // sleeps until the next event is due
 }
 
 
-void eeprom_read(void){
-    int     addr            = 0;
-    byte    readValue;
-    uint8_t ssidIndex       = 0;
-    uint8_t passwordIndex   = 0;
+void schedule_init(void){
+    File            file;
+    StoreHeader     header;
 
-    readValue = EEPROM.read(addr);
-    if ('\n' == char(readValue)){
-        wifiInfoPresent = true;
-        addr += 1;
+    memset(schedule, 0, sizeof(schedule));
+    file = LittleFS.open(SCHEDULE_FILE, "r");
+    if (file && (file.read((uint8_t *)&header, sizeof(header)) == sizeof(header)) &&
+        (header.magic == SCHEDULE_MAGIC) && (header.count == SCHEDULE_MAX)){
+        file.read((uint8_t *)schedule, sizeof(schedule));
+    }
+    if (file){
+        file.close();
+    }
+    settimeofday_cb(schedule_timeSet);
+    configTime(SCHEDULE_TZ, SCHEDULE_NTP_SERVER);                               // SNTP starts once WiFi is up
+    scheduleDirty = true;
+}
+
+
+void schedule_timeSet(void){
+    scheduleDirty = true;                                                       // clock jumped, next event may differ
+}
+
+
+void schedule_fire(const ScheduleEntry *entry){
+    LOG_INFO("Schedule %d: %s, brightness %u, fade %us", (int)(entry - schedule),
+        entry->state ? "on" : "off", entry->brightness, entry->fade);
+    scheduleFired += 1;
+    if (entry->state){
+        fadeFrom = ledState ? ledBrightness : LED_MIN_BRIGHTNESS;
+        fadeTo = constrain(entry->brightness, LED_MIN_BRIGHTNESS, LED_MAX_BRIGHTNESS);
+        fadeOff = false;
+        ledState = true;
+        ledBrightness = fadeFrom;
     }
     else {
-        wifiInfoPresent = false;
-        return;
+        if (!ledState){
+            return;
+        }
+        fadeFrom = ledBrightness;
+        fadeTo = LED_MIN_BRIGHTNESS;
+        fadeOff = true;
+    }
+    led_queue(LED_CMD_STATE);                                                   // cancels a running fade
+    fadeStart = millis();
+    fadeDuration = entry->fade * 1000UL;
+    fadeActive = true;
+}
+
+
+void schedule_fade(void){
+    unsigned long   elapsed = millis() - fadeStart;
+
+    if (elapsed >= fadeDuration){
+        fadeActive = false;
+        ledBrightness = fadeTo;
+        if (fadeOff){
+            ledBrightness = fadeFrom;                                           // switching back on resumes the old level
+            ledState = false;
+            led_queue(LED_CMD_STATE);
+            return;
+        }
+    }
+    else {
+        ledBrightness = fadeFrom + ((long)(fadeTo - fadeFrom) * (long)elapsed) / (long)fadeDuration;
+    }
+    if ((ledPattern != HEARTBEAT) && (ledPattern != AUDIO)){                    // those scale ledBrightness themselves
+        ledFrameBrightness = ledBrightness;
+    }
+}
+
+
+bool schedule_save(void){
+    File            file;
+    StoreHeader     header;
+    bool            ok;
+
+    header.magic = SCHEDULE_MAGIC;
+    header.count = SCHEDULE_MAX;
+    header.active = 0;
+    header.reserved = 0;
+    file = LittleFS.open(SCHEDULE_FILE, "w");
+    if (!file){
+        return false;
+    }
+    ok = (file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header)) &&
+         (file.write((const uint8_t *)schedule, sizeof(schedule)) == sizeof(schedule));
+    file.close();
+    scheduleDirty = true;
+    return ok;
+}
+
+
+void schedule_render(void){
+    HtmlStream  out;
+    time_t      now     = time(NULL);
+
+    render_begin(&out, "application/json");
+    render_printf(&out, "{\"time\":%ld,\"synced\":%s,\"next\":%d,\"nextTime\":%ld,\"fired\":%lu,\"entries\":[",
+        (long)now, (now >= SCHEDULE_EPOCH_VALID) ? "true" : "false", scheduleNext, (long)scheduleNextTime, scheduleFired);
+    for (uint8_t i = 0; i < SCHEDULE_MAX; i++){
+        render_printf(&out, "%s{\"id\":%u,\"enabled\":%u,\"time\":\"%02u:%02u\",\"days\":%u,\"state\":\"%s\","
+            "\"brightness\":%u,\"fade\":%u}",
+            (i > 0) ? "," : "", i, schedule[i].enabled, schedule[i].hour, schedule[i].minute, schedule[i].days,
+            schedule[i].state ? "on" : "off", schedule[i].brightness, schedule[i].fade);
+    }
+    render_printf(&out, "]}");
+    render_flush(&out);
+}
+
+
+void schedule_set(void){
+    ScheduleEntry   entry;
+    long            id      = webServer.arg("id").toInt();
+    const char      *at     = webServer.arg("time").c_str();
+    const char      *colon  = strchr(at, ':');
+    long            hour    = atol(at);
+    long            minute  = ((NULL != colon) && (colon > at)) ? atol(colon + 1) : -1;
+    long            days    = webServer.hasArg("days") ? webServer.arg("days").toInt() : 0x7F;
+    long            level   = webServer.hasArg("brightness") ? webServer.arg("brightness").toInt() : LED_MAX_BRIGHTNESS;
+    long            fade    = webServer.arg("fade").toInt();
+
+    if (!webServer.hasArg("id") || (id < 0) || (id >= SCHEDULE_MAX)){
+        server_send(400, "text/plain", "Expected id=<0..7>");
+        return;
+    }
+    if (webServer.hasArg("enabled") && (0 == webServer.arg("enabled").toInt())){   // enabled=0 clears the slot
+        memset(&schedule[id], 0, sizeof(ScheduleEntry));
+    }
+    else if ((hour < 0) || (hour > 23) || (minute < 0) || (minute > 59) || (days < 1) || (days > 0x7F) ||
+             (level < 0) || (level > LED_MAX_BRIGHTNESS) || (fade < 0) || (fade > SCHEDULE_FADE_MAX)){
+        server_send(400, "text/plain", "Expected time=HH:MM&days=<1..127>&state=on|off&brightness=<0..255>&fade=<s>");
+        return;
+    }
+    else {
+        entry.enabled = 1;
+        entry.hour = hour;
+        entry.minute = minute;
+        entry.days = days;
+        entry.state = (0 != strcmp(webServer.arg("state").c_str(), "off"));
+        entry.brightness = level;
+        entry.fade = fade;
+        schedule[id] = entry;
+    }
+    if (!schedule_save()){
+        server_send(500, "text/plain", "Schedule write failed");
+        return;
+    }
+    server_send(200, "text/plain", "OK");
+}
+
+
+void audio_init(void){
+    for (uint8_t b = 0; b < AUDIO_BANDS; b++){
+        audioCoeff[b] = audio_coeff(audioBins[b], AUDIO_BLOCK);
+        audioPeak[b] = AUDIO_PEAK_MIN;
+    }
+}
+
+
+void audio_finishBlock(void){
+    uint32_t    magnitude;
+
+    for (uint8_t b = 0; b < AUDIO_BANDS; b++){
+        magnitude = audio_magnitude(audioCoeff[b], audioS1[b], audioS2[b]);
+        audioPeak[b] = max(magnitude, audioPeak[b] - (audioPeak[b] >> AUDIO_PEAK_DECAY));
+        audioPeak[b] = max(audioPeak[b], (uint32_t)AUDIO_PEAK_MIN);
+        audioLevel[b] = (magnitude < AUDIO_NOISE_FLOOR) ? 0 : min(255UL, (magnitude * 255UL) / audioPeak[b]);
+    }
+    audioReadyStamp = audioBlockStamp;
+    audioFresh = true;
+}
+
+
+void audio_render(void){
+    uint8_t     hue;
+
+    audioRotate += AUDIO_ROTATE_MIN + (audioLevel[2] >> 3);                     // high band: up to ~60 pixels/s at 400Hz
+    audioHue += audioLevel[1] >> 2;                                             // mid band: up to ~100 hue steps/s
+    hue = (audioHue >> 8) + (audioRotate >> 8) * (256 / LED_NUM);
+    for (uint8_t i = 0; i < LED_NUM; i++){
+        leds[i] = CHSV(hue + (i * 256) / LED_NUM, 255, 255);
+    }
+    ledFrameBrightness = LED_MIN_BRIGHTNESS + (audioLevel[0] * (ledBrightness - LED_MIN_BRIGHTNESS)) / 255;   // low band
+
+    if (audioFresh){
+        audioFresh = false;
+        audioLatency = micros() - audioReadyStamp;
+        audioLatencyMax = max(audioLatencyMax, audioLatency);
+    }
+}
+
+
+#if INPUT_ENABLED
+void input_init(void){
+    pinMode(INPUT_BUTTON_PIN, INPUT_PULLUP);
+    pinMode(INPUT_ENC_A_PIN, INPUT_PULLUP);
+    pinMode(INPUT_ENC_B_PIN, INPUT_PULLUP);
+    inputButtonDown = (LOW == digitalRead(INPUT_BUTTON_PIN));
+    inputEncState = (digitalRead(INPUT_ENC_A_PIN) << 1) | digitalRead(INPUT_ENC_B_PIN);
+    attachInterrupt(digitalPinToInterrupt(INPUT_BUTTON_PIN), input_buttonIsr, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(INPUT_ENC_A_PIN), input_encoderIsr, CHANGE);
+    attachInterrupt(digitalPinToInterrupt(INPUT_ENC_B_PIN), input_encoderIsr, CHANGE);
+}
+
+
+void IRAM_ATTR input_push(uint8_t event){
+    // single producer: GPIO interrupts do not nest, task_input() only moves inputTail
+    if ((uint8_t)(inputHead - inputTail) >= INPUT_QUEUE_LEN){
+        inputDropped += 1;
+        return;
+    }
+    inputQueue[inputHead & (INPUT_QUEUE_LEN - 1)] = event;
+    inputHead += 1;                                                             // publish after the slot is written
+}
+
+
+void IRAM_ATTR input_buttonIsr(void){
+    input_push(INPUT_EV_EDGE);                                                  // debounced by task_input()
+}
+
+
+void IRAM_ATTR input_encoderIsr(void){
+    // (previous AB << 2) | AB -> quadrature step, contact bounce cancels itself out
+    static const int8_t steps[16]  = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
+
+    inputEncState = ((inputEncState << 2) | (digitalRead(INPUT_ENC_A_PIN) << 1) | digitalRead(INPUT_ENC_B_PIN)) & 0x0F;
+    inputEncSteps += steps[inputEncState];
+    if (inputEncSteps >= INPUT_ENC_STEPS){
+        inputEncSteps = 0;
+        input_push(INPUT_EV_UP);
+    }
+    else if (inputEncSteps <= -INPUT_ENC_STEPS){
+        inputEncSteps = 0;
+        input_push(INPUT_EV_DOWN);
+    }
+}
+#endif
+
+
+void udp_poll(void){
+    uint8_t     buf[UDP_PACKET_MAX];
+    uint8_t     reply[UDP_REPLY_SIZE];
+    UdpPacket   packet;
+    uint8_t     status;
+    uint32_t    ip;
+    int         len;
+
+    for (uint8_t n = 0; n < UDP_BURST; n++){
+        len = ctrlUdp.parsePacket();
+        if (len <= 0){
+            return;
+        }
+        udpPackets += 1;
+        ip = ctrlUdp.remoteIP();
+        len = ctrlUdp.read(buf, sizeof(buf));                                   // a longer datagram is truncated here
+        if (!udp_parse(buf, len, &packet)){
+            udpErrors += 1;
+            continue;                                                           // not ours, no reply
+        }
+        if ((ip == udpLastIp) && (ctrlUdp.remotePort() == udpLastPort) && !udp_newer(packet.seq, udpLastSeq)){
+            status = UDP_STATUS_STALE;                                          // reordered or repeated, already superseded
+            udpStale += 1;
+        }
+        else {
+            status = udp_apply(packet.ops, packet.len);
+            if (UDP_STATUS_OK == status){
+                udpLastIp = ip;
+                udpLastPort = ctrlUdp.remotePort();
+                udpLastSeq = packet.seq;
+            }
+            else {
+                udpErrors += 1;
+            }
+        }
+        if (packet.flags & UDP_FLAG_ACK_REQ){
+            udp_reply(buf, status, reply);
+            ctrlUdp.beginPacket(ctrlUdp.remoteIP(), ctrlUdp.remotePort());
+            ctrlUdp.write(reply, sizeof(reply));
+            ctrlUdp.endPacket();
+        }
+    }
+}
+
+
+uint8_t udp_apply(const uint8_t *ops, uint8_t len){
+    UdpCommand  cmd;
+    uint8_t     change      = 0;
+
+    if (UDP_STATUS_OK != udp_decode(ops, len, ROTATE, palette.size, &cmd)){
+        return UDP_STATUS_BAD;
+    }
+    if (cmd.has & UDP_HAS_STATE){
+        ledState = cmd.state;
+        change |= LED_CMD_STATE;
+    }
+    if (cmd.has & UDP_HAS_BRIGHTNESS){
+        ledBrightness = constrain(cmd.brightness, LED_MIN_BRIGHTNESS, LED_MAX_BRIGHTNESS);
+        change |= LED_CMD_BRIGHTNESS;
+    }
+    if (cmd.has & UDP_HAS_PALETTE){
+        memcpy(cmd.rgb, palette.rgb[cmd.index], 3);
+    }
+    if (cmd.has & UDP_HAS_COLOR){
+        led_storeColor((cmd.rgb[0] << 16) | (cmd.rgb[1] << 8) | cmd.rgb[2]);    // keeps r/g/b tuning in step
+        change |= LED_CMD_COLOR;
+    }
+    if (cmd.has & UDP_HAS_PATTERN){
+        ledPattern = (LEDPattern)cmd.pattern;
+        change |= LED_CMD_PATTERN;
+    }
+    if (change){
+        led_queue(change);                                                      // picked up by the next task_led()
+    }
+    return UDP_STATUS_OK;
+}
+
+
+void mdns_init(void){
+    snprintf(mdnsHost, sizeof(mdnsHost), "%s-%06x", wifiHostname, (unsigned int)ESP.getChipId());
+    WiFi.hostname(mdnsHost);                                                    // DHCP name, same as the .local name
+}
+
+
+void mdns_poll(void){
+    uint8_t         buf[MDNS_QUERY_MAX];
+    MdnsQuestion    question;
+    IPAddress       ip;
+    unsigned long   start;
+    int             len;
+
+    if (WiFi.status() != WL_CONNECTED){
+        mdnsIp = 0;
+        return;
+    }
+    ip = WiFi.localIP();
+    if ((uint32_t)ip != mdnsIp){                                                // joined or got a new lease
+        mdnsIp = ip;
+        mdnsUdp.stop();
+        mdnsUdp.beginMulticast(ip, IPAddress(224, 0, 0, 251), MDNS_PORT);
+        mdns_answer(ip);
+        mdnsAnnounce = MDNS_ANNOUNCE_COUNT;
+        mdnsStamp = millis() - MDNS_ANNOUNCE_INTERVAL;
+        LOG_INFO("mDNS: %s.local, %u byte answer", mdnsHost, mdnsPacketLen);
+    }
+    if ((mdnsAnnounce > 0) && ((millis() - mdnsStamp) >= MDNS_ANNOUNCE_INTERVAL)){
+        mdnsAnnounce -= 1;
+        mdns_multicast();
+    }
+
+    for (uint8_t n = 0; n < UDP_BURST; n++){
+        len = mdnsUdp.parsePacket();
+        if (len <= 0){
+            return;
+        }
+        start = micros();
+        len = mdnsUdp.read(buf, sizeof(buf));                                   // known-answer lists past this are ignored
+        mdnsQueries += 1;
+        if (!mdns_matches(buf, len, mdnsHost, &question)){
+            continue;
+        }
+        if (MDNS_PORT != mdnsUdp.remotePort()){                                 // legacy resolver: unicast reply
+            mdns_legacy(buf, &question);
+        }
+        else if ((millis() - mdnsStamp) >= MDNS_MIN_INTERVAL){                 // otherwise the last multicast answers it
+            mdns_multicast();
+        }
+        else {
+            continue;
+        }
+        mdnsReplies += 1;
+        mdnsReplyTime = micros() - start;
+        mdnsReplyMax = max(mdnsReplyMax, mdnsReplyTime);
+    }
+}
+
+
+void mdns_multicast(void){
+    mdnsUdp.beginPacketMulticast(IPAddress(224, 0, 0, 251), MDNS_PORT, WiFi.localIP(), 255);
+    mdnsUdp.write(mdnsPacket, mdnsPacketLen);
+    mdnsUdp.endPacket();
+    mdnsStamp = millis();
+}
+
+
+void mdns_legacy(const uint8_t *query, const MdnsQuestion *question){
+    uint16_t    len     = mdns_legacyReply(mdnsLegacy, sizeof(mdnsLegacy), query, question, mdnsPacket, mdnsPacketLen);
+
+    if (0 == len){
+        return;
+    }
+    mdnsUdp.beginPacket(mdnsUdp.remoteIP(), mdnsUdp.remotePort());
+    mdnsUdp.write(mdnsLegacy, len);
+    mdnsUdp.endPacket();
+}
+
+
+void mdns_answer(IPAddress ip){
+    char            text[5][MDNS_TEXT_LEN];                                     // TXT strings, copied into the answer
+    const char      *strings[5]     = {text[0], text[1], text[2], text[3], text[4]};
+    MdnsService     service;
+
+    snprintf(text[0], MDNS_TEXT_LEN, "ver=%d.%d", (int)infoVersion, (int)(infoVersion * 10 + 0.5f) % 10);
+    snprintf(text[1], MDNS_TEXT_LEN, "variant=%s", LAMP_VARIANT);
+    snprintf(text[2], MDNS_TEXT_LEN, "leds=%u", LED_NUM);
+    snprintf(text[3], MDNS_TEXT_LEN, "proto=%u", UDP_CTRL_VERSION);
+    snprintf(text[4], MDNS_TEXT_LEN, "features=frame,effect,rotate,audio,schedule,mqtt,trace%s%s%s",
+#ifdef OTA_PUBLIC_KEY
+        ",ota",
+#else
+        "",
+#endif
+        LCD_ENABLED ? ",lcd" : "", INPUT_ENABLED ? ",input" : "");
+    service.host = mdnsHost;
+    service.ip[0] = ip[0];
+    service.ip[1] = ip[1];
+    service.ip[2] = ip[2];
+    service.ip[3] = ip[3];
+    service.httpPort = WIFI_PORT;
+    service.udpPort = UDP_CTRL_PORT;
+    service.text = strings;
+    service.textCount = 5;
+    mdnsPacketLen = mdns_build(mdnsPacket, &service);
+}
+
+
+void effect_render(void){
+    uint32_t        cycles  = ESP.getCycleCount();
+
+    effect_run(effect.code, effect.len, millis() >> EFFECT_TIME_SHIFT, (uint8_t *)leds, LED_NUM);
+
+    cycles = ESP.getCycleCount() - cycles;
+    if (cycles > effectCyclesMax){
+        effectCyclesMax = cycles;
+    }
+    if (effectOps > 0){
+        effectNsPerOp = (cycles * 1000UL) / (ESP.getCpuFreqMHz() * effectOps * LED_NUM);
+    }
+}
+
+
+bool effect_read(uint8_t id, Effect *dst){
+    File    file;
+    bool    ok;
+
+    if (id >= EFFECT_MAX){
+        return false;
+    }
+    file = LittleFS.open(EFFECT_FILE, "r");
+    if (!file){
+        return false;
+    }
+    ok = file.seek(sizeof(StoreHeader) + (id * sizeof(Effect)), SeekSet) &&
+         (file.read((uint8_t *)dst, sizeof(Effect)) == sizeof(Effect));
+    file.close();
+    return ok;
+}
+
+
+bool effect_write(uint8_t id, const Effect *src){
+    File    file;
+    bool    ok;
+
+    if (id >= EFFECT_MAX){
+        return false;
+    }
+    file = LittleFS.open(EFFECT_FILE, "r+");
+    if (!file){
+        return false;
+    }
+    ok = file.seek(sizeof(StoreHeader) + (id * sizeof(Effect)), SeekSet) &&
+         (file.write((const uint8_t *)src, sizeof(Effect)) == sizeof(Effect));
+    file.close();
+    return ok;
+}
+
+
+void effect_select(void){
+    Effect      selected;
+    long        id          = webServer.arg("id").toInt();
+    int         ops;
+
+    if (!webServer.hasArg("id") || (id < 0) || (id >= EFFECT_MAX) ||
+        !effect_read(id, &selected) || ('\0' == selected.name[0]) || (selected.len > EFFECT_CODE_SIZE)){
+        server_send(404, "text/plain", "Effect not found");
+        return;
+    }
+    ops = effect_verify(selected.code, selected.len, LED_NUM, EFFECT_FRAME_BUDGET);   // flash contents are not trusted
+    if (ops <= 0){
+        server_send(422, "text/plain", "Stored effect is invalid");
+        return;
+    }
+    effect = selected;
+    effectOps = ops;
+    ledState = true;
+    ledPattern = EFFECT;
+    led_command(LED_CMD_PATTERN);
+}
+
+
+void effect_save(void){
+    Effect      compiled;
+    long        id      = webServer.arg("id").toInt();
+    const String &name  = webServer.arg("name");
+    const String &src   = webServer.arg("src");
+
+    if (!webServer.hasArg("id") || (id < 0) || (id >= EFFECT_MAX) ||
+        (0 == src.length()) || (src.length() > EFFECT_SRC_LEN)){
+        server_send(400, "text/plain", "Expected id=<0..3> and src=<r>;<g>;<b>");
+        return;
+    }
+    memset(&compiled, 0, sizeof(compiled));
+    if (!effect_compile(src.c_str(), compiled.code, EFFECT_CODE_SIZE, &compiled.len, LED_NUM, EFFECT_FRAME_BUDGET)){
+        server_send(422, "text/plain", "Effect does not compile or exceeds the frame budget");
+        return;
+    }
+    if (name.length() > 0){
+        strncpy(compiled.name, name.c_str(), STORE_NAME_LEN - 1);
+    }
+    else {
+        snprintf(compiled.name, STORE_NAME_LEN, "Effect %ld", id);
+    }
+    if (!effect_write(id, &compiled)){
+        server_send(500, "text/plain", "Effect write failed");
+        return;
+    }
+    LOG_INFO("Saved effect %ld: %s (%u bytes)", id, compiled.name, compiled.len);
+    server_send(200, "text/plain", "OK");
+}
+
+
+void frame_receive(void){
+    HTTPRaw     &raw    = webServer.raw();
+
+    if (RAW_START == raw.status){
+        frameOffset = 0;
+    }
+    else if (RAW_WRITE == raw.status){
+        frame_write(raw.buf, raw.currentSize);
+    }
+    else if (RAW_END == raw.status){
+        frameLastOk = frame_commit();
+    }
+    else {
+        frameOffset = 0;
+        frameLastOk = false;
+        frameErrors += 1;
+    }
+}
+
+
+void frame_done(void){
+    if (frameLastOk){
+        server_send(204, NULL, "");
+    }
+    else {
+        snprintf(serverMsg, sizeof(serverMsg), "Expected %u bytes of packed RGB (application/octet-stream)", FRAME_SIZE);
+        server_send(400, "text/plain", serverMsg);
+    }
+    frameLastOk = false;
+}
+
+
+void frame_write(const uint8_t *data, size_t len){
+    size_t  count   = min(len, (size_t)(FRAME_SIZE - frameOffset));             // extra bytes are ignored
+
+    memcpy((uint8_t *)frameBuf[frameWrite] + frameOffset, data, count);
+    frameOffset += count;
+}
+
+
+bool frame_commit(void){
+    if (frameOffset != FRAME_SIZE){
+        frameOffset = 0;
+        frameErrors += 1;
+        return false;
+    }
+    frameOffset = 0;
+    frameRead = frameWrite;                                                     // swap, next upload fills the other buffer
+    frameWrite ^= 1;
+    if (ledPending){                                                            // same accounting as led_queue()
+        cmdMerged += 1;
+    }
+    else {
+        ledCmdStamp = micros();
+    }
+    ledPattern = FRAME;
+    ledState = true;
+    ledPending |= LED_CMD_FRAME;
+    frameCount += 1;
+    frameWindowCount += 1;
+    return true;
+}
+
+
+void frame_pollTcp(void){
+    uint8_t     buf[FRAME_SIZE];
+
+    if (!frameClient || !frameClient.connected()){
+        frameClient = frameServer.accept();
+        if (!frameClient){
+            return;
+        }
+        frameClient.setNoDelay(true);
+    }
+    for (uint8_t n = 0; n < FRAME_TCP_BURST; n++){                              // only whole frames, never blocks
+        if (frameClient.available() < FRAME_SIZE){
+            break;
+        }
+        frameClient.read(buf, FRAME_SIZE);
+        frameOffset = 0;
+        frame_write(buf, FRAME_SIZE);
+        frame_commit();
+    }
+}
+
+
+void storage_init(void){
+    File            file;
+    StoreHeader     header;
+    Palette         empty;
+    Scene           unused;
+
+    if (!LittleFS.begin()){
+        LOG_WARN("Formatting flash filesystem...");
+        LittleFS.format();
+        LittleFS.begin();
+    }
+
+    // factory default palette, used whenever the palette file is missing or invalid
+    memset(&palette, 0, sizeof(palette));
+    strncpy(palette.name, "Default", STORE_NAME_LEN - 1);
+    palette.size = PALETTE_SIZE;
+    for (uint8_t i = 0; i < PALETTE_SIZE; i++){
+        palette.rgb[i][0] = (colorTable[i] & 0xFF0000) >> 16;
+        palette.rgb[i][1] = (colorTable[i] & 0x00FF00) >> 8;
+        palette.rgb[i][2] = colorTable[i] & 0x0000FF;
+    }
+
+    file = LittleFS.open(PALETTE_FILE, "r");
+    if (!file || (file.read((uint8_t *)&header, sizeof(header)) != sizeof(header)) ||
+        (header.magic != PALETTE_MAGIC) || (header.count != PALETTE_MAX)){
+        if (file){
+            file.close();
+        }
+        LOG_INFO("Creating palette storage...");
+        memset(&empty, 0, sizeof(empty));
+        header.magic = PALETTE_MAGIC;
+        header.count = PALETTE_MAX;
+        header.active = 0;
+        header.reserved = 0;
+        file = LittleFS.open(PALETTE_FILE, "w");
+        file.write((const uint8_t *)&header, sizeof(header));
+        file.write((const uint8_t *)&palette, sizeof(palette));
+        for (uint8_t i = 1; i < PALETTE_MAX; i++){
+            file.write((const uint8_t *)&empty, sizeof(empty));
+        }
+    }
+    file.close();
+    paletteActive = (header.active < PALETTE_MAX) ? header.active : 0;
+    if (!palette_read(paletteActive, &palette) || (palette.size > PALETTE_SIZE)){
+        paletteActive = 0;
+        palette_read(paletteActive, &palette);
+    }
+
+    file = LittleFS.open(SCENE_FILE, "r");
+    if (!file || (file.read((uint8_t *)&header, sizeof(header)) != sizeof(header)) ||
+        (header.magic != SCENE_MAGIC) || (header.count != SCENE_MAX)){
+        if (file){
+            file.close();
+        }
+        LOG_INFO("Creating scene storage...");
+        memset(&unused, 0, sizeof(unused));
+        header.magic = SCENE_MAGIC;
+        header.count = SCENE_MAX;
+        header.active = 0;
+        header.reserved = 0;
+        file = LittleFS.open(SCENE_FILE, "w");
+        file.write((const uint8_t *)&header, sizeof(header));
+        for (uint8_t i = 0; i < SCENE_MAX; i++){
+            file.write((const uint8_t *)&unused, sizeof(unused));
+        }
+    }
+    file.close();
+
+    file = LittleFS.open(EFFECT_FILE, "r");
+    if (!file || (file.read((uint8_t *)&header, sizeof(header)) != sizeof(header)) ||
+        (header.magic != EFFECT_MAGIC) || (header.count != EFFECT_MAX)){
+        if (file){
+            file.close();
+        }
+        LOG_INFO("Creating effect storage...");
+        memset(&effect, 0, sizeof(effect));
+        header.magic = EFFECT_MAGIC;
+        header.count = EFFECT_MAX;
+        header.active = 0;
+        header.reserved = 0;
+        file = LittleFS.open(EFFECT_FILE, "w");
+        file.write((const uint8_t *)&header, sizeof(header));
+        for (uint8_t i = 0; i < EFFECT_MAX; i++){
+            file.write((const uint8_t *)&effect, sizeof(effect));
+        }
+    }
+    file.close();
+    LOG_INFO("Loaded palette %u: %s (%u colors)", paletteActive, palette.name, palette.size);
+}
+
+
+bool palette_read(uint8_t id, Palette *dst){
+    File    file;
+    bool    ok;
+
+    if (id >= PALETTE_MAX){
+        return false;
+    }
+    file = LittleFS.open(PALETTE_FILE, "r");
+    if (!file){
+        return false;
+    }
+    ok = file.seek(sizeof(StoreHeader) + (id * sizeof(Palette)), SeekSet) &&
+         (file.read((uint8_t *)dst, sizeof(Palette)) == sizeof(Palette));
+    file.close();
+    return ok;
+}
+
+
+bool palette_write(uint8_t id, const Palette *src){
+    File    file;
+    bool    ok;
+
+    if (id >= PALETTE_MAX){
+        return false;
+    }
+    file = LittleFS.open(PALETTE_FILE, "r+");
+    if (!file){
+        return false;
+    }
+    ok = file.seek(sizeof(StoreHeader) + (id * sizeof(Palette)), SeekSet) &&
+         (file.write((const uint8_t *)src, sizeof(Palette)) == sizeof(Palette));
+    file.close();
+    return ok;
+}
+
+
+bool palette_writeActive(uint8_t id){
+    File    file;
+    bool    ok;
+
+    file = LittleFS.open(PALETTE_FILE, "r+");
+    if (!file){
+        return false;
+    }
+    ok = file.seek(offsetof(StoreHeader, active), SeekSet) && (file.write(&id, 1) == 1);
+    file.close();
+    return ok;
+}
+
+
+bool scene_read(uint8_t id, Scene *dst){
+    File    file;
+    bool    ok;
+
+    if (id >= SCENE_MAX){
+        return false;
+    }
+    file = LittleFS.open(SCENE_FILE, "r");
+    if (!file){
+        return false;
+    }
+    ok = file.seek(sizeof(StoreHeader) + (id * sizeof(Scene)), SeekSet) &&
+         (file.read((uint8_t *)dst, sizeof(Scene)) == sizeof(Scene));
+    file.close();
+    return ok;
+}
+
+
+bool scene_write(uint8_t id, const Scene *src){
+    File    file;
+    bool    ok;
+
+    if (id >= SCENE_MAX){
+        return false;
+    }
+    file = LittleFS.open(SCENE_FILE, "r+");
+    if (!file){
+        return false;
+    }
+    ok = file.seek(sizeof(StoreHeader) + (id * sizeof(Scene)), SeekSet) &&
+         (file.write((const uint8_t *)src, sizeof(Scene)) == sizeof(Scene));
+    file.close();
+    return ok;
+}
+
+
+void palette_select(void){
+    Palette     selected;
+    long        id          = webServer.arg("id").toInt();
+
+    if (!webServer.hasArg("id") || (id < 0) || (id >= PALETTE_MAX) ||
+        !palette_read(id, &selected) || ('\0' == selected.name[0]) || (selected.size > PALETTE_SIZE)){
+        server_send(404, "text/plain", "Palette not found");
+        return;
+    }
+    palette = selected;
+    paletteActive = id;
+    paletteDirty = true;                                                        // written later by task_persist()
+    server_commandDone();
+}
+
+
+void palette_colorSet(void){
+    Palette         edited  = palette;
+    long            index   = webServer.arg("index").toInt();
+    unsigned long   rgb     = strtoul(webServer.arg("rgb").c_str(), NULL, 16);
+
+    if (!webServer.hasArg("index") || !webServer.hasArg("rgb") ||
+        (index < 0) || (index > palette.size) || (index >= PALETTE_SIZE) || (rgb > 0xFFFFFF)){
+        server_send(400, "text/plain", "Expected index=<0..size> and rgb=RRGGBB");
+        return;
+    }
+    edited.rgb[index][0] = (rgb & 0xFF0000) >> 16;
+    edited.rgb[index][1] = (rgb & 0x00FF00) >> 8;
+    edited.rgb[index][2] = rgb & 0x0000FF;
+    if (index == edited.size){                                                  // index == size appends a color
+        edited.size += 1;
+    }
+    if (!palette_write(paletteActive, &edited)){                               // RAM keeps what flash has
+        server_send(500, "text/plain", "Palette write failed");
+        return;
+    }
+    palette = edited;
+    server_commandDone();
+}
+
+
+void palette_saveAs(void){
+    Palette saved   = palette;
+    long    id      = webServer.arg("id").toInt();
+    const String &name  = webServer.arg("name");
+
+    if (!webServer.hasArg("id") || (id < 0) || (id >= PALETTE_MAX)){
+        server_send(400, "text/plain", "Expected id=<0..3>");
+        return;
+    }
+    memset(saved.name, 0, STORE_NAME_LEN);
+    if (name.length() > 0){
+        strncpy(saved.name, name.c_str(), STORE_NAME_LEN - 1);
+    }
+    else {
+        snprintf(saved.name, STORE_NAME_LEN, "Palette %ld", id);
+    }
+    if (!palette_write(id, &saved)){                                            // renamed only once it is in flash
+        server_send(500, "text/plain", "Palette write failed");
+        return;
+    }
+    palette = saved;
+    paletteActive = id;
+    paletteDirty = true;
+    server_commandDone();
+}
+
+
+void scene_recall(void){
+    Scene   scene;
+    long    id      = webServer.arg("id").toInt();
+
+    if (!webServer.hasArg("id") || (id < 0) || (id >= SCENE_MAX) ||
+        !scene_read(id, &scene) || ('\0' == scene.name[0]) || (scene.pattern > ROTATE)){
+        server_send(404, "text/plain", "Scene not found");
+        return;
+    }
+    led_storeColor((scene.rgb[0] << 16) | (scene.rgb[1] << 8) | scene.rgb[2]);
+    ledBrightness = constrain(scene.brightness, LED_MIN_BRIGHTNESS, LED_MAX_BRIGHTNESS);
+    ledRotateDelay = scene.rotateDelay;
+    ledHeartbeatDelay = scene.heartbeatDelay;
+    ledPattern = (LEDPattern)scene.pattern;
+    lamp_on();
+}
+
+
+void scene_save(void){
+    Scene   scene;
+    long    id      = webServer.arg("id").toInt();
+    const String &name  = webServer.arg("name");
+
+    if (!webServer.hasArg("id") || (id < 0) || (id >= SCENE_MAX)){
+        server_send(400, "text/plain", "Expected id=<0..15>");
+        return;
+    }
+    memset(&scene, 0, sizeof(scene));
+    if (name.length() > 0){
+        strncpy(scene.name, name.c_str(), STORE_NAME_LEN - 1);
+    }
+    else {
+        snprintf(scene.name, STORE_NAME_LEN, "Scene %ld", id);
+    }
+    scene.rgb[0] = (ledColor & 0xFF0000) >> 16;
+    scene.rgb[1] = (ledColor & 0x00FF00) >> 8;
+    scene.rgb[2] = ledColor & 0x0000FF;
+    scene.brightness = ledBrightness;
+    scene.pattern = (ledPattern > ROTATE) ? STATIC : ledPattern;               // frames and effects are not stored
+    scene.rotateDelay = ledRotateDelay;
+    scene.heartbeatDelay = ledHeartbeatDelay;
+    if (!scene_write(id, &scene)){
+        server_send(500, "text/plain", "Scene write failed");
+        return;
+    }
+    server_commandDone();
+}
+
+
+void cal_init(void){
+    File        file;
+    const CRGB  correction  = LED_COLOR_CORRECTION;
+
+    file = LittleFS.open(CAL_FILE, "r");
+    if (file && (file.read((uint8_t *)&calTable, sizeof(calTable)) == sizeof(calTable)) &&
+        (CAL_MAGIC == calTable.magic) && (LED_NUM == calTable.leds) && cal_valid()){
+        file.close();
+        return;
+    }
+    if (file){
+        file.close();
+    }
+    // factory default: every profile is the global color correction, linear, so output matches an uncalibrated ring
+    memset(&calTable, 0, sizeof(calTable));
+    calTable.magic = CAL_MAGIC;
+    calTable.leds = LED_NUM;
+    for (uint8_t p = 0; p < CAL_PROFILES; p++){
+        for (uint8_t c = 0; c < 3; c++){
+            cal_generate(p, c, correction.raw[c], 1.0f);
+        }
+    }
+}
+
+
+void cal_generate(uint8_t profile, uint8_t channel, uint8_t gain, float gamma){
+    float       level;
+
+    for (uint8_t k = 0; k < CAL_POINTS; k++){
+        level = 65535.0f * ((gain + 1) / 256.0f) * powf(k / (float)(CAL_POINTS - 1), gamma);
+        calTable.curve[profile][channel][k] = min(lroundf(level), 65535L);
+    }
+}
+
+
+bool cal_valid(void){
+    for (uint8_t i = 0; i < LED_NUM; i++){                                      // the refresh pass indexes curves with these
+        if (calTable.pixel[i] >= CAL_PROFILES){
+            return false;
+        }
+    }
+    for (uint8_t p = 0; p < CAL_PROFILES; p++){
+        for (uint8_t c = 0; c < 3; c++){
+            if (!cal_monotonic(calTable.curve[p][c])){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+bool cal_monotonic(const uint16_t *points){
+    for (uint8_t k = 1; k < CAL_POINTS; k++){                                   // the power limiter takes the last point as the peak
+        if (points[k] < points[k - 1]){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool cal_write(void){
+    File    file    = LittleFS.open(CAL_FILE, "w");
+    size_t  written;
+
+    if (!file){
+        return false;
+    }
+    written = file.write((const uint8_t *)&calTable, sizeof(calTable));
+    file.close();
+    return (sizeof(calTable) == written);                                       // short write: stays dirty, retried
+}
+
+
+void cal_render(void){
+    HtmlStream  out;
+
+    render_begin(&out, "application/json");
+    render_printf(&out, "{\"profiles\":[");
+    for (uint8_t p = 0; p < CAL_PROFILES; p++){
+        render_printf(&out, "%s[", (p > 0) ? "," : "");
+        for (uint8_t c = 0; c < 3; c++){
+            render_printf(&out, "%s[", (c > 0) ? "," : "");
+            for (uint8_t k = 0; k < CAL_POINTS; k++){
+                render_printf(&out, "%s%u", (k > 0) ? "," : "", calTable.curve[p][c][k]);
+            }
+            render_printf(&out, "]");
+        }
+        render_printf(&out, "]");
+    }
+    render_printf(&out, "],\"pixels\":[");
+    for (uint8_t i = 0; i < LED_NUM; i++){
+        render_printf(&out, "%s%u", (i > 0) ? "," : "", calTable.pixel[i]);
+    }
+    render_printf(&out, "],\"mixCycles\":%lu,\"mixCyclesMax\":%lu}", ledMixCycles, ledMixCyclesMax);
+    render_flush(&out);
+}
+
+
+void cal_curve(void){
+    static const char   channels[]  = "rgb";
+    static const char   *gains[]    = {"r", "g", "b"};
+    uint16_t            points[CAL_POINTS];
+    long                profile     = webServer.arg("profile").toInt();
+    const char          *text;
+    const char          *channel;
+    char                *end;
+    long                value;
+    float               gamma;
+    long                gain;
+
+    if (!webServer.hasArg("profile") || (profile < 0) || (profile >= CAL_PROFILES)){
+        server_send(400, "text/plain", "Expected profile=<0..3> and channel=<r|g|b>&points=<17 values 0..65535> "
+                                          "or r=&g=&b=<gain 0..255>&gamma=<0.3..4>");
+        return;
+    }
+    if (webServer.hasArg("points")){                                            // measured curve, taken as is
+        channel = strchr(channels, webServer.arg("channel").c_str()[0]);
+        text = webServer.arg("points").c_str();
+        for (uint8_t k = 0; k < CAL_POINTS; k++){
+            value = strtol(text, &end, 10);
+            if ((end == text) || (value < 0) || (value > 65535) || ((k < (CAL_POINTS - 1)) && (',' != *end))){
+                channel = NULL;
+                break;
+            }
+            points[k] = value;
+            text = end + 1;
+        }
+        if ((NULL == channel) || ('\0' == *channel) || ('\0' != *end)){
+            server_send(400, "text/plain", "Expected channel=<r|g|b>&points=<17 comma separated values 0..65535>");
+            return;
+        }
+        if (!cal_monotonic(points)){
+            server_send(400, "text/plain", "Expected points=<17 non-decreasing values>");
+            return;
+        }
+        memcpy(calTable.curve[profile][channel - channels], points, sizeof(points));
+    }
+    else {                                                                      // white balance gains and a gamma
+        gamma = webServer.hasArg("gamma") ? webServer.arg("gamma").toFloat() : 1.0f;
+        if ((gamma < 0.3f) || (gamma > 4.0f)){
+            server_send(400, "text/plain", "Expected gamma=<0.3..4>");
+            return;
+        }
+        for (uint8_t c = 0; c < 3; c++){
+            gain = webServer.hasArg(gains[c]) ? webServer.arg(gains[c]).toInt() : 255;
+            if ((gain < 0) || (gain > 255)){
+                server_send(400, "text/plain", "Expected r=&g=&b=<gain 0..255>");
+                return;
+            }
+            cal_generate(profile, c, gain, gamma);
+        }
+    }
+    calDirty = true;                                                            // written later by task_persist()
+    server_send(200, "text/plain", "OK");
+}
+
+
+void cal_pixels(void){
+    const char  *map    = webServer.arg("map").c_str();
+    long        pixel   = webServer.arg("pixel").toInt();
+    long        profile = webServer.arg("profile").toInt();
+
+    if (webServer.hasArg("map")){                                               // one digit per pixel, pixel 0 first
+        if (strlen(map) != LED_NUM){
+            server_send(400, "text/plain", "Expected map=<one profile digit 0..3 per pixel>");
+            return;
+        }
+        for (uint8_t i = 0; i < LED_NUM; i++){
+            if ((map[i] < '0') || (map[i] >= ('0' + CAL_PROFILES))){
+                server_send(400, "text/plain", "Expected map=<one profile digit 0..3 per pixel>");
+                return;
+            }
+        }
+        for (uint8_t i = 0; i < LED_NUM; i++){
+            calTable.pixel[i] = map[i] - '0';
+        }
+    }
+    else if (webServer.hasArg("pixel") && (pixel >= 0) && (pixel < LED_NUM) && (profile >= 0) && (profile < CAL_PROFILES)){
+        calTable.pixel[pixel] = profile;
+    }
+    else {
+        server_send(400, "text/plain", "Expected map=<digits> or pixel=<index>&profile=<0..3>");
+        return;
+    }
+    calDirty = true;
+    server_send(200, "text/plain", "OK");
+}
+
+
+void wifi_showConnected(void){
+    IPAddress   ip  = WiFi.localIP();
+
+    LOG_INFO("WiFi connected, IP address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+
+#if LCD_ENABLED
+    lcd.clear();
+    lcd.drawString(0, 0, "> Wifi Connected");
+    lcd_printf(15, "> %s", wifiSSID);
+    lcd_printf(35, "> %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    lcdDirty = true;                                                            // sent by task_display()
+#endif
+}
+
+
+void wifi_startProvisioning(void){
+    char    apName[32];
+
+    snprintf(apName, sizeof(apName), PROV_AP_PREFIX "%06X", (unsigned int)ESP.getChipId());
+    WiFi.mode(WIFI_AP_STA);                                                     // STA side is used for scan and join
+    WiFi.softAP(apName);
+    dnsServer.start(DNS_PORT, "*", WiFi.softAPIP());                            // resolve every name to the portal
+
+    LOG_INFO("Started setup access point %s at %u.%u.%u.%u", apName,
+        WiFi.softAPIP()[0], WiFi.softAPIP()[1], WiFi.softAPIP()[2], WiFi.softAPIP()[3]);
+#if LCD_ENABLED
+    lcd.clear();
+    lcd.drawString(0, 0, "> No WiFi info saved.");
+    lcd.drawString(0, 15, "> Join WiFi network:");
+    lcd_printf(25, "> %s", apName);
+    lcd_printf(35, "> %u.%u.%u.%u", WiFi.softAPIP()[0], WiFi.softAPIP()[1], WiFi.softAPIP()[2], WiFi.softAPIP()[3]);
+    lcdDirty = true;
+#endif
+
+    provFailed = false;
+    WiFi.scanNetworks(true);                                                    // async, polled by wifi_provision()
+    provState = PROV_SCANNING;
+}
+
+
+void wifi_provision(void){
+    int     result;
+
+    dnsServer.processNextRequest();
+
+    if (PROV_SCANNING == provState){
+        result = WiFi.scanComplete();
+        if (result >= 0){
+            provNetworks = result;
+            provState = PROV_WAITING;
+        }
+        else if (WIFI_SCAN_FAILED == result){
+            provNetworks = 0;
+            provState = PROV_WAITING;
+        }
+    }
+    else if (PROV_CONNECTING == provState){
+        if (WiFi.status() == WL_CONNECTED){
+            eeprom_write();                                                     // only working credentials are saved
+            wifiInfoPresent = true;
+            dnsServer.stop();
+            WiFi.softAPdisconnect(true);
+            WiFi.mode(WIFI_STA);
+            WiFi.scanDelete();
+            provNetworks = 0;
+            provState = PROV_OFF;
+            provTime = millis();
+            LOG_INFO("Provisioned %lu ms after power-on.", provTime);
+            wifi_showConnected();
+        }
+        else if ((millis() - provStamp) > PROV_CONNECT_TIMEOUT){
+            LOG_WARN("Could not connect to %s", wifiSSID);
+            WiFi.disconnect();
+            provFailed = true;
+            provState = PROV_WAITING;
+        }
+    }
+}
+
+
+void wifi_scan(void){
+    if (PROV_OFF == provState){                                                 // scanning is only offered by the portal
+        server_notFound();
+        return;
+    }
+    if (PROV_WAITING == provState){
+        WiFi.scanDelete();
+        provNetworks = 0;
+        WiFi.scanNetworks(true);
+        provState = PROV_SCANNING;
+    }
+    server_htmlRender();
+}
+
+
+void wifi_submit(void){
+    const String    *ssid       = &webServer.arg("other");                      // typed SSID wins over the list
+    const String    &password   = webServer.arg("password");
+
+    if ((PROV_WAITING != provState) && (PROV_SCANNING != provState)){
+        server_notFound();
+        return;
+    }
+    if (0 == ssid->length()){
+        ssid = &webServer.arg("ssid");
+    }
+    if ((0 == ssid->length()) || (ssid->length() >= sizeof(wifiSSID)) || (password.length() >= sizeof(wifiPassword))){
+        server_send(400, "text/plain", "Invalid SSID or password");
+        return;
+    }
+    memset(wifiSSID, 0, sizeof(wifiSSID));
+    memset(wifiPassword, 0, sizeof(wifiPassword));
+    strncpy(wifiSSID, ssid->c_str(), sizeof(wifiSSID) - 1);
+    strncpy(wifiPassword, password.c_str(), sizeof(wifiPassword) - 1);
+
+    LOG_INFO("Connecting to %s", wifiSSID);
+#if LCD_ENABLED
+    lcd.clear();
+    lcd.drawString(0, 0, "> Connecting to WiFi");
+    lcd_printf(15, "> %s", wifiSSID);
+    lcdDirty = true;
+#endif
+
+    WiFi.begin(wifiSSID, wifiPassword);
+    provFailed = false;
+    provStamp = millis();
+    provState = PROV_CONNECTING;
+    server_htmlRender();
+}
+
+
+#if LCD_ENABLED
+void lcd_printf(int16_t y, const char *format, ...){
+    va_list     args;
+
+    va_start(args, format);
+    vsnprintf(lcdLine, sizeof(lcdLine), format, args);
+    va_end(args);
+    lcd.drawString(0, y, lcdLine);                                              // the driver still wraps it in one String
+}
+#endif
+
+
+void diag_init(void){
+    struct rst_info *info   = ESP.getResetInfoPtr();
+
+    if (!ESP.rtcUserMemoryRead(DIAG_RTC_OFFSET, (uint32_t *)&diagRtc, sizeof(diagRtc)) ||
+        (diagRtc.magic != DIAG_MAGIC)){                                         // power-on: RTC memory is random
+        memset(&diagRtc, 0, sizeof(diagRtc));
+        diagRtc.magic = DIAG_MAGIC;
+    }
+    diagRtc.boots += 1;
+
+    // a hardware WDT reset skips custom_crash_callback(), so the last snapshot stands in for it
+    if ((DIAG_EVENT_NONE == diagRtc.event) && (NULL != info) &&
+        ((REASON_WDT_RST == info->reason) || (REASON_EXCEPTION_RST == info->reason) || (REASON_SOFT_WDT_RST == info->reason))){
+        diagRtc.event = DIAG_EVENT_CRASH;
+        diagRtc.reason = info->reason;
+        diagRtc.exccause = info->exccause;
+        diagRtc.epc1 = info->epc1;
+        diagRtc.crashes += 1;
+    }
+    if (DIAG_EVENT_NONE != diagRtc.event){
+        diagLast = diagRtc;
+        diagLast.route[DIAG_ROUTE_LEN - 1] = '\0';
+        diagLast.task[DIAG_TASK_LEN - 1] = '\0';
+        diagLastValid = true;
+        diagRtc.event = DIAG_EVENT_NONE;
+        LOG_WARN("Previous boot ended in a %s (reason %u) at %s in task %s",
+            (DIAG_EVENT_STALL == diagLast.event) ? "stall" : "crash", diagLast.reason, diagLast.route, diagLast.task);
+    }
+    diagRtc.route[0] = '\0';
+    diagRtc.task[0] = '\0';
+    ESP.rtcUserMemoryWrite(DIAG_RTC_OFFSET, (uint32_t *)&diagRtc, sizeof(diagRtc));
+}
+
+
+void diag_arm(void){
+    diagFeed = millis();
+    diagLoopStamp = micros();
+    diagArmed = true;
+    diagTicker.attach_ms(DIAG_CHECK_PERIOD, diag_check);
+}
+
+
+void diag_feed(void){
+    unsigned long   now     = micros();
+    unsigned long   elapsed = now - diagLoopStamp;
+    unsigned long   heap    = ESP.getFreeHeap();
+
+    diagLoopStamp = now;
+    diagFeed = millis();
+    if (elapsed > diagLoopMax){
+        diagLoopMax = elapsed;
+    }
+    if (elapsed > DIAG_LOOP_SLOW){
+        diagSlowLoops += 1;
+    }
+    if (heap < diagHeapMin){
+        diagHeapMin = heap;
+    }
+}
+
+
+void diag_check(void){
+    uint32_t    marker;
+
+    // runs from the SDK timer, i.e. only while a stalled handler still yields (delay(), WiFi waits);
+    // a busy stall is caught by the software WDT and reported through custom_crash_callback().
+    // MQTT and OTA pull connect through NetConn, so no DNS or TCP connect waits in loop() any more.
+    if (!diagArmed || ((millis() - diagFeed) < DIAG_STALL_TIMEOUT)){
+        return;
+    }
+    diagArmed = false;
+    diagRtc.stalls += 1;
+    diagRtc.reason = REASON_SOFT_RESTART;
+    diagRtc.exccause = 0;
+    diagRtc.epc1 = 0;
+    diag_snapshot(DIAG_EVENT_STALL, (uint32_t)(uintptr_t)&marker);
+    system_restart();                                                           // ESP.restart() would yield from the SDK timer and panic
+}
+
+
+void diag_snapshot(uint32_t event, uint32_t sp){
+    diagRtc.event = event;
+    diagRtc.sp = sp;
+    diagRtc.uptime = millis();
+    diagRtc.loopMax = max(diagLoopMax, (micros() - diagLoopStamp));            // includes the iteration that stalled
+    diagRtc.handlerMax = diagHandlerMax;
+    diagRtc.heapMin = diagHeapMin;
+    strncpy(diagRtc.task, diagTask, DIAG_TASK_LEN - 1);
+    diagRtc.task[DIAG_TASK_LEN - 1] = '\0';
+    ESP.rtcUserMemoryWrite(DIAG_RTC_OFFSET, (uint32_t *)&diagRtc, sizeof(diagRtc));
+}
+
+
+ESP8266WebServer::ClientFuture diag_routeHook(const String &method, const String &url, WiFiClient *client,
+                                              ESP8266WebServer::ContentTypeFunction contentType){
+    (void)client;
+    (void)contentType;
+    snprintf(diagRtc.route, DIAG_ROUTE_LEN, "%s %s", method.c_str(), url.c_str());
+    for (char *c = diagRtc.route; '\0' != *c; c++){                            // kept JSON-safe for /diag
+        if ((*c < ' ') || ('"' == *c) || ('\\' == *c)){
+            *c = '_';
+        }
+    }
+    diag_snapshot(DIAG_EVENT_NONE, 0);                                          // survives a hardware WDT reset
+    return ESP8266WebServer::CLIENT_REQUEST_CAN_CONTINUE;
+}
+
+
+void custom_crash_callback(struct rst_info *info, uint32_t stack, uint32_t stackEnd){
+    (void)stackEnd;
+    if ((REASON_SOFT_WDT_RST == info->reason) || (REASON_WDT_RST == info->reason)){
+        diagRtc.stalls += 1;                                                    // loop() stopped yielding
+    }
+    else {
+        diagRtc.crashes += 1;
+    }
+    diagRtc.reason = info->reason;
+    diagRtc.exccause = info->exccause;
+    diagRtc.epc1 = info->epc1;
+    diag_snapshot(DIAG_EVENT_CRASH, stack);
+}
+
+
+void diag_render(void){
+    HtmlStream  out;
+
+    render_begin(&out, "application/json");
+    render_printf(&out,
+        "{\"resetReason\":\"%s\",\"boots\":%lu,\"stalls\":%lu,\"crashes\":%lu,\"slowLoops\":%lu,"
+        "\"loopMax\":%lu,\"handlerMax\":%lu,\"heapMin\":%lu,\"postmortem\":",
+        ESP.getResetReason().c_str(), (unsigned long)diagRtc.boots, (unsigned long)diagRtc.stalls,
+        (unsigned long)diagRtc.crashes, diagSlowLoops, diagLoopMax, diagHandlerMax, diagHeapMin);
+    if (!diagLastValid){
+        render_printf(&out, "null}");
+    }
+    else {
+        render_printf(&out,
+            "{\"event\":\"%s\",\"reason\":%lu,\"exccause\":%lu,\"epc1\":\"0x%08lx\",\"sp\":\"0x%08lx\","
+            "\"uptime\":%lu,\"loopMax\":%lu,\"handlerMax\":%lu,\"heapMin\":%lu,\"route\":\"%s\",\"task\":\"%s\"}}",
+            (DIAG_EVENT_STALL == diagLast.event) ? "stall" : "crash", (unsigned long)diagLast.reason,
+            (unsigned long)diagLast.exccause, (unsigned long)diagLast.epc1, (unsigned long)diagLast.sp,
+            (unsigned long)diagLast.uptime, (unsigned long)diagLast.loopMax, (unsigned long)diagLast.handlerMax,
+            (unsigned long)diagLast.heapMin, diagLast.route, diagLast.task);
+    }
+    render_flush(&out);
+}
+
+
+void heap_arm(void){
+    uint32_t    block;
+
+    ESP.getHeapStats(NULL, &block, NULL);
+    heapBoot = ESP.getFreeHeap();
+    heapBlockMin = block;
+    heapStamp = millis();
+    heapArmed = true;
+    LOG_INFO("Heap after boot: %lu bytes free, largest block %lu", heapBoot, (unsigned long)block);
+}
+
+
+void heap_sample(void){
+    uint32_t    block;
+    uint8_t     frag;
+
+    if ((millis() - heapStamp) < HEAP_SAMPLE_PERIOD){                           // a heap walk per sample, keep it rare
+        return;
+    }
+    heapStamp = millis();
+    ESP.getHeapStats(NULL, &block, &frag);
+    if (block < heapBlockMin){
+        heapBlockMin = block;
+    }
+    if (frag > heapFragMax){
+        heapFragMax = frag;
+    }
+}
+
+
+#if HEAP_TRAP
+void IRAM_ATTR heap_note(uint32_t caller){
+    if (!heapArmed){
+        return;
+    }
+    heapAllocs += 1;
+#if HEAP_TRAP >= 2
+    if ((NULL != schedCurrent) && (schedCurrent->priority <= SCHED_URGENT_PRIORITY)){
+        panic();                                                                // LED/audio must never allocate, post-mortem at /diag
+    }
+#endif
+    for (uint8_t i = 0; i < HEAP_SITES; i++){
+        if ((heapSites[i].caller == caller) || (0 == heapSites[i].caller)){
+            heapSites[i].caller = caller;
+            heapSites[i].count += 1;
+            return;
+        }
+    }
+    heapUntracked += 1;
+}
+#endif
+
+
+void heap_render(void){
+    HtmlStream      out;
+    uint32_t        block;
+    uint8_t         frag;
+
+    ESP.getHeapStats(NULL, &block, &frag);
+    render_begin(&out, "application/json");
+    render_printf(&out,
+        "{\"trap\":%u,\"boot\":%lu,\"free\":%lu,\"min\":%lu,\"maxBlock\":%lu,\"maxBlockMin\":%lu,"
+        "\"frag\":%u,\"fragMax\":%lu,\"allocs\":%lu,\"untracked\":%lu,\"sites\":[",
+        HEAP_TRAP, heapBoot, (unsigned long)ESP.getFreeHeap(), diagHeapMin, (unsigned long)block, heapBlockMin,
+        frag, heapFragMax, heapAllocs, heapUntracked);
+    for (uint8_t i = 0; (i < HEAP_SITES) && (0 != heapSites[i].caller); i++){
+        render_printf(&out, "%s{\"caller\":\"0x%08lx\",\"count\":%lu}",         // resolve with addr2line on firmware.elf
+            (i > 0) ? "," : "", (unsigned long)heapSites[i].caller, (unsigned long)heapSites[i].count);
+    }
+    render_printf(&out, "]}");
+    render_flush(&out);
+}
+
+
+#if HEAP_TRAP                                                                   // linked with -Wl,--wrap=malloc etc. (nodemcuv2-heaptrap)
+extern "C" void * IRAM_ATTR __wrap_malloc(size_t size){
+    heap_note((uint32_t)(uintptr_t)__builtin_return_address(0));
+    return __real_malloc(size);
+}
+
+
+extern "C" void * IRAM_ATTR __wrap_calloc(size_t count, size_t size){
+    heap_note((uint32_t)(uintptr_t)__builtin_return_address(0));
+    return __real_calloc(count, size);
+}
+
+
+extern "C" void * IRAM_ATTR __wrap_realloc(void *ptr, size_t size){
+    heap_note((uint32_t)(uintptr_t)__builtin_return_address(0));
+    return __real_realloc(ptr, size);
+}
+#endif
+
+
+ESP8266WebServer::ClientFuture trace_hook(const String &method, const String &url, WiFiClient *client,
+                                          ESP8266WebServer::ContentTypeFunction contentType){
+    (void)method;
+    (void)client;
+    (void)contentType;
+    traceOpen = true;
+    traceStart = micros();
+    traceStamp = millis();
+    traceHeap = ESP.getFreeHeap();
+    traceBytes = 0;
+    traceRouted = true;                                                         // until server_notFound() or a 429 says otherwise
+    strncpy(tracePath, url.c_str(), TRACE_ROUTE_LEN - 1);
+    tracePath[TRACE_ROUTE_LEN - 1] = '\0';
+    return ESP8266WebServer::CLIENT_REQUEST_CAN_CONTINUE;
+}
+
+
+void trace_finish(void){
+    TraceRecord *rec    = &traceRing[traceHead % TRACE_RECORDS];
+
+    if (!traceOpen){                                                            // handleClient() served nothing
+        return;
+    }
+    traceOpen = false;
+    rec->stamp = traceStamp;
+    rec->duration = micros() - traceStart;
+    rec->bytes = traceBytes;
+    rec->heapBefore = traceHeap;
+    rec->heapAfter = ESP.getFreeHeap();
+    rec->showTime = min(ledShowTimeLast, 0xFFFFUL);
+    rec->route = trace_route(tracePath, traceRouted);
+    rec->method = webServer.method();
+    traceHead += 1;
+}
+
+
+// Only paths a handler served are interned, probes and 404s share TRACE_ROUTE_OTHER
+uint8_t trace_route(const char *path, bool intern){
+    uint8_t     i;
+
+    for (i = 0; i < traceRouteCount; i++){
+        if (0 == strcmp(traceRoutes[i], path)){
+            return i;
+        }
+    }
+    if (!intern || (traceRouteCount >= TRACE_ROUTES)){
+        return TRACE_ROUTE_OTHER;
+    }
+    strcpy(traceRoutes[i], path);                                               // tracePath is already cut to fit
+    traceRouteCount += 1;
+    return i;
+}
+
+
+void trace_render(void){
+    TraceHeader header;
+    uint32_t    count   = min(traceHead, (uint32_t)TRACE_RECORDS);
+    uint32_t    first   = (traceHead - count) % TRACE_RECORDS;                  // oldest record kept
+    uint32_t    part    = min(count, (uint32_t)(TRACE_RECORDS - first));
+
+    if (webServer.hasArg("clear")){
+        traceHead = 0;
+        traceRouteCount = 0;
+        traceOpen = false;                                                      // this request is not recorded
+        server_send(200, "text/plain", "OK");
+        return;
+    }
+    memset(&header, 0, sizeof(header));
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    header.routeLen = TRACE_ROUTE_LEN;
+    header.routeCount = traceRouteCount;
+    header.count = count;
+    header.dropped = traceHead - count;
+    header.uptime = millis();
+
+    // header, route names (index = TraceRecord.route), then records oldest first
+    webServer.setContentLength(sizeof(header) + (traceRouteCount * TRACE_ROUTE_LEN) + (count * sizeof(TraceRecord)));
+    server_send(200, "application/octet-stream", "");
+    webServer.sendContent((const char *)&header, sizeof(header));
+    webServer.sendContent((const char *)traceRoutes, traceRouteCount * TRACE_ROUTE_LEN);
+    webServer.sendContent((const char *)&traceRing[first], part * sizeof(TraceRecord));
+    webServer.sendContent((const char *)&traceRing[0], (count - part) * sizeof(TraceRecord));
+}
+
+
+bool net_open(NetConn *conn, const char *host, uint16_t port, unsigned long timeout){
+    err_t       err;
+
+    net_close(conn);
+    if (strlen(host) >= NET_HOST_LEN){
+        net_fail(conn, "host name too long");
+        return false;
+    }
+    strcpy(conn->host, host);
+    conn->port = port;
+    conn->timeout = timeout;
+    conn->stamp = millis();
+    conn->error = NULL;
+    conn->state = NET_RESOLVING;
+    err = dns_gethostbyname(conn->host, &conn->ip, net_dnsFound, conn);         // IP literals and cached names answer at once
+    if (ERR_OK == err){
+        net_connect(conn);
+    }
+    else if (ERR_INPROGRESS != err){
+        net_fail(conn, "DNS query failed");
+    }
+    return (NET_FAILED != conn->state);
+}
+
+
+void net_connect(NetConn *conn){
+    conn->pcb = tcp_new();
+    if (NULL == conn->pcb){
+        net_fail(conn, "out of sockets");
+        return;
+    }
+    tcp_arg(conn->pcb, conn);
+    tcp_recv(conn->pcb, net_tcpRecv);
+    tcp_err(conn->pcb, net_tcpError);
+    tcp_nagle_disable(conn->pcb);                                               // small packets go out at once
+    conn->state = NET_CONNECTING;
+    if (ERR_OK != tcp_connect(conn->pcb, &conn->ip, conn->port, net_tcpConnected)){
+        net_fail(conn, "connect failed");
+    }
+}
+
+
+void net_dnsFound(const char *name, const ip_addr_t *ip, void *arg){
+    NetConn     *conn       = (NetConn *)arg;
+
+    if ((NET_RESOLVING != conn->state) || (0 != strcmp(name, conn->host))){
+        return;                                                                 // answer to a query its owner gave up on
+    }
+    if (NULL == ip){
+        net_fail(conn, "host not found");
+        return;
+    }
+    conn->ip = *ip;
+    net_connect(conn);
+}
+
+
+err_t net_tcpConnected(void *arg, struct tcp_pcb *pcb, err_t err){
+    ((NetConn *)arg)->state = NET_CONNECTED;
+    return ERR_OK;
+}
+
+
+err_t net_tcpRecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err){
+    NetConn     *conn       = (NetConn *)arg;
+
+    if (NULL == p){
+        conn->state = NET_CLOSED;                                               // FIN
+        return ERR_OK;
+    }
+    if (NULL == conn->rx){
+        conn->rx = p;
+    }
+    else {
+        pbuf_cat(conn->rx, p);
+    }
+    return ERR_OK;                                                              // window reopens as net_read() consumes it
+}
+
+
+void net_tcpError(void *arg, err_t err){
+    NetConn     *conn       = (NetConn *)arg;
+
+    conn->pcb = NULL;                                                           // already freed by lwIP
+    net_fail(conn, (NET_CONNECTING == conn->state) ? "connection refused" : "connection reset");
+}
+
+
+void net_fail(NetConn *conn, const char *error){
+    net_close(conn);
+    conn->state = NET_FAILED;
+    conn->error = error;
+}
+
+
+void net_poll(NetConn *conn){
+    if (((NET_RESOLVING == conn->state) || (NET_CONNECTING == conn->state)) && ((millis() - conn->stamp) > conn->timeout)){
+        net_fail(conn, (NET_RESOLVING == conn->state) ? "DNS timed out" : "connect timed out");
+    }
+}
+
+
+size_t net_available(NetConn *conn){
+    return (NULL != conn->rx) ? (conn->rx->tot_len - conn->rxOffset) : 0;
+}
+
+
+size_t net_read(NetConn *conn, uint8_t *buf, size_t len){
+    struct pbuf     *next;
+    size_t          count;
+    size_t          done        = 0;
+
+    while ((done < len) && (NULL != conn->rx)){
+        count = pbuf_copy_partial(conn->rx, buf + done, min(len - done, (size_t)(conn->rx->len - conn->rxOffset)), conn->rxOffset);
+        done += count;
+        conn->rxOffset += count;
+        if (conn->rxOffset < conn->rx->len){
+            break;
+        }
+        next = conn->rx->next;                                                  // first pbuf used up, unlink it
+        if (NULL != next){
+            pbuf_ref(next);
+        }
+        if (NULL != conn->pcb){
+            tcp_recved(conn->pcb, conn->rx->len);
+        }
+        pbuf_free(conn->rx);
+        conn->rx = next;
+        conn->rxOffset = 0;
+    }
+    return done;
+}
+
+
+bool net_write(NetConn *conn, const uint8_t *data, size_t len){
+    if ((NET_CONNECTED != conn->state) || (len > tcp_sndbuf(conn->pcb)) ||
+        (ERR_OK != tcp_write(conn->pcb, data, len, TCP_WRITE_FLAG_COPY))){
+        return false;
+    }
+    tcp_output(conn->pcb);
+    return true;
+}
+
+
+void net_close(NetConn *conn){
+    if (NULL != conn->pcb){
+        tcp_arg(conn->pcb, NULL);
+        tcp_recv(conn->pcb, NULL);
+        tcp_err(conn->pcb, NULL);
+        if (ERR_OK != tcp_close(conn->pcb)){
+            tcp_abort(conn->pcb);
+        }
+        conn->pcb = NULL;
+    }
+    if (NULL != conn->rx){
+        pbuf_free(conn->rx);
+        conn->rx = NULL;
+    }
+    conn->rxOffset = 0;
+    conn->state = NET_IDLE;
+}
+
+
+void ota_init(void){
+    File    file;
+
+    if (!ESP.rtcUserMemoryRead(OTA_RTC_OFFSET, (uint32_t *)&otaRtc, sizeof(otaRtc)) ||
+        (otaRtc.magic != OTA_MAGIC)){
+        memset(&otaRtc, 0, sizeof(otaRtc));
+        otaRtc.magic = OTA_MAGIC;
+    }
+    if (otaRtc.trial){
+        otaRtc.boots += 1;
+        LOG_WARN("Unconfirmed firmware, boot %u of %u", otaRtc.boots, OTA_TRIAL_BOOTS);
+        if (otaRtc.boots >= OTA_TRIAL_BOOTS){
+            otaRtc.trial = 0;                                                   // one rollback attempt, then run as is
+            otaRecovery = true;
+            LOG_ERROR("Firmware failed to confirm, rolling back");
+        }
+    }
+    ESP.rtcUserMemoryWrite(OTA_RTC_OFFSET, (uint32_t *)&otaRtc, sizeof(otaRtc));
+
+    memset(&otaConfig, 0, sizeof(otaConfig));
+    file = LittleFS.open(OTA_FILE, "r");
+    if (file){
+        file.read((uint8_t *)&otaConfig, sizeof(otaConfig));
+        file.close();
+        otaConfig.current[OTA_URL_LEN - 1] = '\0';
+        otaConfig.good[OTA_URL_LEN - 1] = '\0';
+    }
+}
+
+
+void ota_service(void){
+    File    file;
+
+    if ((OTA_REBOOT == otaState) && ((millis() - otaStamp) > OTA_REBOOT_DELAY)){
+        LOG_INFO("Restarting into the new firmware");
+        log_flush();
+        ESP.restart();
+    }
+    if (WiFi.status() != WL_CONNECTED){
+        return;
+    }
+    if (otaRtc.trial && (millis() > OTA_CONFIRM_DELAY)){                        // reached HTTP-ready and stayed up
+        otaRtc.trial = 0;
+        otaRtc.boots = 0;
+        ESP.rtcUserMemoryWrite(OTA_RTC_OFFSET, (uint32_t *)&otaRtc, sizeof(otaRtc));
+        if ('\0' != otaConfig.current[0]){
+            memcpy(otaConfig.good, otaConfig.current, OTA_URL_LEN);
+            file = LittleFS.open(OTA_FILE, "w");
+            file.write((const uint8_t *)&otaConfig, sizeof(otaConfig));
+            file.close();
+        }
+        LOG_INFO("Firmware confirmed");
+    }
+    if (otaRecovery && (OTA_IDLE == otaState)){
+        otaRecovery = false;
+        if ('\0' == otaConfig.good[0]){
+            LOG_ERROR("No confirmed image to roll back to, push one to /ota");
+        }
+        else if (!ota_pullStart(otaConfig.good)){
+            LOG_ERROR("Rollback pull failed: %s", otaError);
+        }
+    }
+}
+
+
+bool ota_begin(unsigned long size){
+#ifdef OTA_PUBLIC_KEY
+    if (!Update.installSignature(&otaHash, &otaVerifier) || !Update.begin(size)){
+        otaError = "not enough flash for the image";
+        return false;
+    }
+    otaSize = size;
+    otaWritten = 0;
+    otaStart = millis();
+    otaStamp = otaStart;
+    otaJitterMax = 0;
+    LOG_INFO("OTA started, %lu bytes", size);
+    return true;
+#else
+    (void)size;
+    otaError = "no signing key, build with include/ota_key.h";
+    return false;
+#endif
+}
+
+
+bool ota_write(uint8_t *data, size_t len){
+    if (Update.write(data, len) != len){                                        // buffers one flash sector internally
+        ota_abort("flash write failed");
+        return false;
+    }
+    otaWritten += len;
+    otaStamp = millis();
+    return true;
+}
+
+
+void ota_finish(void){
+    File            file;
+    unsigned long   elapsed = millis() - otaStart;
+
+    otaRate = (elapsed > 0) ? ((otaWritten * 1000UL) / elapsed) : otaWritten;
+    if (!Update.end()){                                                         // checks the signature before arming eboot
+        LOG_ERROR("OTA rejected: %s", Update.getErrorString().c_str());
+        otaError = "image incomplete or signature invalid";
+        otaState = OTA_IDLE;
+        return;
+    }
+    if (OTA_PUSH == otaState){
+        otaConfig.current[0] = '\0';                                            // pushed images cannot be re-fetched
+    }
+    file = LittleFS.open(OTA_FILE, "w");
+    file.write((const uint8_t *)&otaConfig, sizeof(otaConfig));
+    file.close();
+    otaRtc.trial = 1;
+    otaRtc.boots = 0;
+    ESP.rtcUserMemoryWrite(OTA_RTC_OFFSET, (uint32_t *)&otaRtc, sizeof(otaRtc));
+    LOG_INFO("OTA verified, %lu bytes at %lu B/s, LED jitter %lu us", otaWritten, otaRate, otaJitterMax);
+    otaState = OTA_REBOOT;
+    otaStamp = millis();
+}
+
+
+void ota_abort(const char *reason){
+    if (OTA_IDLE == otaState){
+        return;
+    }
+    Update.end();                                                               // incomplete, discards the image
+    net_close(&otaConn);
+    otaError = reason;
+    otaState = OTA_IDLE;
+    LOG_ERROR("OTA aborted after %lu bytes: %s", otaWritten, reason);
+}
+
+
+void ota_receive(void){
+    HTTPRaw     &raw    = webServer.raw();
+
+    if (RAW_START == raw.status){
+        otaLastOk = false;
+        if (OTA_IDLE != otaState){
+            otaError = "update already running";
+            return;
+        }
+        if (!ota_begin(webServer.clientContentLength())){
+            return;
+        }
+        otaState = OTA_PUSH;
+    }
+    else if (OTA_PUSH != otaState){
+        return;
+    }
+    else if (RAW_WRITE == raw.status){
+        ota_write(raw.buf, raw.currentSize);
+        sched_runUrgent();                                                      // the whole body arrives in one handleClient()
+        diag_feed();
+    }
+    else if (RAW_END == raw.status){
+        ota_finish();
+        otaLastOk = (OTA_REBOOT == otaState);
+    }
+    else {
+        ota_abort("upload aborted by client");
+    }
+}
+
+
+void ota_done(void){
+    if (otaLastOk){
+        server_send(200, "text/plain", "Update verified, restarting");
+    }
+    else {
+        server_send((OTA_IDLE == otaState) ? 400 : 409, "text/plain", otaError);
+    }
+    otaLastOk = false;
+}
+
+
+void ota_pull(void){
+    const String    &url    = webServer.arg("url");
+
+    if (OTA_IDLE != otaState){
+        server_send(409, "text/plain", "Update already running");
+        return;
+    }
+    if ((0 == url.length()) || (url.length() >= OTA_URL_LEN) || !ota_pullStart(url.c_str())){
+        snprintf(serverMsg, sizeof(serverMsg), "Expected url=http://host[:port]/path: %s", otaError);
+        server_send(400, "text/plain", serverMsg);
+        return;
+    }
+    server_send(202, "text/plain", "Download started, progress at /stats");
+}
+
+
+bool ota_pullStart(const char *url){
+    char        host[NET_HOST_LEN];
+    const char  *start;
+    const char  *path;
+    const char  *port;
+    size_t      len;
+
+    if (0 != strncmp(url, "http://", 7)){
+        otaError = "only http:// urls, the image is signed";
+        return false;
+    }
+    start = url + 7;
+    path = strchr(start, '/');
+    if (NULL == path){
+        path = start + strlen(start);
+    }
+    port = (const char *)memchr(start, ':', path - start);
+    len = ((NULL != port) ? port : path) - start;
+    if ((0 == len) || (len >= sizeof(host))){
+        otaError = "bad host";
+        return false;
+    }
+    memcpy(host, start, len);
+    host[len] = '\0';
+
+    // DNS and the TCP handshake finish in lwIP callbacks, ota_poll() sends the request
+    if (!net_open(&otaConn, host, (NULL != port) ? atoi(port + 1) : 80, OTA_CONNECT_TIMEOUT)){
+        otaError = otaConn.error;
+        return false;
+    }
+    if (url != otaUrl){
+        strncpy(otaUrl, url, OTA_URL_LEN - 1);
+    }
+    otaLineLen = 0;
+    otaLineCount = 0;
+    otaSize = 0;
+    otaWritten = 0;
+    otaStamp = millis();
+    otaState = OTA_PULL_CONNECT;
+    LOG_INFO("OTA pull from %s", url);
+    return true;
+}
+
+
+void ota_poll(void){
+    uint8_t     buf[OTA_CHUNK];
+    char        request[OTA_URL_LEN + NET_HOST_LEN + 32];
+    const char  *path;
+    uint8_t     c;
+    int         count;
+
+    if ((millis() - otaStamp) > OTA_TIMEOUT){
+        ota_abort("download timed out");
+        return;
+    }
+    if (OTA_PULL_CONNECT == otaState){
+        net_poll(&otaConn);
+        if (NET_FAILED == otaConn.state){
+            ota_abort(otaConn.error);
+            return;
+        }
+        if (NET_CONNECTED != otaConn.state){
+            return;
+        }
+        path = strchr(otaUrl + 7, '/');
+        snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n", (NULL != path) ? path : "/", otaConn.host);
+        if (!net_write(&otaConn, (const uint8_t *)request, strlen(request))){
+            ota_abort("request not sent");
+            return;
+        }
+        memcpy(otaConfig.current, otaUrl, OTA_URL_LEN);                         // installed from here if it verifies
+        otaStamp = millis();
+        otaState = OTA_PULL_HEADERS;
+    }
+    while ((OTA_PULL_HEADERS == otaState) && (net_read(&otaConn, &c, 1) > 0)){
+        if ('\r' == c){
+            continue;
+        }
+        if ('\n' != c){
+            if (otaLineLen < (OTA_LINE_LEN - 1)){
+                otaLine[otaLineLen++] = c;
+            }
+            continue;
+        }
+        otaLine[otaLineLen] = '\0';
+        otaStamp = millis();
+        if ((0 == otaLineCount) && (NULL == strstr(otaLine, " 200"))){
+            ota_abort("server did not return 200");
+            return;
+        }
+        if (0 == strncasecmp(otaLine, "Content-Length:", 15)){
+            otaSize = strtoul(otaLine + 15, NULL, 10);
+        }
+        if (0 == otaLineLen){                                                   // end of headers
+            if (0 == otaSize){
+                ota_abort("no Content-Length");
+                return;
+            }
+            if (!ota_begin(otaSize)){
+                net_close(&otaConn);
+                otaState = OTA_IDLE;
+                LOG_ERROR("OTA pull failed: %s", otaError);
+                return;
+            }
+            otaState = OTA_PULL_BODY;
+        }
+        otaLineLen = 0;
+        otaLineCount += 1;
+    }
+    if (OTA_PULL_BODY != otaState){
+        return;
+    }
+    count = net_read(&otaConn, buf, min((unsigned long)OTA_CHUNK, otaSize - otaWritten));  // one chunk per run, LEDs go between
+    if ((count > 0) && !ota_write(buf, count)){
+        return;
+    }
+    if (otaWritten >= otaSize){
+        net_close(&otaConn);
+        ota_finish();
+    }
+    else if ((count <= 0) && (NET_CONNECTED != otaConn.state)){
+        ota_abort("connection closed early");
+    }
+}
+
+
+void mqtt_init(void){
+    File    file;
+
+    snprintf(mqttSession.base, sizeof(mqttSession.base), "eperly/%06x", (unsigned int)ESP.getChipId());
+    snprintf(mqttSession.clientId, sizeof(mqttSession.clientId), "eperly-%06x", (unsigned int)ESP.getChipId());
+    mqttSession.write = mqtt_write;
+    mqttSession.close = mqtt_close;
+    mqttSession.command = mqtt_command;
+    memset(&mqttConfig, 0, sizeof(mqttConfig));
+    file = LittleFS.open(MQTT_FILE, "r");
+    if (file){
+        file.read((uint8_t *)&mqttConfig, sizeof(mqttConfig));
+        file.close();
+        mqttConfig.host[MQTT_HOST_LEN - 1] = '\0';
+    }
+    mqtt_start(&mqttSession, '\0' != mqttConfig.host[0], millis());
+}
+
+
+void mqtt_service(void){
+    unsigned long   reconnects;
+    char            state[MQTT_STATE_LEN];
+
+    if ((MQTT_OFF == mqttSession.state) || (WiFi.status() != WL_CONNECTED)){
+        return;
+    }
+    if (MQTT_BACKOFF == mqttSession.state){
+        if (mqtt_due(&mqttSession, millis())){
+            mqtt_connect();
+        }
+        return;
+    }
+    net_poll(&mqttConn);
+    if (MQTT_CONNECTING == mqttSession.state){
+        if (NET_CONNECTED == mqttConn.state){
+            mqtt_opened(&mqttSession, millis());
+        }
+        else if (NET_FAILED == mqttConn.state){
+            snprintf(mqttSession.error, sizeof(mqttSession.error), "%s:%u: %s", mqttConfig.host, mqttConfig.port,
+                mqttConn.error);
+            mqtt_drop(&mqttSession, millis(), mqttSession.error);
+        }
+        return;
+    }
+    if ((NET_CONNECTED != mqttConn.state) && (0 == net_available(&mqttConn))){
+        mqtt_drop(&mqttSession, millis(), "connection lost");
+        return;
+    }
+    reconnects = mqttSession.reconnects;
+    mqttSession.bufLen += net_read(&mqttConn, mqttSession.buf + mqttSession.bufLen, MQTT_BUF_SIZE - mqttSession.bufLen);
+    mqtt_process(&mqttSession, millis());
+    if (reconnects != mqttSession.reconnects){
+        LOG_INFO("MQTT connected to %s:%u", mqttConfig.host, mqttConfig.port);
+    }
+    if (mqtt_poll(&mqttSession, millis())){
+        mqtt_stateJson(state, sizeof(state));
+        mqtt_publishState(&mqttSession, state, millis());
+    }
+}
+
+
+void mqtt_connect(void){
+    // DNS and the TCP handshake finish in lwIP callbacks, mqtt_service() polls for the result
+    if (!net_open(&mqttConn, mqttConfig.host, mqttConfig.port, MQTT_CONNECT_TIMEOUT)){
+        snprintf(mqttSession.error, sizeof(mqttSession.error), "%s:%u: %s", mqttConfig.host, mqttConfig.port,
+            mqttConn.error);
+        mqtt_drop(&mqttSession, millis(), mqttSession.error);
+        return;
+    }
+    mqtt_opening(&mqttSession, millis());
+}
+
+
+bool mqtt_write(void *ctx, const uint8_t *data, uint16_t len){
+    return net_write(&mqttConn, data, len);
+}
+
+
+void mqtt_close(void *ctx){
+    LOG_WARN("MQTT %s", mqttSession.error);
+    net_close(&mqttConn);
+}
+
+
+void mqtt_command(void *ctx, const char *key, const char *payload){
+    long        value;
+
+    if (0 == strcmp(key, "state")){
+        ledState = (0 == strcasecmp(payload, "ON")) || (0 == strcmp(payload, "1"));
+        led_queue(LED_CMD_STATE);
+    }
+    else if (0 == strcmp(key, "brightness")){
+        value = atol(payload);
+        ledBrightness = constrain(value, LED_MIN_BRIGHTNESS, LED_MAX_BRIGHTNESS);
+        led_queue(LED_CMD_BRIGHTNESS);
+    }
+    else if (0 == strcmp(key, "color")){
+        if ('#' == *payload){
+            payload += 1;
+        }
+        led_storeColor(strtol(payload, NULL, 16));                              // keeps r/g/b tuning in step
+        led_queue(LED_CMD_COLOR);
+    }
+    else if (0 == strcmp(key, "pattern")){
+        if (0 == strcasecmp(payload, "static")){
+            ledPattern = STATIC;
+        }
+        else if (0 == strcasecmp(payload, "heartbeat")){
+            ledPattern = HEARTBEAT;
+        }
+        else if (0 == strcasecmp(payload, "rotate")){
+            ledPattern = ROTATE;
+        }
+        else if (0 == strcasecmp(payload, "audio")){
+            ledPattern = AUDIO;
+        }
+        else {
+            return;
+        }
+        led_queue(LED_CMD_PATTERN);
+    }
+}
+
+
+void mqtt_stateJson(char *state, size_t size){
+    static const char   *patterns[]     = {"static", "heartbeat", "rotate", "frame", "effect", "audio"};
+
+    snprintf(state, size, "{\"state\":\"%s\",\"brightness\":%d,\"color\":\"%06X\",\"pattern\":\"%s\"}",
+        ledState ? "ON" : "OFF", ledBrightness, ledColor & 0xFFFFFF, patterns[ledPattern]);
+}
+
+
+void mqtt_config(void){
+    File    file;
+    const String &host  = webServer.arg("host");
+    long    port    = webServer.hasArg("port") ? webServer.arg("port").toInt() : MQTT_PORT;
+
+    if ((host.length() >= MQTT_HOST_LEN) || (port <= 0) || (port > 65535)){
+        server_send(400, "text/plain", "Expected host=<broker>&port=<1..65535>, empty host disables MQTT");
+        return;
+    }
+    net_close(&mqttConn);
+    memset(&mqttConfig, 0, sizeof(mqttConfig));
+    strncpy(mqttConfig.host, host.c_str(), MQTT_HOST_LEN - 1);
+    mqttConfig.port = port;
+    file = LittleFS.open(MQTT_FILE, "w");
+    file.write((const uint8_t *)&mqttConfig, sizeof(mqttConfig));
+    file.close();
+    mqtt_init();
+    snprintf(serverMsg, sizeof(serverMsg), ('\0' != mqttConfig.host[0]) ? "MQTT topics under %s" : "MQTT disabled", mqttSession.base);
+    server_send(200, "text/plain", serverMsg);
+}
+
+
+void log_write(uint8_t level, PGM_P format, ...){
+    uint32_t            cycles      = ESP.getCycleCount();
+    char                line[LOG_LINE_LEN];
+    va_list             args;
+    uint16_t            len;
+
+    va_start(args, format);
+    len = log_format(line, sizeof(line), millis(), level, format, args);
+    va_end(args);
+    logHead = log_append(logBuffer, LOG_BUFFER_SIZE, logHead, line, len);
+
+    cycles = ESP.getCycleCount() - cycles;
+    if (cycles > logCyclesMax){
+        logCyclesMax = cycles;
+    }
+}
+
+
+void log_drain(void){
+    uint32_t    head    = logHead;
+    uint32_t    count;
+    char        line[LOG_SYSLOG_LEN];
+
+    if (logSinks & LOG_SINK_UART){
+        log_catchUp(LOG_BUFFER_SIZE, &logUartTail, head, &logUartDropped);
+        count = min(head - logUartTail, (uint32_t)Serial.availableForWrite()); // never wait on the UART FIFO
+        count = min(count, LOG_BUFFER_SIZE - (logUartTail & (LOG_BUFFER_SIZE - 1)));
+        if (count > 0){
+            Serial.write((const uint8_t *)logBuffer + (logUartTail & (LOG_BUFFER_SIZE - 1)), count);
+            logUartTail += count;
+        }
+    }
+    else {
+        logUartTail = head;
+    }
+
+    if ((logSinks & LOG_SINK_SYSLOG) && ((uint32_t)logSyslogHost != 0) && (WiFi.status() == WL_CONNECTED)){
+        for (uint8_t n = 0; n < LOG_SYSLOG_LINES; n++){
+            log_catchUp(LOG_BUFFER_SIZE, &logSyslogTail, head, &logSyslogDropped);
+            count = log_syslog(logBuffer, LOG_BUFFER_SIZE, &logSyslogTail, head, wifiHostname, line, sizeof(line));
+            if (0 == count){
+                break;
+            }
+            logUdp.beginPacket(logSyslogHost, LOG_SYSLOG_PORT);                 // formatted on the stack, printf() would
+            logUdp.write((const uint8_t *)line, count);                         // allocate for lines over 64 bytes
+            logUdp.endPacket();
+        }
+    }
+    else {
+        logSyslogTail = head;
+    }
+}
+
+
+void log_flush(void){
+    while ((logSinks & LOG_SINK_UART) && (logUartTail != logHead)){
+        log_drain();
+        yield();
+    }
+}
+
+
+void log_tail(void){
+    uint32_t    head    = logHead;
+    uint32_t    start   = (head > LOG_BUFFER_SIZE) ? (head - LOG_BUFFER_SIZE) : 0;
+    uint32_t    index;
+    uint32_t    count;
+
+    if (start > 0){                                                             // skip the partially overwritten line
+        while ((start != head) && ('\n' != logBuffer[start & (LOG_BUFFER_SIZE - 1)])){
+            start += 1;
+        }
+        start += (start != head) ? 1 : 0;
+    }
+    webServer.setContentLength(head - start);
+    server_send(200, "text/plain", "");
+    index = start & (LOG_BUFFER_SIZE - 1);
+    count = min(head - start, LOG_BUFFER_SIZE - index);
+    if (count > 0){
+        webServer.sendContent(logBuffer + index, count);
+    }
+    if ((head - start) > count){
+        webServer.sendContent(logBuffer, (head - start) - count);
+    }
+}
+
+
+void log_config(void){
+    if (webServer.hasArg("sinks")){
+        logSinks = webServer.arg("sinks").toInt() & (LOG_SINK_UART | LOG_SINK_SYSLOG);
+    }
+    if (webServer.hasArg("syslog") && !logSyslogHost.fromString(webServer.arg("syslog").c_str())){
+        server_send(400, "text/plain", "Expected syslog=<ip address>");
+        return;
+    }
+    logSyslogTail = logHead;                                                    // a new sink starts at the current line
+    server_send(200, "text/plain", "OK");
+}
+
+
+void eeprom_init(void){
+    LOG_DEBUG("Initializing EEPROM");
+    EEPROM.begin(EEPROM_SIZE);
+}
+
+
+void eeprom_read(void){
+    int     addr            = 0;
+    byte    readValue;
+    uint8_t ssidIndex       = 0;
+    uint8_t passwordIndex   = 0;
+
+    readValue = EEPROM.read(addr);
+    if ('\n' == char(readValue)){
+        wifiInfoPresent = true;
+        addr += 1;
+    }
+    else {
+        wifiInfoPresent = false;
+        return;
     }
     
     while(true){
         readValue = EEPROM.read(addr);
-        if ('\n' == char(readValue)){
+        if (('\n' == char(readValue)) || (addr >= (EEPROM_SIZE - 1)) || (ssidIndex >= (sizeof(wifiSSID) - 1))){
             break;
         }
         else {
@@ -1313,7 +5501,7 @@ void eeprom_read(void){
     addr += 1;
     while(true){
         readValue = EEPROM.read(addr);
-        if ('\n' == char(readValue)){
+        if (('\n' == char(readValue)) || (addr >= (EEPROM_SIZE - 1)) || (passwordIndex >= (sizeof(wifiPassword) - 1))){
             break;
         }
         else {
@@ -1337,7 +5525,7 @@ void eeprom_write(void){
     int addr        = 0;
     int i           = 0;
 
-    Serial.println("Writing WiFi info to EEPROM...");
+    LOG_DEBUG("Writing WiFi info to EEPROM...");
     
     // overwrite all EEPROM data
     eeprom_erase();
@@ -1370,7 +5558,7 @@ void eeprom_write(void){
 
     EEPROM.write(addr, '\n');                                                   // write the 3rd character indicator
     EEPROM.commit();
-    Serial.println("Finished writing WiFi credentials to EEPROM.");
+    LOG_INFO("Finished writing WiFi credentials to EEPROM.");
 }
 
 
@@ -1391,6 +5579,9 @@ void serial_getWifiInfo(void){
             if (Serial.available()){
                 input = Serial.read();
                 if (('\n' != input) && ('\r' != input)){
+                    if (ssidIndex >= (int)(sizeof(wifiSSID) - 1)){                  // ignore input past the buffer
+                        continue;
+                    }
                     wifiSSID[ssidIndex] = input;
                     ssidIndex += 1;
                     validChars += 1;
@@ -1438,6 +5629,9 @@ void serial_getWifiInfo(void){
             if (Serial.available()){
                 input = Serial.read();
                 if (('\n' != input) && ('\r' != input)){
+                    if (passwordIndex >= (int)(sizeof(wifiPassword) - 1)){          // ignore input past the buffer
+                        continue;
+                    }
                     wifiPassword[passwordIndex] = input;
                     passwordIndex += 1;
                     validChars += 1;
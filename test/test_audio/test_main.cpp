@@ -0,0 +1,176 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              Audio Goertzel bank (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "lamp_audio.h"
+
+
+#define TEST_RATE                       200                                     // (Hz) AUDIO_SAMPLE_PERIOD
+#define TEST_BLOCK                      16                                      // AUDIO_BLOCK
+#define TEST_BANDS                      3
+#define TEST_JITTER                     0.0005                                  // (s) AUDIO_JITTER_MAX
+
+
+const uint8_t       bins[TEST_BANDS]    = {2, 4, 7};                            // audioBins
+int32_t             coeff[TEST_BANDS];
+int32_t             s1[TEST_BANDS];
+int32_t             s2[TEST_BANDS];
+uint32_t            seed;
+
+
+void setUp(void){
+    for (uint8_t b = 0; b < TEST_BANDS; b++){
+        coeff[b] = audio_coeff(bins[b], TEST_BLOCK);
+    }
+    seed = 1;
+}
+
+
+void tearDown(void){
+}
+
+
+double noise(void){                                                             // uniform -1..1, repeatable
+    seed = seed * 1103515245 + 12345;
+    return ((double)((seed >> 8) & 0xFFFF) / 32768.0) - 1.0;
+}
+
+
+// one block of a tone (Hz) sampled at TEST_RATE with optional timing jitter (s), returns the magnitudes
+void block(double freq, double amplitude, double phase, double jitter, uint32_t *magnitude){
+    double          t;
+
+    memset(s1, 0, sizeof(s1));
+    memset(s2, 0, sizeof(s2));
+    for (uint8_t n = 0; n < TEST_BLOCK; n++){
+        t = ((double)n / TEST_RATE) + (jitter * noise());
+        audio_goertzel(lround(amplitude * sin((2.0 * M_PI * freq * t) + phase)), coeff, s1, s2, TEST_BANDS);
+    }
+    for (uint8_t b = 0; b < TEST_BANDS; b++){
+        magnitude[b] = audio_magnitude(coeff[b], s1[b], s2[b]);
+    }
+}
+
+
+void test_isqrt(void){
+    TEST_ASSERT_EQUAL_UINT32(0, audio_isqrt(0));
+    TEST_ASSERT_EQUAL_UINT32(1, audio_isqrt(3));
+    TEST_ASSERT_EQUAL_UINT32(2, audio_isqrt(4));
+    TEST_ASSERT_EQUAL_UINT32(65535, audio_isqrt(65536ULL * 65536ULL - 1));
+    TEST_ASSERT_EQUAL_UINT32(65536, audio_isqrt(65536ULL * 65536ULL));
+    TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFF, audio_isqrt(0xFFFFFFFFFFFFFFFFULL));
+}
+
+
+void test_coefficients(void){
+    TEST_ASSERT_EQUAL_INT32(23170, coeff[0]);                                   // 2cos(pi/4)
+    TEST_ASSERT_EQUAL_INT32(0, coeff[1]);                                       // 2cos(pi/2)
+    TEST_ASSERT_EQUAL_INT32(-30274, coeff[2]);                                  // 2cos(7pi/8)
+}
+
+
+void test_tone_on_bin_is_detected(void){
+    uint32_t        magnitude[TEST_BANDS];
+
+    for (uint8_t b = 0; b < TEST_BANDS; b++){
+        block(bins[b] * (double)TEST_RATE / TEST_BLOCK, 200.0, 0.3, 0.0, magnitude);
+        for (uint8_t k = 0; k < TEST_BANDS; k++){
+            if (k == b){
+                TEST_ASSERT_UINT32_WITHIN(32, 1600, magnitude[k]);              // amplitude * block / 2
+            }
+            else {
+                TEST_ASSERT_LESS_THAN(32, magnitude[k]);                        // other bins are orthogonal
+            }
+        }
+    }
+}
+
+
+void test_dc_is_removed(void){
+    int32_t         dc          = 512 << 4;
+    uint32_t        magnitude[TEST_BANDS];
+
+    for (uint16_t n = 0; n < 1000; n++){                                        // settle on a 700 count offset
+        audio_dc(700, &dc);
+    }
+    memset(s1, 0, sizeof(s1));
+    memset(s2, 0, sizeof(s2));
+    for (uint8_t n = 0; n < TEST_BLOCK; n++){
+        audio_goertzel(audio_dc(700 + lround(200.0 * sin(2.0 * M_PI * 50.0 * n / TEST_RATE)), &dc), coeff, s1, s2, TEST_BANDS);
+    }
+    for (uint8_t b = 0; b < TEST_BANDS; b++){
+        magnitude[b] = audio_magnitude(coeff[b], s1[b], s2[b]);
+    }
+    TEST_ASSERT_UINT32_WITHIN(64, 1600, magnitude[1]);
+    TEST_ASSERT_LESS_THAN(64, magnitude[0]);                                    // AUDIO_NOISE_FLOOR
+    TEST_ASSERT_LESS_THAN(64, magnitude[2]);
+}
+
+
+void test_jitter_within_limit_keeps_the_bin(void){
+    uint32_t        clean[TEST_BANDS];
+    uint32_t        magnitude[TEST_BANDS];
+    uint32_t        worst       = 0xFFFFFFFF;
+
+    // samples up to AUDIO_JITTER_MAX off their slot still read the high band within 10%
+    block(87.5, 200.0, 0.0, 0.0, clean);
+    for (uint16_t n = 0; n < 200; n++){
+        block(87.5, 200.0, n * 0.1, TEST_JITTER, magnitude);
+        worst = (magnitude[2] < worst) ? magnitude[2] : worst;
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL((clean[2] * 90) / 100, worst);
+}
+
+
+void test_benchmark_clip(void){
+    const uint32_t  seconds     = 600;
+    const uint32_t  samples     = seconds * TEST_RATE;
+    uint32_t        level[TEST_BANDS]   = {0, 0, 0};
+    int32_t         *clip       = new int32_t[samples];
+    int32_t         dc          = 512 << 4;
+    char            msg[128];
+    double          t;
+    double          ns;
+
+    // ten minutes of a 120 bpm beat: 25Hz kick on the beat, 50Hz bass line, 88Hz hats, noise, 10-bit ADC
+    for (uint32_t n = 0; n < samples; n++){
+        t = (double)n / TEST_RATE;
+        clip[n] = 512 + lround(((fmod(t, 0.5) < 0.1) ? 250.0 : 0.0) * sin(2.0 * M_PI * 25.0 * t) +
+                               90.0 * sin(2.0 * M_PI * 50.0 * t) + 40.0 * sin(2.0 * M_PI * 87.5 * t) + 20.0 * noise());
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < samples; n += TEST_BLOCK){
+        memset(s1, 0, sizeof(s1));
+        memset(s2, 0, sizeof(s2));
+        for (uint8_t k = 0; k < TEST_BLOCK; k++){
+            audio_goertzel(audio_dc(clip[n + k], &dc), coeff, s1, s2, TEST_BANDS);
+        }
+        for (uint8_t b = 0; b < TEST_BANDS; b++){
+            level[b] += audio_magnitude(coeff[b], s1[b], s2[b]);
+        }
+    }
+    ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    delete[] clip;
+    snprintf(msg, sizeof(msg), "host Goertzel: %.1f ns per sample, mean magnitudes %u / %u / %u",
+             ns / samples, (unsigned)(level[0] / (samples / TEST_BLOCK)), (unsigned)(level[1] / (samples / TEST_BLOCK)),
+             (unsigned)(level[2] / (samples / TEST_BLOCK)));
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_GREATER_THAN(level[2], level[1]);                               // louder bass line than hats
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_isqrt);
+    RUN_TEST(test_coefficients);
+    RUN_TEST(test_tone_on_bin_is_detected);
+    RUN_TEST(test_dc_is_removed);
+    RUN_TEST(test_jitter_within_limit_keeps_the_bin);
+    RUN_TEST(test_benchmark_clip);
+    return UNITY_END();
+}
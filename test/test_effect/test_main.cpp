@@ -0,0 +1,188 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              Effect compiler, verifier and VM (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "lamp_effect.h"
+
+
+#define TEST_CODE_SIZE                  64                                      // EFFECT_CODE_SIZE
+#define TEST_BUDGET                     16000                                   // EFFECT_FRAME_BUDGET
+#define TEST_LEDS                       8
+
+
+uint8_t             code[TEST_CODE_SIZE];
+uint8_t             len;
+uint8_t             rgb[255][3];
+
+
+void setUp(void){
+    memset(code, 0, sizeof(code));
+    memset(rgb, 0xAA, sizeof(rgb));
+    len = 0;
+}
+
+
+void tearDown(void){
+}
+
+
+bool compile(const char *src, uint16_t leds){
+    return effect_compile(src, code, TEST_CODE_SIZE, &len, leds, TEST_BUDGET);
+}
+
+
+void test_compiles_and_runs_constant_color(void){
+    TEST_ASSERT_TRUE(compile("255; 0; 0x40", TEST_LEDS));
+    effect_run(code, len, 0, &rgb[0][0], TEST_LEDS);
+    for (uint8_t i = 0; i < TEST_LEDS; i++){
+        TEST_ASSERT_EQUAL_UINT8(255, rgb[i][0]);
+        TEST_ASSERT_EQUAL_UINT8(0, rgb[i][1]);
+        TEST_ASSERT_EQUAL_UINT8(0x40, rgb[i][2]);
+    }
+    TEST_ASSERT_EQUAL_UINT8(0xAA, rgb[TEST_LEDS][0]);                           // stops at the last pixel
+}
+
+
+void test_pixel_index_time_and_precedence(void){
+    TEST_ASSERT_TRUE(compile("i * 32 + 1; 255 - i * 32; (t + i) % n", TEST_LEDS));
+    effect_run(code, len, 13, &rgb[0][0], TEST_LEDS);
+    for (uint8_t i = 0; i < TEST_LEDS; i++){
+        TEST_ASSERT_EQUAL_UINT8((i * 32) + 1, rgb[i][0]);
+        TEST_ASSERT_EQUAL_UINT8(255 - (i * 32), rgb[i][1]);
+        TEST_ASSERT_EQUAL_UINT8((13 + i) % TEST_LEDS, rgb[i][2]);
+    }
+}
+
+
+void test_functions_and_clamping(void){
+    TEST_ASSERT_TRUE(compile("sin(t); tri(t) + abs(-300); scale(min(t, 200), max(-5, 128))", TEST_LEDS));
+    effect_run(code, len, 64, &rgb[0][0], 1);
+    TEST_ASSERT_EQUAL_UINT8(255, rgb[0][0]);                                    // sin8(64)
+    TEST_ASSERT_EQUAL_UINT8(255, rgb[0][1]);                                    // 128 + 300, clamped
+    TEST_ASSERT_EQUAL_UINT8(32, rgb[0][2]);                                     // (64 * 128) >> 8
+}
+
+
+void test_sin8_matches_fastled(void){
+    TEST_ASSERT_EQUAL_UINT8(128, effect_sin8(0));
+    TEST_ASSERT_EQUAL_UINT8(218, effect_sin8(32));
+    TEST_ASSERT_EQUAL_UINT8(255, effect_sin8(64));
+    TEST_ASSERT_EQUAL_UINT8(128, effect_sin8(128));
+    TEST_ASSERT_EQUAL_UINT8(1, effect_sin8(192));
+}
+
+
+void test_rejects_bad_source(void){
+    TEST_ASSERT_FALSE(compile("255; 0", TEST_LEDS));                            // two channels
+    TEST_ASSERT_FALSE(compile("255; 0; 0; 0", TEST_LEDS));
+    TEST_ASSERT_FALSE(compile("x; 0; 0", TEST_LEDS));
+    TEST_ASSERT_FALSE(compile("40000; 0; 0", TEST_LEDS));                       // immediates are 16-bit
+    TEST_ASSERT_FALSE(compile("((((((((((1)))))))));0;0", TEST_LEDS));          // deeper than EFFECT_NEST_MAX
+    TEST_ASSERT_FALSE(compile("sin(1, 2); 0; 0", TEST_LEDS));
+    TEST_ASSERT_FALSE(compile("1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1+1; 0; 0", TEST_LEDS));
+}
+
+
+void test_rejects_malformed_bytecode(void){
+    const uint8_t   underflow[] = {OP_ADD, OP_OUT, OP_OUT, OP_OUT, OP_END};
+    const uint8_t   truncated[] = {OP_T, OP_OUT, OP_T, OP_OUT, OP_PUSH16, 1};
+    const uint8_t   unknown[]   = {OP_T, OP_OUT, OP_T, OP_OUT, OP_T, OP_COUNT, OP_OUT, OP_END};
+    const uint8_t   outs[]      = {OP_T, OP_OUT, OP_T, OP_OUT, OP_END};
+    const uint8_t   leftover[]  = {OP_T, OP_T, OP_OUT, OP_T, OP_OUT, OP_T, OP_OUT, OP_END};
+    const uint8_t   good[]      = {OP_T, OP_OUT, OP_I, OP_OUT, OP_PUSH8, 7, OP_OUT, OP_END};
+    uint8_t         deep[32];
+    uint8_t         n           = 0;
+
+    TEST_ASSERT_EQUAL_INT(-1, effect_verify(underflow, sizeof(underflow), TEST_LEDS, TEST_BUDGET));
+    TEST_ASSERT_EQUAL_INT(-1, effect_verify(truncated, sizeof(truncated), TEST_LEDS, TEST_BUDGET));
+    TEST_ASSERT_EQUAL_INT(-1, effect_verify(unknown, sizeof(unknown), TEST_LEDS, TEST_BUDGET));
+    TEST_ASSERT_EQUAL_INT(-1, effect_verify(outs, sizeof(outs), TEST_LEDS, TEST_BUDGET));
+    TEST_ASSERT_EQUAL_INT(-1, effect_verify(leftover, sizeof(leftover), TEST_LEDS, TEST_BUDGET));
+    TEST_ASSERT_EQUAL_INT(7, effect_verify(good, sizeof(good), TEST_LEDS, TEST_BUDGET));
+
+    for (uint8_t k = 0; k <= EFFECT_STACK; k++){                                // one push more than the stack holds
+        deep[n++] = OP_T;
+    }
+    TEST_ASSERT_EQUAL_INT(-1, effect_verify(deep, n, TEST_LEDS, TEST_BUDGET));
+}
+
+
+void test_budget_scales_with_pixels(void){
+    // fits the 8 LED ring, too slow for a 255 pixel strip
+    TEST_ASSERT_TRUE(compile("sin(t + i * 8); sin(t * 2 + i * 8); sin(t * 3 + i * 8)", TEST_LEDS));
+    TEST_ASSERT_FALSE(compile("sin(t + i * 8); sin(t * 2 + i * 8); sin(t * 3 + i * 8)", 255));
+    TEST_ASSERT_TRUE(compile("t; i; 0", 64));
+}
+
+
+void test_budget_rejects_division_heavy_code_on_8_leds(void){
+    // within EFFECT_CODE_SIZE, but 27 software divisions per pixel do not fit the frame budget
+    TEST_ASSERT_FALSE(compile("t/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i; 0; 0", TEST_LEDS));
+    TEST_ASSERT_TRUE(compile("t/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i/i; 0; 0", 4));
+    TEST_ASSERT_TRUE(compile("t/(i+1); t%(i+1); 0", TEST_LEDS));
+}
+
+
+void test_overflow_wraps_without_undefined_behaviour(void){
+    uint8_t         prog[16];
+    uint8_t         n;
+
+    // INT32_MIN / -1, INT32_MIN % -1 and -INT32_MIN wrap instead of trapping
+    TEST_ASSERT_TRUE(compile("(-16384 * 2 << 16) / -1 + 300; (-16384 * 2 << 16) % -1 + 7; abs(-16384 * 2 << 16) + 1", 1));
+    effect_run(code, len, 0, &rgb[0][0], 1);
+    TEST_ASSERT_EQUAL_UINT8(0, rgb[0][0]);                                      // INT32_MIN + 300, clamped to 0
+    TEST_ASSERT_EQUAL_UINT8(7, rgb[0][1]);
+    TEST_ASSERT_EQUAL_UINT8(0, rgb[0][2]);
+
+    // t = INT32_MAX: t + 1, t * t and -scale(t, t) wrap
+    n = 0;
+    prog[n++] = OP_T; prog[n++] = OP_PUSH8; prog[n++] = 1; prog[n++] = OP_ADD; prog[n++] = OP_OUT;
+    prog[n++] = OP_T; prog[n++] = OP_T; prog[n++] = OP_MUL; prog[n++] = OP_OUT;
+    prog[n++] = OP_T; prog[n++] = OP_T; prog[n++] = OP_SCALE; prog[n++] = OP_NEG; prog[n++] = OP_OUT;
+    prog[n++] = OP_END;
+    TEST_ASSERT_GREATER_THAN(0, effect_verify(prog, n, 1, TEST_BUDGET));
+    effect_run(prog, n, 0x7FFFFFFF, &rgb[0][0], 1);
+    TEST_ASSERT_EQUAL_UINT8(0, rgb[0][0]);                                      // INT32_MIN
+    TEST_ASSERT_EQUAL_UINT8(1, rgb[0][1]);                                      // (2^31 - 1)^2 mod 2^32 = 1
+    TEST_ASSERT_EQUAL_UINT8(0, rgb[0][2]);
+}
+
+
+void test_benchmark_ns_per_op(void){
+    const uint32_t  frames      = 20000;
+    char            msg[128];
+    int             ops;
+    double          ns;
+
+    TEST_ASSERT_TRUE(compile("sin(t + i * 32); scale(tri(t * 2 + i * 16), 200); abs(128 - (t + i * 8) % 256)", TEST_LEDS));
+    ops = effect_verify(code, len, TEST_LEDS, TEST_BUDGET);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t f = 0; f < frames; f++){
+        effect_run(code, len, f, &rgb[0][0], TEST_LEDS);
+    }
+    ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    snprintf(msg, sizeof(msg), "host VM: %.2f ns per pixel-instruction, %d instructions, est. %u cycles/pixel",
+             ns / ((double)frames * TEST_LEDS * ops), ops, (unsigned)effect_cost(code, len));
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_GREATER_THAN(0, rgb[0][0] + rgb[1][0] + rgb[2][0] + rgb[3][0]); // keeps the loop alive
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_compiles_and_runs_constant_color);
+    RUN_TEST(test_pixel_index_time_and_precedence);
+    RUN_TEST(test_functions_and_clamping);
+    RUN_TEST(test_sin8_matches_fastled);
+    RUN_TEST(test_rejects_bad_source);
+    RUN_TEST(test_rejects_malformed_bytecode);
+    RUN_TEST(test_budget_scales_with_pixels);
+    RUN_TEST(test_budget_rejects_division_heavy_code_on_8_leds);
+    RUN_TEST(test_overflow_wraps_without_undefined_behaviour);
+    RUN_TEST(test_benchmark_ns_per_op);
+    return UNITY_END();
+}
@@ -0,0 +1,189 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              Log lines, ring buffer and syslog packets (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "lamp_log.h"
+
+
+#define TEST_LINE_LEN                   128                                     // LOG_LINE_LEN
+#define TEST_SYSLOG_LEN                 (TEST_LINE_LEN + 32)                    // LOG_SYSLOG_LEN
+#define TEST_RING                       2048                                    // LOG_BUFFER_SIZE
+#define TEST_SMALL_RING                 64
+#define TEST_CALLS                      200000
+
+
+char                ring[TEST_RING];
+uint32_t            head;
+char                line[TEST_LINE_LEN];
+char                packet[TEST_SYSLOG_LEN];
+
+
+// log_write() without the cycle counter
+uint16_t test_log(uint8_t level, unsigned long stamp, const char *format, ...){
+    va_list         args;
+    uint16_t        len;
+
+    va_start(args, format);
+    len = log_format(line, sizeof(line), stamp, level, format, args);
+    va_end(args);
+    head = log_append(ring, TEST_RING, head, line, len);
+    return len;
+}
+
+
+void setUp(void){
+    memset(ring, 0, sizeof(ring));
+    memset(line, 0, sizeof(line));
+    memset(packet, 0, sizeof(packet));
+    head = 0;
+}
+
+
+void tearDown(void){
+}
+
+
+void test_format_stamp_tag_newline(void){
+    const char      expected[]  = "1234 [WARN] MQTT broker timed out after 45 s\n";
+
+    TEST_ASSERT_EQUAL_UINT16(strlen(expected), test_log(LOG_LEVEL_WARN, 1234, "MQTT %s after %d s", "broker timed out", 45));
+    TEST_ASSERT_EQUAL_MEMORY(expected, ring, strlen(expected));
+    TEST_ASSERT_EQUAL_UINT32(strlen(expected), head);
+}
+
+
+void test_long_message_is_cut_before_the_newline(void){
+    char            text[300];
+    uint16_t        len;
+
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    len = test_log(LOG_LEVEL_INFO, 1, "%s", text);
+    TEST_ASSERT_EQUAL_UINT16(TEST_LINE_LEN - 1, len);
+    TEST_ASSERT_EQUAL_UINT8('\n', line[len - 1]);
+    TEST_ASSERT_EQUAL_UINT8('x', line[len - 2]);
+}
+
+
+void test_ring_wraps_and_lapped_reader_counts_drops(void){
+    char            small[TEST_SMALL_RING];
+    uint32_t        at          = 0;
+    uint32_t        tail        = 0;
+    unsigned long   dropped     = 0;
+
+    for (uint8_t n = 0; n < 5; n++){                                            // 5 x 20 bytes through 64
+        at = log_append(small, sizeof(small), at, "0123456789abcdefghi\n", 20);
+    }
+    TEST_ASSERT_EQUAL_UINT32(100, at);
+    TEST_ASSERT_EQUAL_MEMORY("456789abcdefghi\n", small, 16);                  // line 4 wrapped at 64
+    TEST_ASSERT_EQUAL_MEMORY("0123", small + 16, 4);                            // 80 & 63 == 16 starts line 5
+    log_catchUp(sizeof(small), &tail, at, &dropped);
+    TEST_ASSERT_EQUAL_UINT32(36, tail);
+    TEST_ASSERT_EQUAL_UINT32(36, dropped);
+    log_catchUp(sizeof(small), &tail, at, &dropped);                            // not lapped any more
+    TEST_ASSERT_EQUAL_UINT32(36, dropped);
+}
+
+
+void check_syslog(uint32_t *tail, const char *expected){
+    TEST_ASSERT_EQUAL_UINT16(strlen(expected), log_syslog(ring, TEST_RING, tail, head, "lamp", packet, sizeof(packet)));
+    TEST_ASSERT_EQUAL_MEMORY(expected, packet, strlen(expected));
+}
+
+
+void test_syslog_packets_carry_severity_and_host(void){
+    uint32_t        tail        = 0;
+
+    test_log(LOG_LEVEL_ERROR, 10, "flash write failed");
+    test_log(LOG_LEVEL_WARN, 11, "text with [D] inside");                      // severity from the tag only
+    test_log(LOG_LEVEL_INFO, 12, "ok");
+    test_log(LOG_LEVEL_DEBUG, 13, "frame %u", 7);
+    check_syslog(&tail, "<11>lamp: 10 [ERROR] flash write failed");
+    check_syslog(&tail, "<12>lamp: 11 [WARN] text with [D] inside");
+    check_syslog(&tail, "<14>lamp: 12 [INFO] ok");
+    check_syslog(&tail, "<15>lamp: 13 [DEBUG] frame 7");
+    TEST_ASSERT_EQUAL_UINT16(0, log_syslog(ring, TEST_RING, &tail, head, "lamp", packet, sizeof(packet)));
+    TEST_ASSERT_EQUAL_UINT32(head, tail);
+}
+
+
+void test_syslog_line_across_the_ring_end_and_cut(void){
+    char            small[TEST_SMALL_RING];
+    uint32_t        at          = 60;
+    uint32_t        tail        = 60;
+    char            tiny[16];
+
+    at = log_append(small, sizeof(small), at, "5 [WARN] wrapped\n", 17);
+    TEST_ASSERT_EQUAL_UINT16(strlen("<12>h: 5 [WARN] wrapped"),
+                             log_syslog(small, sizeof(small), &tail, at, "h", packet, sizeof(packet)));
+    TEST_ASSERT_EQUAL_MEMORY("<12>h: 5 [WARN] wrapped", packet, 23);
+    at = log_append(small, sizeof(small), at, "6 [INFO] longer than the packet\n", 32);
+    TEST_ASSERT_EQUAL_UINT16(sizeof(tiny), log_syslog(small, sizeof(small), &tail, at, "h", tiny, sizeof(tiny)));
+    TEST_ASSERT_EQUAL_MEMORY("<14>h: 6 [INFO]", tiny, 15);
+    TEST_ASSERT_EQUAL_UINT32(at, tail);                                         // the cut rest is skipped
+}
+
+
+void test_benchmark_hot_path_log_cost(void){
+    // what a LOG_* call costs the task it runs in: format, ring copy; and a syslog packet in log_drain()
+    const char      *names[]    = {"short", "numbers", "long cut"};
+    char            text[200];
+    char            msg[256];
+    double          ns[3];
+    double          syslogNs;
+    uint32_t        tail        = 0;
+    unsigned long   dropped     = 0;
+    uint32_t        packets     = 0;
+    uint32_t        bytes       = 0;
+
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    for (uint8_t k = 0; k < 3; k++){
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t n = 0; n < TEST_CALLS; n++){
+            if (0 == k){
+                test_log(LOG_LEVEL_INFO, n, "MQTT connected");
+            }
+            else if (1 == k){
+                test_log(LOG_LEVEL_WARN, n, "LED frame %lu late by %lu us (%d%%)", (unsigned long)n, 1200UL, 48);
+            }
+            else {
+                test_log(LOG_LEVEL_ERROR, n, "%s", text);
+            }
+        }
+        ns[k] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / TEST_CALLS;
+    }
+
+    tail = head;                                                                // drained up to here
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < TEST_CALLS; n++){
+        test_log(LOG_LEVEL_WARN, n, "LED frame %lu late by %lu us (%d%%)", (unsigned long)n, 1200UL, 48);
+        log_catchUp(TEST_RING, &tail, head, &dropped);
+        bytes += log_syslog(ring, TEST_RING, &tail, head, "eperly-lite", packet, sizeof(packet));
+        packets += 1;
+    }
+    syslogNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / TEST_CALLS;
+
+    snprintf(msg, sizeof(msg), "host log_write(): %s %.0f ns, %s %.0f ns, %s %.0f ns; with a syslog packet %.0f ns "
+             "(device cost at /stats logCyclesMax)", names[0], ns[0], names[1], ns[1], names[2], ns[2], syslogNs);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_EQUAL_UINT32(TEST_CALLS, packets);
+    TEST_ASSERT_GREATER_THAN(0, bytes);                                         // keeps the loop alive
+    TEST_ASSERT_EQUAL_UINT32(0, dropped);
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_format_stamp_tag_newline);
+    RUN_TEST(test_long_message_is_cut_before_the_newline);
+    RUN_TEST(test_ring_wraps_and_lapped_reader_counts_drops);
+    RUN_TEST(test_syslog_packets_carry_severity_and_host);
+    RUN_TEST(test_syslog_line_across_the_ring_end_and_cut);
+    RUN_TEST(test_benchmark_hot_path_log_cost);
+    return UNITY_END();
+}
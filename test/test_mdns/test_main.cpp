@@ -0,0 +1,297 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              mDNS answers, query matching, legacy replies (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "lamp_mdns.h"
+
+
+#define TEST_PACKET_MAX                 1024                                    // MDNS_PACKET_MAX
+#define TEST_LAMPS                      50
+#define TEST_HOST                       "eperly-lite-00a1b2"
+
+
+const char * const  text[]          = {"ver=1.2", "variant=nodemcuv2", "leds=8", "proto=1",
+                                       "features=frame,effect,rotate,audio,schedule,mqtt,trace,lcd,input"};
+uint8_t             answer[TEST_PACKET_MAX];
+uint16_t            answerLen;
+uint8_t             reply[TEST_PACKET_MAX];
+uint8_t             query[256];
+MdnsQuestion        question;
+
+
+typedef struct {
+    uint16_t        type;
+    uint16_t        rclass;
+    uint32_t        ttl;
+    char            name[MDNS_NAME_LEN];
+    char            target[MDNS_NAME_LEN];                                      // PTR/SRV
+    uint16_t        port;                                                       // SRV
+    uint8_t         ip[4];                                                      // A
+} Record;
+
+
+uint16_t build(uint8_t *buf, const char *host, uint8_t last){
+    MdnsService     service     = {host, {192, 168, 1, last}, 80, 4210, text, 5};
+
+    return mdns_build(buf, &service);
+}
+
+
+void setUp(void){
+    answerLen = build(answer, TEST_HOST, 42);
+    memset(reply, 0xEE, sizeof(reply));
+}
+
+
+void tearDown(void){
+}
+
+
+// query with one question per name, id 0x1234
+int makeQuery(const char * const *names, uint8_t count, uint16_t type, bool unicast){
+    int             pos         = MDNS_HEADER_SIZE;
+
+    memset(query, 0, MDNS_HEADER_SIZE);
+    query[0] = 0x12;
+    query[1] = 0x34;
+    query[5] = count;
+    for (uint8_t i = 0; i < count; i++){
+        pos = mdns_putName(query, pos, names[i]);
+        query[pos++] = type >> 8;
+        query[pos++] = type;
+        query[pos++] = unicast ? 0x80 : 0x00;
+        query[pos++] = 0x01;
+    }
+    return pos;
+}
+
+
+// walks the records after the questions the way a resolver does, 0 if malformed
+uint8_t parse(const uint8_t *buf, int len, Record *records, uint8_t max){
+    uint16_t        questions   = (buf[4] << 8) | buf[5];
+    uint16_t        count       = (buf[6] << 8) | buf[7];
+    int             pos         = MDNS_HEADER_SIZE;
+    char            name[MDNS_NAME_LEN];
+    uint16_t        rdlen;
+    uint8_t         n           = 0;
+
+    for (uint16_t q = 0; q < questions; q++){
+        pos = mdns_readName(buf, len, pos, name);
+        if (pos < 0){
+            return 0;
+        }
+        pos += 4;
+    }
+    for (uint16_t r = 0; (r < count) && (n < max); r++, n++){
+        Record      *rec        = &records[n];
+
+        memset(rec, 0, sizeof(*rec));
+        pos = mdns_readName(buf, len, pos, rec->name);
+        if ((pos < 0) || ((pos + 10) > len)){
+            return 0;
+        }
+        rec->type = (buf[pos] << 8) | buf[pos + 1];
+        rec->rclass = (buf[pos + 2] << 8) | buf[pos + 3];
+        rec->ttl = ((uint32_t)buf[pos + 4] << 24) | ((uint32_t)buf[pos + 5] << 16) | (buf[pos + 6] << 8) | buf[pos + 7];
+        rdlen = (buf[pos + 8] << 8) | buf[pos + 9];
+        pos += 10;
+        if ((pos + rdlen) > len){
+            return 0;
+        }
+        if ((MDNS_TYPE_PTR == rec->type) && ((pos + rdlen) != mdns_readName(buf, len, pos, rec->target))){
+            return 0;
+        }
+        if (MDNS_TYPE_SRV == rec->type){
+            rec->port = (buf[pos + 4] << 8) | buf[pos + 5];
+            if ((pos + rdlen) != mdns_readName(buf, len, pos + 6, rec->target)){
+                return 0;
+            }
+        }
+        if (MDNS_TYPE_A == rec->type){
+            memcpy(rec->ip, buf + pos, 4);
+        }
+        pos += rdlen;
+    }
+    return (len == pos) ? n : 0;
+}
+
+
+void test_answer_records(void){
+    Record          records[9];
+
+    TEST_ASSERT_EQUAL_UINT8(9, parse(answer, answerLen, records, 9));
+    TEST_ASSERT_EQUAL_HEX8(0x84, answer[2]);
+    TEST_ASSERT_EQUAL_UINT16(MDNS_TYPE_A, records[0].type);
+    TEST_ASSERT_EQUAL_STRING(TEST_HOST ".local", records[0].name);
+    TEST_ASSERT_EQUAL_UINT8(42, records[0].ip[3]);
+    TEST_ASSERT_EQUAL_HEX16(MDNS_CLASS_FLUSH | MDNS_CLASS_IN, records[0].rclass);
+    TEST_ASSERT_EQUAL_UINT32(MDNS_TTL_HOST, records[0].ttl);
+    TEST_ASSERT_EQUAL_STRING(TEST_HOST "._eperly._udp.local", records[6].target);
+    TEST_ASSERT_EQUAL_HEX16(MDNS_CLASS_IN, records[6].rclass);                 // shared PTR, no cache-flush
+    TEST_ASSERT_EQUAL_UINT16(4210, records[7].port);
+    TEST_ASSERT_EQUAL_STRING(TEST_HOST ".local", records[7].target);
+    TEST_ASSERT_EQUAL_UINT16(MDNS_TYPE_TXT, records[8].type);
+}
+
+
+void test_queries_for_us_match(void){
+    const char * const  service[]   = {"_eperly._udp.local"};
+    const char * const  host[]      = {"EPERLY-lite-00A1B2.local"};
+    const char * const  other[]     = {"eperly-lite-ffffff.local", "_ipp._tcp.local"};
+    int                 len;
+
+    len = makeQuery(service, 1, MDNS_TYPE_PTR, true);
+    TEST_ASSERT_TRUE(mdns_matches(query, len, TEST_HOST, &question));
+    TEST_ASSERT_EQUAL_STRING("_eperly._udp.local", question.name);
+    TEST_ASSERT_EQUAL_UINT16(MDNS_TYPE_PTR, question.type);
+    TEST_ASSERT_EQUAL_HEX16(MDNS_CLASS_IN, question.qclass);                   // QU bit stripped
+    len = makeQuery(host, 1, MDNS_TYPE_A, false);
+    TEST_ASSERT_TRUE(mdns_matches(query, len, TEST_HOST, &question));
+    len = makeQuery(other, 2, MDNS_TYPE_A, false);
+    TEST_ASSERT_FALSE(mdns_matches(query, len, TEST_HOST, &question));
+    len = makeQuery(service, 1, MDNS_TYPE_PTR, false);
+    query[2] = 0x84;                                                            // another responder's answer
+    TEST_ASSERT_FALSE(mdns_matches(query, len, TEST_HOST, &question));
+}
+
+
+void test_compressed_and_malformed_questions(void){
+    const char * const  first[]     = {"_ipp._tcp.local"};
+    int                 len         = makeQuery(first, 1, MDNS_TYPE_PTR, false);
+
+    // second question "_eperly._udp" + pointer to "local" at offset 22
+    query[5] = 2;
+    query[len++] = 7;
+    memcpy(query + len, "_eperly", 7);
+    len += 7;
+    query[len++] = 4;
+    memcpy(query + len, "_udp", 4);
+    len += 4;
+    query[len++] = 0xC0;
+    query[len++] = MDNS_HEADER_SIZE + 10;
+    query[len++] = 0;
+    query[len++] = MDNS_TYPE_PTR;
+    query[len++] = 0;
+    query[len++] = 1;
+    TEST_ASSERT_TRUE(mdns_matches(query, len, TEST_HOST, &question));
+    TEST_ASSERT_EQUAL_STRING("_eperly._udp.local", question.name);
+    TEST_ASSERT_FALSE(mdns_matches(query, len - 1, TEST_HOST, &question));     // class cut off
+    query[len - 6] = 0xC0;                                                      // pointer to itself
+    query[len - 5] = len - 6;
+    TEST_ASSERT_FALSE(mdns_matches(query, len, TEST_HOST, &question));
+}
+
+
+void test_legacy_reply(void){
+    const char * const  service[]   = {"_eperly._udp.local"};
+    Record              plain[9];
+    Record              legacy[9];
+    char                name[MDNS_NAME_LEN];
+    uint16_t            len;
+
+    TEST_ASSERT_TRUE(mdns_matches(query, makeQuery(service, 1, MDNS_TYPE_PTR, false), TEST_HOST, &question));
+    len = mdns_legacyReply(reply, sizeof(reply), query, &question, answer, answerLen);
+    TEST_ASSERT_EQUAL_UINT16(answerLen + strlen("_eperly._udp.local") + 6, len);
+    TEST_ASSERT_EQUAL_HEX8(0x12, reply[0]);                                     // id echoed
+    TEST_ASSERT_EQUAL_HEX8(0x34, reply[1]);
+    TEST_ASSERT_EQUAL_HEX8(0x84, reply[2]);
+    TEST_ASSERT_EQUAL_UINT8(1, reply[5]);                                       // the question is repeated
+    TEST_ASSERT_EQUAL_INT(MDNS_HEADER_SIZE + 20, mdns_readName(reply, len, MDNS_HEADER_SIZE, name));
+    TEST_ASSERT_EQUAL_STRING("_eperly._udp.local", name);
+    TEST_ASSERT_EQUAL_UINT8(9, parse(reply, len, legacy, 9));
+    TEST_ASSERT_EQUAL_UINT8(9, parse(answer, answerLen, plain, 9));
+    for (uint8_t i = 0; i < 9; i++){
+        TEST_ASSERT_EQUAL_HEX16(MDNS_CLASS_IN, legacy[i].rclass);              // no cache-flush bits
+        TEST_ASSERT_TRUE(legacy[i].ttl <= MDNS_TTL_LEGACY);
+        TEST_ASSERT_EQUAL_UINT16(plain[i].type, legacy[i].type);
+        TEST_ASSERT_EQUAL_STRING(plain[i].name, legacy[i].name);
+        TEST_ASSERT_EQUAL_STRING(plain[i].target, legacy[i].target);
+    }
+    TEST_ASSERT_EQUAL_UINT16(0, mdns_legacyReply(reply, len - 1, query, &question, answer, answerLen));
+}
+
+
+void test_longest_host_fits(void){
+    char                host[32];
+    char                name[MDNS_NAME_LEN];
+    const char * const  names[]     = {name};
+    uint16_t            len;
+
+    memset(host, 'x', sizeof(host) - 1);                                        // mdnsHost[32]
+    host[sizeof(host) - 1] = '\0';
+    answerLen = build(answer, host, 1);
+    snprintf(name, sizeof(name), "%s._eperly._udp.local", host);
+    TEST_ASSERT_TRUE(mdns_matches(query, makeQuery(names, 1, MDNS_TYPE_SRV, false), host, &question));
+    len = mdns_legacyReply(reply, sizeof(reply), query, &question, answer, answerLen);
+    TEST_ASSERT_NOT_EQUAL(0, len);
+    TEST_ASSERT_TRUE(len <= TEST_PACKET_MAX);
+}
+
+
+void test_benchmark_discovery(void){
+    const char * const  service[]   = {"_eperly._udp.local"};
+    static uint8_t      answers[TEST_LAMPS][TEST_PACKET_MAX];
+    uint16_t            lens[TEST_LAMPS];
+    char                hosts[TEST_LAMPS][32];
+    Record              records[9];
+    uint8_t             seen[TEST_LAMPS];
+    uint32_t            bytes       = 0;
+    const int           rounds      = 200;
+    int                 queryLen;
+    uint8_t             found;
+    uint16_t            len;
+    char                msg[128];
+    double              ns;
+
+    for (uint8_t i = 0; i < TEST_LAMPS; i++){
+        snprintf(hosts[i], sizeof(hosts[i]), "eperly-lite-%06x", 0x100000 + i * 7919);
+        lens[i] = build(answers[i], hosts[i], 10 + i);
+    }
+    queryLen = makeQuery(service, 1, MDNS_TYPE_PTR, false);
+    // one browse: every lamp matches the query and answers (legacy unicast
+    // on odd rounds), the browser resolves PTR -> SRV port -> A address
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++){
+        memset(seen, 0, sizeof(seen));
+        found = 0;
+        for (uint8_t i = 0; i < TEST_LAMPS; i++){
+            const uint8_t   *packet = answers[i];
+
+            if (!mdns_matches(query, queryLen, hosts[i], &question)){
+                continue;
+            }
+            len = lens[i];
+            if (round & 1){
+                len = mdns_legacyReply(reply, sizeof(reply), query, &question, answers[i], lens[i]);
+                packet = reply;
+            }
+            bytes += len;
+            if ((9 == parse(packet, len, records, 9)) && (MDNS_TYPE_PTR == records[6].type) && (4210 == records[7].port) && (MDNS_TYPE_A == records[0].type) &&
+                !seen[records[0].ip[3] - 10]){
+                seen[records[0].ip[3] - 10] = 1;
+                found += 1;
+            }
+        }
+        TEST_ASSERT_EQUAL_UINT8(TEST_LAMPS, found);
+    }
+    ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    snprintf(msg, sizeof(msg), "host mDNS discovery of %d lamps: %.1f us per browse, %.0f ns per lamp, %lu bytes answered",
+             TEST_LAMPS, ns / rounds / 1000.0, ns / rounds / TEST_LAMPS, (unsigned long)(bytes / rounds));
+    TEST_MESSAGE(msg);
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_answer_records);
+    RUN_TEST(test_queries_for_us_match);
+    RUN_TEST(test_compressed_and_malformed_questions);
+    RUN_TEST(test_legacy_reply);
+    RUN_TEST(test_longest_host_fits);
+    RUN_TEST(test_benchmark_discovery);
+    return UNITY_END();
+}
@@ -0,0 +1,96 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              Calibration curve, brightness and dithering (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include "lamp_mix.h"
+
+
+uint16_t            linear[MIX_CURVE_POINTS];
+uint16_t            gamma2[MIX_CURVE_POINTS];                                   // squared, as set with /cal/curve?gamma=2
+
+
+void setUp(void){
+    for (uint8_t k = 0; k < MIX_CURVE_POINTS; k++){
+        linear[k] = (65535UL * k) / (MIX_CURVE_POINTS - 1);
+        gamma2[k] = (65535UL * k * k) / ((MIX_CURVE_POINTS - 1) * (MIX_CURVE_POINTS - 1));
+    }
+}
+
+
+void tearDown(void){
+}
+
+
+void test_curve_points_are_exact(void){
+    for (uint8_t k = 0; k < (MIX_CURVE_POINTS - 1); k++){                      // full scale is 0xFFFF / 0x10000
+        TEST_ASSERT_UINT32_WITHIN(1, gamma2[k], mix_level(k << 4, gamma2, 0xFFFF));
+        TEST_ASSERT_UINT32_WITHIN(1, gamma2[k] / 2, mix_level(k << 4, gamma2, 0x8000));
+    }
+}
+
+
+void test_curve_is_interpolated(void){
+    TEST_ASSERT_EQUAL_UINT16(0, mix_level(0, linear, 0xFFFF));
+    TEST_ASSERT_EQUAL_UINT16(65278, mix_level(255, linear, 0xFFFF));            // 15/16 of the way to the last point
+    TEST_ASSERT_UINT32_WITHIN(1, (gamma2[1] + gamma2[2]) / 2, mix_level(24, gamma2, 0xFFFF));
+    for (uint16_t color = 1; color < 256; color++){                             // monotonic curve in, monotonic level out
+        TEST_ASSERT_LESS_OR_EQUAL(mix_level(color, gamma2, 0xFFFF), mix_level(color - 1, gamma2, 0xFFFF));
+    }
+}
+
+
+void test_scale_is_applied(void){
+    TEST_ASSERT_EQUAL_UINT16(0, mix_level(200, linear, 0));
+    TEST_ASSERT_UINT32_WITHIN(1, mix_level(200, linear, 0xFFFF) / 2, mix_level(200, linear, 0x8000));
+}
+
+
+void test_dither_average_matches_level(void){
+    const uint16_t  levels[]    = {0, 1, 0x40, 0x80, 0xFF, 0x100, 0x1234, 0x8000, 0xFF00};     // up to 255 * 256, above it saturates
+    uint32_t        sum;
+    uint8_t         err;
+
+    for (uint8_t n = 0; n < (sizeof(levels) / sizeof(levels[0])); n++){
+        err = 0;
+        sum = 0;
+        for (uint16_t f = 0; f < 256; f++){
+            sum += mix_dither(levels[n], &err);
+        }
+        TEST_ASSERT_UINT32_WITHIN(1, levels[n], sum);                           // 256 frames, 8-bit out: sum = level
+    }
+}
+
+
+void test_dither_lights_sub_lsb_levels(void){
+    uint8_t         err         = 0;
+    uint8_t         lit         = 0;
+
+    for (uint8_t f = 0; f < 16; f++){                                           // a quarter LSB: one frame in four is on
+        lit += mix_dither(0x40, &err);
+    }
+    TEST_ASSERT_EQUAL_UINT8(4, lit);
+}
+
+
+void test_dither_saturates_at_full_scale(void){
+    uint16_t        level       = mix_level(255, gamma2, 0xFFFF);
+    uint8_t         err         = 0;
+
+    for (uint16_t f = 0; f < 1000; f++){                                        // 255 + carry must not wrap to off
+        TEST_ASSERT_GREATER_THAN(0, mix_dither(level, &err));
+        TEST_ASSERT_EQUAL_UINT8(255, mix_dither(0xFFFE, &err));
+    }
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_curve_points_are_exact);
+    RUN_TEST(test_curve_is_interpolated);
+    RUN_TEST(test_scale_is_applied);
+    RUN_TEST(test_dither_average_matches_level);
+    RUN_TEST(test_dither_lights_sub_lsb_levels);
+    RUN_TEST(test_dither_saturates_at_full_scale);
+    return UNITY_END();
+}
@@ -0,0 +1,129 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              MQTT packet encoding and parsing (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include <string.h>
+#include "lamp_mqtt.h"
+
+
+uint8_t             buf[512];
+char                topic[64];
+char                payload[32];
+
+
+void setUp(void){
+    memset(buf, 0xEE, sizeof(buf));
+    memset(topic, 0, sizeof(topic));
+    memset(payload, 0, sizeof(payload));
+}
+
+
+void tearDown(void){
+}
+
+
+void test_connect_packet_matches_spec(void){
+    // CONNECT as captured from the lamp: MQTT 3.1.1, clean session, retained will "offline"
+    const uint8_t   expected[]  = {
+        0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x26, 0x00, 0x1E,
+        0x00, 0x0D, 'e', 'p', 'e', 'r', 'l', 'y', '-', '0', '0', 'a', '1', 'b', '2',
+        0x00, 0x14, 'e', 'p', 'e', 'r', 'l', 'y', '/', '0', '0', 'a', '1', 'b', '2', '/', 's', 't', 'a', 't', 'u', 's',
+        0x00, 0x07, 'o', 'f', 'f', 'l', 'i', 'n', 'e',
+    };
+    uint16_t        len         = mqtt_connectBody(buf, "eperly-00a1b2", "eperly/00a1b2/status", "offline", 30);
+
+    TEST_ASSERT_EQUAL_UINT16(sizeof(expected), len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, buf, len);
+}
+
+
+void test_subscribe_packet(void){
+    const uint8_t   expected[]  = {0x00, 0x01, 0x00, 0x05, 'a', '/', 's', 'e', 't', 0x00};
+
+    TEST_ASSERT_EQUAL_UINT16(sizeof(expected), mqtt_subscribeBody(buf, 1, "a/set"));
+    TEST_ASSERT_EQUAL_MEMORY(expected, buf, sizeof(expected));
+}
+
+
+void test_header_length_round_trip(void){
+    const uint16_t  lengths[]   = {0, 1, 127, 128, 200, 16383};
+    uint32_t        remaining;
+    uint8_t         n;
+
+    for (uint8_t k = 0; k < (sizeof(lengths) / sizeof(lengths[0])); k++){
+        n = mqtt_putHeader(buf, 0x30, lengths[k]);
+        TEST_ASSERT_EQUAL_UINT8((lengths[k] > 127) ? 3 : 2, n);
+        TEST_ASSERT_EQUAL_UINT8(0x30, buf[0]);
+        TEST_ASSERT_EQUAL_INT(n, mqtt_frame(buf, n, &remaining));
+        TEST_ASSERT_EQUAL_UINT32(lengths[k], remaining);
+    }
+}
+
+
+void test_frame_waits_for_length_bytes(void){
+    const uint8_t   split[]     = {0x30, 0xC8, 0x01};                           // 200, the second byte not arrived yet
+    const uint8_t   huge[]      = {0x30, 0xFF, 0xFF, 0xFF, 0x7F};               // 268435455, largest legal length
+    const uint8_t   bad[]       = {0x30, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    uint32_t        remaining;
+
+    TEST_ASSERT_EQUAL_INT(MQTT_FRAME_PARTIAL, mqtt_frame(split, 1, &remaining));
+    TEST_ASSERT_EQUAL_INT(MQTT_FRAME_PARTIAL, mqtt_frame(split, 2, &remaining));
+    TEST_ASSERT_EQUAL_INT(3, mqtt_frame(split, 3, &remaining));
+    TEST_ASSERT_EQUAL_UINT32(200, remaining);
+    TEST_ASSERT_EQUAL_INT(5, mqtt_frame(huge, sizeof(huge), &remaining));
+    TEST_ASSERT_EQUAL_UINT32(268435455UL, remaining);
+    TEST_ASSERT_EQUAL_INT(MQTT_FRAME_BAD, mqtt_frame(bad, sizeof(bad), &remaining));
+}
+
+
+void test_publish_round_trip(void){
+    uint16_t        len         = mqtt_publishBody(buf, sizeof(buf), "eperly/00a1b2/set/color", "#FF9329");
+
+    TEST_ASSERT_EQUAL_UINT16(2 + 23 + 7, len);
+    TEST_ASSERT_TRUE(mqtt_parsePublish(0x30, buf, len, topic, sizeof(topic), payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL_STRING("eperly/00a1b2/set/color", topic);
+    TEST_ASSERT_EQUAL_STRING("#FF9329", payload);
+    TEST_ASSERT_EQUAL_UINT16(0, mqtt_publishBody(buf, len - 1, "eperly/00a1b2/set/color", "#FF9329"));
+}
+
+
+void test_publish_with_packet_id(void){
+    // QoS 1 delivery: topic, packet id, payload
+    const uint8_t   qos1[]      = {0x00, 0x03, 'a', '/', 'b', 0x12, 0x34, 'O', 'N'};
+
+    TEST_ASSERT_TRUE(mqtt_parsePublish(0x32, qos1, sizeof(qos1), topic, sizeof(topic), payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL_STRING("a/b", topic);
+    TEST_ASSERT_EQUAL_STRING("ON", payload);
+}
+
+
+void test_malformed_publish_is_dropped(void){
+    const uint8_t   shortTopic[]    = {0x00, 0x09, 'a', '/', 'b'};              // topic runs past the packet
+    const uint8_t   noId[]          = {0x00, 0x03, 'a', '/', 'b', 0x12};        // QoS 1 without a full packet id
+    const uint8_t   good[]          = {0x00, 0x03, 'a', '/', 'b', 'O', 'N'};
+    uint8_t         longPayload[64];
+
+    TEST_ASSERT_FALSE(mqtt_parsePublish(0x30, shortTopic, 1, topic, sizeof(topic), payload, sizeof(payload)));
+    TEST_ASSERT_FALSE(mqtt_parsePublish(0x30, shortTopic, sizeof(shortTopic), topic, sizeof(topic), payload, sizeof(payload)));
+    TEST_ASSERT_FALSE(mqtt_parsePublish(0x32, noId, sizeof(noId), topic, sizeof(topic), payload, sizeof(payload)));
+    TEST_ASSERT_FALSE(mqtt_parsePublish(0x30, good, sizeof(good), topic, 3, payload, sizeof(payload)));    // no room for the NUL
+    TEST_ASSERT_FALSE(mqtt_parsePublish(0x30, good, sizeof(good), topic, sizeof(topic), payload, 2));
+    memset(longPayload, 'x', sizeof(longPayload));
+    longPayload[0] = 0x00;
+    longPayload[1] = 0x01;
+    TEST_ASSERT_FALSE(mqtt_parsePublish(0x30, longPayload, sizeof(longPayload), topic, sizeof(topic), payload, sizeof(payload)));
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_connect_packet_matches_spec);
+    RUN_TEST(test_subscribe_packet);
+    RUN_TEST(test_header_length_round_trip);
+    RUN_TEST(test_frame_waits_for_length_bytes);
+    RUN_TEST(test_publish_round_trip);
+    RUN_TEST(test_publish_with_packet_id);
+    RUN_TEST(test_malformed_publish_is_dropped);
+    return UNITY_END();
+}
@@ -0,0 +1,686 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              MQTT session against a broker stand-in, 50 lamps (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lamp_mqtt.h"
+
+
+#define TEST_LAMPS                      50
+#define TEST_CONTROLLER                 TEST_LAMPS                              // link index of the publishing controller
+#define TEST_LINKS                      (TEST_LAMPS + 1)
+#define TEST_FRAME                      2500                                    // (us) LED_REFRESH_PERIOD, network task too
+#define TEST_STEP                       100                                     // (us) simulation resolution
+#define TEST_LINK_DELAY                 2000                                    // (us) one way, WiFi + broker host
+#define TEST_LINK_JITTER                3000                                    // (us) added on top, order kept as TCP does
+#define TEST_SEGMENTS                   256                                     // writes in flight per direction
+#define TEST_SEGMENT_SIZE               (MQTT_BUF_SIZE + MQTT_HEADER_MAX)
+#define TEST_RETAINED                   256
+#define TEST_PENDING                    8                                       // commands applied between two frames
+#define TEST_COMMAND_PERIOD             10000                                   // (us) brightness to one lamp, 100/s
+#define TEST_SCENE_PERIOD               2000000                                 // (us) color to every lamp at once
+#define TEST_WARMUP                     1000000                                 // (us) connect and subscribe
+#define TEST_SECONDS                    20
+#define TEST_SAMPLES                    4096
+
+
+typedef struct {
+    uint64_t        at;                                                         // (us) arrives at the other end
+    uint16_t        len;
+    uint16_t        pos;                                                        // read so far
+    uint8_t         data[TEST_SEGMENT_SIZE];
+} Segment;
+
+
+typedef struct {
+    Segment         segments[TEST_SEGMENTS];
+    uint16_t        head;
+    uint16_t        count;
+} Pipe;
+
+
+typedef struct {
+    Pipe            up;                                                         // client to broker
+    Pipe            down;                                                       // broker to client
+    bool            open;
+} Link;
+
+
+typedef struct {
+    bool            connected;
+    char            filter[MQTT_TOPIC_LEN + 8];
+    char            willTopic[MQTT_TOPIC_LEN + 8];
+    char            willMessage[16];
+    uint8_t         buf[MQTT_BUF_SIZE];
+    uint16_t        bufLen;
+    unsigned long   statePublishes;
+} BrokerClient;
+
+
+typedef struct {
+    char            topic[MQTT_TOPIC_LEN + 16];
+    char            payload[MQTT_STATE_LEN];
+} Retained;
+
+
+typedef struct {
+    MqttSession     session;
+    uint8_t         index;
+    uint64_t        openAt;                                                     // (us) TCP handshake done
+    uint64_t        connectAt;                                                  // (us) last CONNECT sent
+    uint8_t         brightness;
+    uint32_t        color;
+    uint64_t        issued[256];                                                // (us) brightness value -> sent
+    uint64_t        sceneIssued;                                                // (us)
+    uint64_t        pending[TEST_PENDING];                                      // issue stamps shown by the next frame
+    uint8_t         pendingCount;
+} Lamp;
+
+
+typedef struct {
+    unsigned long   packetsIn;
+    unsigned long   packetsOut;
+    unsigned long   publishIn;
+    unsigned long   publishOut;
+} BrokerStats;
+
+
+Link                links[TEST_LINKS];
+BrokerClient        clients[TEST_LINKS];
+Retained            retained[TEST_RETAINED];
+uint16_t            retainedCount;
+BrokerStats         broker;
+bool                brokerUp;
+bool                brokerMute;                                                 // accepts TCP, never answers
+Lamp                lamps[TEST_LAMPS];
+uint64_t            simNow;                                                     // (us)
+uint32_t            simRandom;
+uint64_t            samples[TEST_SAMPLES];                                      // (us) command to light
+uint32_t            sampleCount;
+unsigned long       commandsSent;
+unsigned long       commandsApplied;
+
+
+uint32_t sim_random(void){
+    simRandom = simRandom * 1664525UL + 1013904223UL;                           // LCG, same run every time
+    return simRandom >> 8;
+}
+
+
+void pipe_write(Pipe *pipe, const uint8_t *data, uint16_t len){
+    uint64_t        at          = simNow + TEST_LINK_DELAY + (sim_random() % TEST_LINK_JITTER);
+    Segment         *last;
+    Segment         *seg;
+
+    if (pipe->count > 0){
+        last = &pipe->segments[(pipe->head + pipe->count - 1) % TEST_SEGMENTS];
+        if (at < last->at){                                                     // a stream never reorders
+            at = last->at;
+        }
+    }
+    if ((pipe->count >= TEST_SEGMENTS) || (len > TEST_SEGMENT_SIZE)){
+        return;                                                                 // caught by the applied count
+    }
+    seg = &pipe->segments[(pipe->head + pipe->count) % TEST_SEGMENTS];
+    seg->at = at;
+    seg->len = len;
+    seg->pos = 0;
+    memcpy(seg->data, data, len);
+    pipe->count += 1;
+}
+
+
+uint16_t pipe_read(Pipe *pipe, uint8_t *buf, uint16_t size){
+    uint16_t        len         = 0;
+    uint16_t        n;
+    Segment         *seg;
+
+    while ((pipe->count > 0) && (len < size)){
+        seg = &pipe->segments[pipe->head];
+        if (seg->at > simNow){
+            break;
+        }
+        n = seg->len - seg->pos;
+        if (n > (size - len)){
+            n = size - len;
+        }
+        memcpy(buf + len, seg->data + seg->pos, n);
+        seg->pos += n;
+        len += n;
+        if (seg->pos == seg->len){
+            pipe->head = (pipe->head + 1) % TEST_SEGMENTS;
+            pipe->count -= 1;
+        }
+    }
+    return len;
+}
+
+
+bool topic_matches(const char *filter, const char *topic){
+    while (('\0' != *filter) && ('\0' != *topic)){
+        if ('#' == *filter){
+            return true;
+        }
+        if ('+' == *filter){
+            while (('\0' != *topic) && ('/' != *topic)){
+                topic += 1;
+            }
+            filter += 1;
+            continue;
+        }
+        if (*filter != *topic){
+            return false;
+        }
+        filter += 1;
+        topic += 1;
+    }
+    return *filter == *topic;
+}
+
+
+// ---------------------------------------------------------------------------
+// Broker stand-in: CONNECT, SUBSCRIBE with +/# filters, QoS 0 PUBLISH routing,
+// retained messages, last wills and PINGREQ, as far as the lamp uses them
+// ---------------------------------------------------------------------------
+void broker_send(uint8_t index, uint8_t header, const uint8_t *body, uint16_t len){
+    uint8_t         packet[TEST_SEGMENT_SIZE];
+    uint8_t         n           = mqtt_putHeader(packet, header, len);
+
+    memcpy(packet + n, body, len);
+    pipe_write(&links[index].down, packet, n + len);
+    broker.packetsOut += 1;
+}
+
+
+void broker_forward(const char *topic, const char *payload){
+    uint8_t         body[MQTT_BUF_SIZE];
+    uint16_t        len         = mqtt_publishBody(body, sizeof(body), topic, payload);
+
+    for (uint8_t k = 0; k < TEST_LINKS; k++){
+        if (clients[k].connected && ('\0' != clients[k].filter[0]) && topic_matches(clients[k].filter, topic)){
+            broker_send(k, 0x30, body, len);
+            broker.publishOut += 1;
+        }
+    }
+}
+
+
+void broker_retain(const char *topic, const char *payload){
+    uint16_t        k;
+
+    for (k = 0; k < retainedCount; k++){
+        if (0 == strcmp(retained[k].topic, topic)){
+            break;
+        }
+    }
+    if (k == retainedCount){
+        if (retainedCount >= TEST_RETAINED){
+            return;
+        }
+        retainedCount += 1;
+    }
+    snprintf(retained[k].topic, sizeof(retained[k].topic), "%s", topic);
+    snprintf(retained[k].payload, sizeof(retained[k].payload), "%s", payload);
+}
+
+
+const char *broker_retained(const char *topic){
+    for (uint16_t k = 0; k < retainedCount; k++){
+        if (0 == strcmp(retained[k].topic, topic)){
+            return retained[k].payload;
+        }
+    }
+    return NULL;
+}
+
+
+uint16_t broker_string(const uint8_t *data, uint16_t pos, char *out, uint16_t size){
+    uint16_t        len         = (data[pos] << 8) | data[pos + 1];
+
+    snprintf(out, size, "%.*s", (int)len, (const char *)data + pos + 2);
+    return pos + 2 + len;
+}
+
+
+void broker_handle(uint8_t index, uint8_t header, const uint8_t *data, uint16_t len){
+    const uint8_t   connack[]   = {0x00, 0x00};
+    const uint8_t   pingresp[]  = {0};
+    BrokerClient    *client     = &clients[index];
+    char            clientId[32];
+    char            topic[MQTT_TOPIC_LEN + 16];
+    char            payload[MQTT_STATE_LEN];
+    uint8_t         suback[3];
+    uint16_t        pos;
+
+    broker.packetsIn += 1;
+    switch (header & 0xF0){
+        case 0x10:                                                              // CONNECT, flags as the lamp sends them
+            pos = broker_string(data, 0, clientId, sizeof(clientId)) + 4;
+            pos = broker_string(data, pos, clientId, sizeof(clientId));
+            pos = broker_string(data, pos, client->willTopic, sizeof(client->willTopic));
+            broker_string(data, pos, client->willMessage, sizeof(client->willMessage));
+            client->connected = true;
+            broker_send(index, 0x20, connack, sizeof(connack));
+            break;
+
+        case 0x80:                                                              // SUBSCRIBE, one filter
+            broker_string(data, 2, client->filter, sizeof(client->filter));
+            suback[0] = data[0];
+            suback[1] = data[1];
+            suback[2] = 0x00;
+            broker_send(index, 0x90, suback, sizeof(suback));
+            for (uint16_t k = 0; k < retainedCount; k++){
+                if (topic_matches(client->filter, retained[k].topic)){
+                    broker_forward(retained[k].topic, retained[k].payload);
+                }
+            }
+            break;
+
+        case 0x30:
+            if (!mqtt_parsePublish(header, data, len, topic, sizeof(topic), payload, sizeof(payload))){
+                break;
+            }
+            broker.publishIn += 1;
+            if (NULL != strstr(topic, "/state")){
+                client->statePublishes += 1;
+            }
+            if (header & 0x01){
+                broker_retain(topic, payload);
+            }
+            broker_forward(topic, payload);
+            break;
+
+        case 0xC0:                                                              // PINGREQ
+            broker_send(index, 0xD0, pingresp, 0);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+void broker_run(void){
+    BrokerClient    *client;
+    uint32_t        remaining;
+    int             pos;
+
+    for (uint8_t k = 0; k < TEST_LINKS; k++){
+        client = &clients[k];
+        if (!links[k].open){
+            if (client->connected){                                             // dropped without DISCONNECT
+                client->connected = false;
+                broker_retain(client->willTopic, client->willMessage);
+                broker_forward(client->willTopic, client->willMessage);
+            }
+            continue;
+        }
+        client->bufLen += pipe_read(&links[k].up, client->buf + client->bufLen, MQTT_BUF_SIZE - client->bufLen);
+        if (brokerMute){
+            client->bufLen = 0;
+            continue;
+        }
+        while (client->bufLen >= 2){
+            pos = mqtt_frame(client->buf, client->bufLen, &remaining);
+            if ((pos <= 0) || ((pos + remaining) > client->bufLen)){
+                break;
+            }
+            broker_handle(k, client->buf[0], client->buf + pos, remaining);
+            client->bufLen -= pos + remaining;
+            memmove(client->buf, client->buf + pos + remaining, client->bufLen);
+        }
+    }
+}
+
+
+void broker_stop(void){
+    brokerUp = false;
+    for (uint8_t k = 0; k < TEST_LAMPS; k++){
+        links[k].open = false;
+        clients[k].connected = false;                                           // the broker itself went away
+        links[k].up.count = 0;
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+// Lamp: the firmware's mqtt_service() and task_led() on simulated time
+// ---------------------------------------------------------------------------
+bool lamp_write(void *ctx, const uint8_t *data, uint16_t len){
+    Lamp            *lamp       = (Lamp *)ctx;
+
+    if (!links[lamp->index].open){
+        return false;
+    }
+    pipe_write(&links[lamp->index].up, data, len);
+    return true;
+}
+
+
+void lamp_close(void *ctx){
+    links[((Lamp *)ctx)->index].open = false;
+}
+
+
+void lamp_command(void *ctx, const char *key, const char *payload){
+    Lamp            *lamp       = (Lamp *)ctx;
+    uint64_t        issued;
+
+    if (0 == strcmp(key, "brightness")){
+        lamp->brightness = atoi(payload);
+        issued = lamp->issued[lamp->brightness];
+    }
+    else if (0 == strcmp(key, "color")){
+        lamp->color = strtol(payload + (('#' == *payload) ? 1 : 0), NULL, 16);
+        issued = lamp->sceneIssued;
+    }
+    else {
+        return;
+    }
+    commandsApplied += 1;
+    if (lamp->pendingCount < TEST_PENDING){
+        lamp->pending[lamp->pendingCount++] = issued;
+    }
+}
+
+
+void lamp_init(Lamp *lamp, uint8_t index){
+    memset(lamp, 0, sizeof(*lamp));
+    lamp->index = index;
+    snprintf(lamp->session.base, sizeof(lamp->session.base), "eperly/%06x", 0xA10000 + index);
+    snprintf(lamp->session.clientId, sizeof(lamp->session.clientId), "eperly-%06x", 0xA10000 + index);
+    lamp->session.ctx = lamp;
+    lamp->session.write = lamp_write;
+    lamp->session.close = lamp_close;
+    lamp->session.command = lamp_command;
+    mqtt_start(&lamp->session, true, simNow / 1000);
+}
+
+
+void lamp_frame(Lamp *lamp){
+    // task_led() runs first: whatever the last network run applied shows now
+    for (uint8_t k = 0; (k < lamp->pendingCount) && (sampleCount < TEST_SAMPLES); k++){
+        samples[sampleCount++] = simNow - lamp->pending[k];
+    }
+    lamp->pendingCount = 0;
+}
+
+
+void lamp_service(Lamp *lamp){
+    MqttSession     *session    = &lamp->session;
+    Link            *link       = &links[lamp->index];
+    unsigned long   now         = simNow / 1000;
+    char            state[MQTT_STATE_LEN];
+
+    if (MQTT_BACKOFF == session->state){
+        if (mqtt_due(session, now)){
+            mqtt_opening(session, now);
+            lamp->openAt = simNow + (2 * TEST_LINK_DELAY);                      // SYN, SYN-ACK
+        }
+        return;
+    }
+    if (MQTT_CONNECTING == session->state){
+        if (simNow < lamp->openAt){
+            return;
+        }
+        if (!brokerUp){
+            mqtt_drop(session, now, "connection refused");
+            return;
+        }
+        memset(link, 0, sizeof(*link));
+        memset(&clients[lamp->index], 0, sizeof(clients[lamp->index]));
+        link->open = true;
+        lamp->connectAt = simNow;
+        mqtt_opened(session, now);
+        return;
+    }
+    if (!link->open && (0 == link->down.count)){
+        mqtt_drop(session, now, "connection lost");
+        return;
+    }
+    session->bufLen += pipe_read(&link->down, session->buf + session->bufLen, MQTT_BUF_SIZE - session->bufLen);
+    mqtt_process(session, now);
+    if (mqtt_poll(session, now)){
+        snprintf(state, sizeof(state), "{\"brightness\":%u,\"color\":\"%06X\"}", lamp->brightness,
+                 (unsigned int)lamp->color);
+        mqtt_publishState(session, state, now);
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+// Controller: home automation publishing commands through the broker
+// ---------------------------------------------------------------------------
+void controller_publish(uint8_t lamp, const char *key, const char *payload){
+    uint8_t         packet[TEST_SEGMENT_SIZE];
+    char            topic[MQTT_TOPIC_LEN + 16];
+    uint16_t        len;
+    uint8_t         n;
+
+    snprintf(topic, sizeof(topic), "%s/set/%s", lamps[lamp].session.base, key);
+    len = mqtt_publishBody(packet + MQTT_HEADER_MAX, sizeof(packet) - MQTT_HEADER_MAX, topic, payload);
+    n = mqtt_putHeader(packet, 0x30, len);
+    memmove(packet + n, packet + MQTT_HEADER_MAX, len);
+    pipe_write(&links[TEST_CONTROLLER].up, packet, n + len);
+    commandsSent += 1;
+}
+
+
+void controller_brightness(uint8_t lamp){
+    uint8_t         value       = 1 + (sim_random() % 255);
+    char            payload[8];
+
+    lamps[lamp].issued[value] = simNow;
+    snprintf(payload, sizeof(payload), "%u", value);
+    controller_publish(lamp, "brightness", payload);
+}
+
+
+void controller_scene(void){
+    uint32_t        color       = sim_random() & 0xFFFFFF;
+    char            payload[8];
+
+    snprintf(payload, sizeof(payload), "%06X", (unsigned int)color);
+    for (uint8_t k = 0; k < TEST_LAMPS; k++){
+        lamps[k].sceneIssued = simNow;
+        controller_publish(k, "color", payload);
+    }
+}
+
+
+void sim_run(uint8_t count, uint64_t until, bool commands){
+    for (; simNow < until; simNow += TEST_STEP){
+        broker_run();
+        for (uint8_t k = 0; k < count; k++){
+            if (0 == ((simNow + (k * TEST_STEP)) % TEST_FRAME)){                 // lamps are not in phase
+                lamp_frame(&lamps[k]);
+                lamp_service(&lamps[k]);
+            }
+        }
+        if (commands && (0 == (simNow % TEST_COMMAND_PERIOD))){
+            controller_brightness(sim_random() % count);
+        }
+        if (commands && (0 == (simNow % TEST_SCENE_PERIOD))){
+            controller_scene();
+        }
+    }
+}
+
+
+int compare_samples(const void *a, const void *b){
+    uint64_t        x           = *(const uint64_t *)a;
+    uint64_t        y           = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+void setUp(void){
+    memset(links, 0, sizeof(links));
+    memset(clients, 0, sizeof(clients));
+    memset(&broker, 0, sizeof(broker));
+    retainedCount = 0;
+    brokerUp = true;
+    brokerMute = false;
+    simNow = 0;
+    simRandom = 12345;
+    sampleCount = 0;
+    commandsSent = 0;
+    commandsApplied = 0;
+    links[TEST_CONTROLLER].open = true;
+    clients[TEST_CONTROLLER].connected = true;                                  // publishes only, no subscription
+    for (uint8_t k = 0; k < TEST_LAMPS; k++){
+        lamp_init(&lamps[k], k);
+    }
+}
+
+
+void tearDown(void){
+}
+
+
+void test_fifty_lamps_connect_and_subscribe(void){
+    char            filter[MQTT_TOPIC_LEN + 8];
+    char            topic[MQTT_TOPIC_LEN + 16];
+
+    sim_run(TEST_LAMPS, TEST_WARMUP, false);
+    for (uint8_t k = 0; k < TEST_LAMPS; k++){
+        TEST_ASSERT_EQUAL_INT(MQTT_CONNECTED, lamps[k].session.state);
+        TEST_ASSERT_EQUAL_UINT32(1, lamps[k].session.reconnects);
+        snprintf(filter, sizeof(filter), "%s/set/+", lamps[k].session.base);
+        TEST_ASSERT_EQUAL_STRING(filter, clients[k].filter);
+        snprintf(topic, sizeof(topic), "%s/status", lamps[k].session.base);
+        TEST_ASSERT_EQUAL_STRING("online", broker_retained(topic));
+        snprintf(topic, sizeof(topic), "%s/state", lamps[k].session.base);
+        TEST_ASSERT_EQUAL_STRING("{\"brightness\":0,\"color\":\"000000\"}", broker_retained(topic));
+    }
+}
+
+
+void test_command_to_light_latency_and_broker_rate(void){
+    uint64_t        start;
+    unsigned long   packets;
+    unsigned long   publishes;
+    unsigned long   perLamp;
+    uint64_t        p50;
+    uint64_t        p99;
+    char            msg[256];
+
+    sim_run(TEST_LAMPS, TEST_WARMUP, false);
+    start = simNow;
+    packets = broker.packetsIn + broker.packetsOut;
+    publishes = broker.publishIn + broker.publishOut;
+    sim_run(TEST_LAMPS, start + (TEST_SECONDS * 1000000ULL), true);
+    sim_run(TEST_LAMPS, simNow + 100000, false);                                // drain the last commands
+
+    TEST_ASSERT_EQUAL_UINT32(commandsSent, commandsApplied);                    // QoS 0 over TCP, nothing lost
+    TEST_ASSERT_EQUAL_UINT32(commandsSent, sampleCount);
+    qsort(samples, sampleCount, sizeof(samples[0]), compare_samples);
+    p50 = samples[sampleCount / 2];
+    p99 = samples[(sampleCount * 99) / 100];
+    packets = ((broker.packetsIn + broker.packetsOut) - packets) / TEST_SECONDS;
+    publishes = ((broker.publishIn + broker.publishOut) - publishes) / TEST_SECONDS;
+    snprintf(msg, sizeof(msg), "%u lamps, %u commands/s + a scene every %u ms: command to light p50 %lu us, "
+             "p99 %lu us, max %lu us; broker %lu msg/s (%lu PUBLISH/s)",
+             TEST_LAMPS, 1000000 / TEST_COMMAND_PERIOD, TEST_SCENE_PERIOD / 1000, (unsigned long)p50,
+             (unsigned long)p99, (unsigned long)samples[sampleCount - 1], packets, publishes);
+    TEST_MESSAGE(msg);
+
+    // two link hops, one network task period to pick it up, one LED frame to show it
+    TEST_ASSERT_LESS_THAN(2 * (TEST_LINK_DELAY + TEST_LINK_JITTER) + 2 * TEST_FRAME, p99);
+    for (uint8_t k = 0; k < TEST_LAMPS; k++){
+        perLamp = clients[k].statePublishes;                                    // coalesced to MQTT_PUBLISH_INTERVAL
+        TEST_ASSERT_LESS_OR_EQUAL((TEST_SECONDS * 1000UL / MQTT_PUBLISH_INTERVAL) + 12, perLamp);
+        TEST_ASSERT_EQUAL_INT(MQTT_CONNECTED, lamps[k].session.state);
+    }
+}
+
+
+void test_scene_burst_coalesces_state(void){
+    sim_run(TEST_LAMPS, TEST_WARMUP, false);
+    for (uint8_t k = 0; k < TEST_LAMPS; k++){
+        clients[k].statePublishes = 0;
+    }
+    for (uint8_t n = 0; n < 5; n++){                                            // five changes inside one interval
+        controller_brightness(7);
+        controller_scene();
+        sim_run(TEST_LAMPS, simNow + 10000, false);
+    }
+    sim_run(TEST_LAMPS, simNow + 500000, false);
+    TEST_ASSERT_EQUAL_UINT32(commandsSent, commandsApplied);
+    for (uint8_t k = 0; k < TEST_LAMPS; k++){
+        TEST_ASSERT_LESS_OR_EQUAL(2, clients[k].statePublishes);
+    }
+}
+
+
+void test_broker_restart_reconnects_with_backoff(void){
+    char            topic[MQTT_TOPIC_LEN + 16];
+    uint64_t        down;
+
+    sim_run(TEST_LAMPS, TEST_WARMUP, false);
+    down = simNow;
+    broker_stop();
+    sim_run(TEST_LAMPS, down + 500000, false);
+    for (uint8_t k = 0; k < TEST_LAMPS; k++){
+        TEST_ASSERT_EQUAL_INT(MQTT_BACKOFF, lamps[k].session.state);
+        TEST_ASSERT_EQUAL_UINT32(2 * MQTT_BACKOFF_MIN, lamps[k].session.backoff);
+        TEST_ASSERT_EQUAL_STRING("connection lost", lamps[k].session.error);
+    }
+    brokerUp = true;
+    sim_run(TEST_LAMPS, down + 3000000, false);
+    for (uint8_t k = 0; k < TEST_LAMPS; k++){
+        TEST_ASSERT_EQUAL_INT(MQTT_CONNECTED, lamps[k].session.state);
+        TEST_ASSERT_EQUAL_UINT32(2, lamps[k].session.reconnects);
+        TEST_ASSERT_EQUAL_UINT32(MQTT_BACKOFF_MIN, lamps[k].session.backoff);
+        TEST_ASSERT_GREATER_OR_EQUAL(down + (2 * MQTT_BACKOFF_MIN * 1000ULL), lamps[k].connectAt);
+        snprintf(topic, sizeof(topic), "%s/status", lamps[k].session.base);
+        TEST_ASSERT_EQUAL_STRING("online", broker_retained(topic));
+    }
+}
+
+
+void test_silent_broker_times_out(void){
+    unsigned long   packets;
+    uint64_t        start;
+
+    brokerMute = true;                                                          // TCP accepted, no CONNACK
+    sim_run(1, 5000000 + 100000, false);
+    TEST_ASSERT_EQUAL_INT(MQTT_BACKOFF, lamps[0].session.state);
+    TEST_ASSERT_EQUAL_STRING("broker did not answer CONNECT", lamps[0].session.error);
+    TEST_ASSERT_EQUAL_UINT32(MQTT_BACKOFF_MIN, lamps[0].session.backoff);
+    sim_run(1, simNow + 7000000, false);                                        // second CONNECT, times out again
+    TEST_ASSERT_EQUAL_UINT32(2 * MQTT_BACKOFF_MIN, lamps[0].session.backoff);
+
+    brokerMute = false;
+    sim_run(1, simNow + 3000000, false);
+    TEST_ASSERT_EQUAL_INT(MQTT_CONNECTED, lamps[0].session.state);
+    packets = broker.packetsIn;
+    sim_run(1, simNow + 60000000, false);                                       // idle: pings keep it up
+    TEST_ASSERT_EQUAL_INT(MQTT_CONNECTED, lamps[0].session.state);
+    TEST_ASSERT_GREATER_OR_EQUAL(3, broker.packetsIn - packets);                // PINGREQ every MQTT_KEEPALIVE / 2
+
+    brokerMute = true;
+    start = simNow;
+    while ((MQTT_CONNECTED == lamps[0].session.state) && ((simNow - start) < 60000000)){
+        sim_run(1, simNow + TEST_FRAME, false);
+    }
+    // the last PINGRESP is at most one ping interval old when the broker goes quiet
+    TEST_ASSERT_EQUAL_STRING("broker timed out", lamps[0].session.error);
+    TEST_ASSERT_GREATER_OR_EQUAL(MQTT_KEEPALIVE * 1000000ULL, simNow - start);
+    TEST_ASSERT_LESS_OR_EQUAL((MQTT_KEEPALIVE * 1500000ULL) + (2 * TEST_FRAME), simNow - start);
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_fifty_lamps_connect_and_subscribe);
+    RUN_TEST(test_command_to_light_latency_and_broker_rate);
+    RUN_TEST(test_scene_burst_coalesces_state);
+    RUN_TEST(test_broker_restart_reconnects_with_backoff);
+    RUN_TEST(test_silent_broker_times_out);
+    return UNITY_END();
+}
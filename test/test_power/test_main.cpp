@@ -0,0 +1,163 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              LED power model (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include <string.h>
+#include "lamp_power.h"
+
+
+#define TEST_LEDS                       8
+#define TEST_POINTS                     17
+#define TEST_FRAME_PERIOD               2500                                    // (us) LED_REFRESH_PERIOD
+
+
+// nodemcuv2 defaults: LED_POWER_BUDGET, LED_IDLE_CURRENT, LED_CHANNEL_CURRENT
+const PowerModel    model               = {TEST_LEDS, 400, 1, 20};
+
+// profile 0: factory table (TypicalSMD5050 gains), profile 1: every gain at 255
+uint16_t            curves[2][3][TEST_POINTS];
+uint8_t             factory[TEST_LEDS]  = {0, 0, 0, 0, 0, 0, 0, 0};
+uint8_t             hot[TEST_LEDS]      = {1, 1, 1, 1, 1, 1, 1, 1};
+
+// frames recorded from the 8 LED ring (/frame uploads and STATIC colors)
+const uint8_t       frameWarm[TEST_LEDS][3]     = {
+    {255, 147, 41}, {255, 147, 41}, {255, 147, 41}, {255, 147, 41},
+    {255, 147, 41}, {255, 147, 41}, {255, 147, 41}, {255, 147, 41},
+};
+const uint8_t       frameRainbow[TEST_LEDS][3]  = {
+    {255, 0, 0}, {255, 191, 0}, {128, 255, 0}, {0, 255, 64},
+    {0, 255, 255}, {0, 64, 255}, {128, 0, 255}, {255, 0, 191},
+};
+const uint8_t       frameRed[TEST_LEDS][3]      = {{255, 0, 0}};
+const uint8_t       frameBlack[TEST_LEDS][3]    = {{0, 0, 0}};
+const uint8_t       frameWhite[TEST_LEDS][3]    = {
+    {255, 255, 255}, {255, 255, 255}, {255, 255, 255}, {255, 255, 255},
+    {255, 255, 255}, {255, 255, 255}, {255, 255, 255}, {255, 255, 255},
+};
+
+
+void setUp(void){
+    const uint16_t  peaks[2][3] = {{65535, 45312, 61695}, {65535, 65535, 65535}};
+
+    for (uint8_t p = 0; p < 2; p++){
+        for (uint8_t c = 0; c < 3; c++){
+            for (uint8_t k = 0; k < TEST_POINTS; k++){
+                curves[p][c][k] = ((uint32_t)peaks[p][c] * k) / (TEST_POINTS - 1);
+            }
+        }
+    }
+}
+
+
+void tearDown(void){
+}
+
+
+uint32_t frame_current(const uint8_t (*frame)[3], const uint8_t *profile, uint16_t scale){
+    uint64_t        weight      = power_weight(&frame[0][0], profile, &curves[0][0][0], TEST_POINTS, TEST_LEDS);
+
+    return power_current(&model, weight, power_limit(&model, weight, scale));
+}
+
+
+void test_black_frame_draws_idle_current(void){
+    TEST_ASSERT_EQUAL_UINT32(TEST_LEDS * 1, frame_current(frameBlack, factory, 0xFFFF));
+}
+
+
+void test_recorded_frames_current(void){
+    TEST_ASSERT_EQUAL_UINT32(255, frame_current(frameWarm, factory, 0xFFFF));
+    TEST_ASSERT_EQUAL_UINT32(218, frame_current(frameRainbow, factory, 0xFFFF));
+    TEST_ASSERT_EQUAL_UINT32(28, frame_current(frameRed, factory, 0xFFFF));
+}
+
+
+void test_brightness_scales_dynamic_current(void){
+    uint64_t        weight      = power_weight(&frameWarm[0][0], factory, &curves[0][0][0], TEST_POINTS, TEST_LEDS);
+
+    TEST_ASSERT_EQUAL_UINT32(8, power_current(&model, weight, 0));
+    TEST_ASSERT_EQUAL_UINT32(131, power_current(&model, weight, 0x8000));
+}
+
+
+void test_calibrated_peak_is_weighed(void){
+    // uploaded curves with every gain at 255 draw more than the factory table
+    TEST_ASSERT_EQUAL_UINT32(248, frame_current(frameRainbow, hot, 0xFFFF));
+    TEST_ASSERT_EQUAL_UINT32(285, frame_current(frameWarm, hot, 0xFFFF));
+    TEST_ASSERT_EQUAL_UINT32(28, frame_current(frameRed, hot, 0xFFFF));        // red peak is the same in both
+}
+
+
+void test_white_frame_is_limited_to_budget(void){
+    uint64_t        weight      = power_weight(&frameWhite[0][0], factory, &curves[0][0][0], TEST_POINTS, TEST_LEDS);
+    uint16_t        scale       = power_limit(&model, weight, 0xFFFF);
+
+    TEST_ASSERT_EQUAL_UINT32(429, power_current(&model, weight, 0xFFFF));       // unlimited estimate
+    TEST_ASSERT_LESS_THAN(0xFFFF, scale);
+    TEST_ASSERT_LESS_OR_EQUAL(400, power_current(&model, weight, scale));
+    TEST_ASSERT_GREATER_OR_EQUAL(399, power_current(&model, weight, scale));
+}
+
+
+void test_limit_never_raises_scale(void){
+    uint8_t         frame[TEST_LEDS][3];
+    uint32_t        seed        = 1;
+    uint64_t        weight;
+    uint16_t        scale;
+    uint16_t        limited;
+
+    for (uint16_t n = 0; n < 1000; n++){
+        for (uint8_t i = 0; i < TEST_LEDS; i++){
+            for (uint8_t c = 0; c < 3; c++){
+                seed = seed * 1103515245 + 12345;
+                frame[i][c] = seed >> 16;
+            }
+        }
+        scale = seed >> 8;
+        weight = power_weight(&frame[0][0], (n & 1) ? hot : factory, &curves[0][0][0], TEST_POINTS, TEST_LEDS);
+        limited = power_limit(&model, weight, scale);
+        TEST_ASSERT_LESS_OR_EQUAL(scale, limited);
+        TEST_ASSERT_LESS_OR_EQUAL(400, power_current(&model, weight, limited));
+    }
+}
+
+
+void test_budget_below_idle_turns_leds_off(void){
+    const PowerModel    tiny    = {TEST_LEDS, 5, 1, 20};
+    uint64_t        weight      = power_weight(&frameRed[0][0], factory, &curves[0][0][0], TEST_POINTS, TEST_LEDS);
+
+    TEST_ASSERT_EQUAL_UINT16(0, power_limit(&tiny, weight, 0xFFFF));
+}
+
+
+void test_charge_over_one_hour(void){
+    const uint8_t   (*sequence[4])[3]   = {frameWarm, frameRainbow, frameRed, frameBlack};
+    uint64_t        weight[4];
+    uint64_t        charge      = 0;
+    uint32_t        frames      = 3600UL * 1000000UL / TEST_FRAME_PERIOD;
+
+    for (uint8_t s = 0; s < 4; s++){
+        weight[s] = power_weight(&sequence[s][0][0], factory, &curves[0][0][0], TEST_POINTS, TEST_LEDS);
+    }
+    for (uint32_t f = 0; f < frames; f++){                                      // one second per recorded frame, 400Hz refresh
+        charge += (uint64_t)power_current(&model, weight[(f / 400) % 4], 0xFFFF) * TEST_FRAME_PERIOD;
+    }
+    // (255 + 218 + 28 + 8) / 4 = 127.25 mA for an hour, at 5V
+    TEST_ASSERT_EQUAL_UINT32(127, power_chargeMAh(charge));
+    TEST_ASSERT_EQUAL_UINT32(636, power_energyMWh(charge, 5000));
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_black_frame_draws_idle_current);
+    RUN_TEST(test_recorded_frames_current);
+    RUN_TEST(test_brightness_scales_dynamic_current);
+    RUN_TEST(test_calibrated_peak_is_weighed);
+    RUN_TEST(test_white_frame_is_limited_to_budget);
+    RUN_TEST(test_limit_never_raises_scale);
+    RUN_TEST(test_budget_below_idle_turns_leds_off);
+    RUN_TEST(test_charge_over_one_hour);
+    return UNITY_END();
+}
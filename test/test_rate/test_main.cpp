@@ -0,0 +1,210 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              Token buckets and LED frames under abusive load (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "lamp_rate.h"
+
+
+#define TEST_FRAME                      2500                                    // (us) LED_REFRESH_PERIOD
+#define TEST_DEADLINE                   1000                                    // (us) led task deadline
+#define TEST_ADMIT_PER_FRAME            1                                       // SERVER_ADMIT_PER_FRAME
+#define TEST_LED_COST                   400                                     // (us) animate + refresh
+#define TEST_HANDLER_COST               1200                                    // (us) admitted request, command + 303
+#define TEST_REJECT_COST                150                                     // (us) bare 429 before parsing
+#define TEST_SECONDS                    10
+#define TEST_QUEUE                      4096
+#define ABUSER                          0x0A01A8C0                              // 192.168.1.10
+#define GOOD                            0x0B01A8C0                              // 192.168.1.11
+
+
+typedef struct {
+    uint32_t        ip;
+    uint64_t        arrival;                                                    // (us)
+} Request;
+
+
+typedef struct {
+    uint64_t        maxLate;                                                    // (us) LED release to LED start
+    uint32_t        missed;                                                     // frames later than TEST_DEADLINE
+    uint32_t        abuserServed;                                               // handler ran
+    uint32_t        abuserThrottled;
+    uint32_t        goodSent;
+    uint32_t        goodServed;
+    uint32_t        goodThrottled;
+    uint64_t        goodWaitMax;                                                // (us) arrival to handler start
+} LoadResult;
+
+
+RateClient          clients[RATE_CLIENTS];
+Request             queue[TEST_QUEUE];
+
+
+void setUp(void){
+    memset(clients, 0, sizeof(clients));
+}
+
+
+void tearDown(void){
+}
+
+
+// A script hammering /r/inc with 20 pipelined requests every 100ms plus a
+// browser polling once a second, against the cooperative loop: an LED frame
+// every TEST_FRAME, the network task in between. Without admission control
+// the network task serves whatever is queued back to back; with it at most
+// TEST_ADMIT_PER_FRAME requests start per frame and empty buckets cost a 429.
+void simulate(bool control, LoadResult *result){
+    uint64_t        t           = 0;
+    uint32_t        head        = 0;
+    uint32_t        tail        = 0;
+    uint64_t        nextAbuse   = 0;
+    uint64_t        nextGood    = 37000;
+    uint8_t         admitted;
+    RateClient      *rate;
+    bool            allowed;
+
+    memset(result, 0, sizeof(*result));
+    for (uint64_t release = 0; release < (TEST_SECONDS * 1000000ULL); release += TEST_FRAME){
+        if (t < release){
+            t = release;                                                        // idle until the frame is due
+        }
+        if ((t - release) > result->maxLate){
+            result->maxLate = t - release;
+        }
+        if ((t - release) > TEST_DEADLINE){
+            result->missed += 1;
+        }
+        t += TEST_LED_COST;
+        admitted = 0;
+        while (true){
+            while ((nextAbuse <= t) || (nextGood <= t)){                        // arrivals so far
+                if (nextAbuse <= nextGood){
+                    for (uint8_t n = 0; n < 20; n++){
+                        queue[tail++ % TEST_QUEUE] = {ABUSER, nextAbuse};
+                    }
+                    nextAbuse += 100000;
+                }
+                else {
+                    queue[tail++ % TEST_QUEUE] = {GOOD, nextGood};
+                    result->goodSent += 1;
+                    nextGood += 1000000;
+                }
+            }
+            if ((head == tail) || (control && (admitted >= TEST_ADMIT_PER_FRAME))){
+                break;
+            }
+            const Request   *req    = &queue[head++ % TEST_QUEUE];
+
+            admitted += 1;
+            allowed = true;
+            if (control){
+                rate = rate_client(clients, RATE_CLIENTS, req->ip, (unsigned long)(t / 1000));
+                allowed = rate_take(rate, (unsigned long)(t / 1000));
+            }
+            if (GOOD == req->ip){
+                result->goodWaitMax = (t - req->arrival > result->goodWaitMax) ? (t - req->arrival) : result->goodWaitMax;
+                result->goodServed += allowed ? 1 : 0;
+                result->goodThrottled += allowed ? 0 : 1;
+            }
+            else {
+                result->abuserServed += allowed ? 1 : 0;
+                result->abuserThrottled += allowed ? 0 : 1;
+            }
+            t += allowed ? TEST_HANDLER_COST : TEST_REJECT_COST;
+        }
+    }
+}
+
+
+void test_burst_then_sustained_rate(void){
+    RateClient      *rate       = rate_client(clients, RATE_CLIENTS, ABUSER, 5000);
+
+    for (uint8_t n = 0; n < RATE_BURST; n++){
+        TEST_ASSERT_TRUE(rate_take(rate, 5000));
+    }
+    TEST_ASSERT_FALSE(rate_take(rate, 5000));
+    TEST_ASSERT_FALSE(rate_take(rate, 5000 + (1000 / RATE_PER_SECOND) - 1));
+    TEST_ASSERT_TRUE(rate_take(rate, 5000 + (1000 / RATE_PER_SECOND)));         // one token per 100ms
+    TEST_ASSERT_FALSE(rate_take(rate, 5000 + (1000 / RATE_PER_SECOND)));
+    TEST_ASSERT_EQUAL_UINT32(RATE_BURST + 4, rate->requests);
+    TEST_ASSERT_EQUAL_UINT32(3, rate->throttled);
+}
+
+
+void test_idle_refill_stops_at_burst(void){
+    RateClient      *rate       = rate_client(clients, RATE_CLIENTS, ABUSER, 0);
+    uint8_t         granted     = 0;
+
+    while (rate_take(rate, 0)){
+    }
+    for (uint16_t n = 0; n < 100; n++){                                         // an hour later
+        granted += rate_take(rate, 3600000UL) ? 1 : 0;
+    }
+    TEST_ASSERT_EQUAL_UINT8(RATE_BURST, granted);
+}
+
+
+void test_millis_wrap(void){
+    RateClient      *rate       = rate_client(clients, RATE_CLIENTS, ABUSER, 0xFFFFFF00UL);
+
+    while (rate_take(rate, 0xFFFFFF00UL)){
+    }
+    TEST_ASSERT_FALSE(rate_take(rate, 0xFFFFFF00UL + 50));
+    TEST_ASSERT_TRUE(rate_take(rate, 0xFFFFFF00UL + 100 + 50));                 // 150ms later, across the wrap
+    TEST_ASSERT_FALSE(rate_take(rate, 0xFFFFFF00UL + 100 + 50));
+}
+
+
+void test_client_table_recycles_least_recent(void){
+    RateClient      *abuser     = rate_client(clients, RATE_CLIENTS, ABUSER, 1000);
+
+    while (rate_take(abuser, 1000)){
+    }
+    for (uint8_t i = 1; i < RATE_CLIENTS; i++){
+        rate_take(rate_client(clients, RATE_CLIENTS, GOOD + i, 1000 + i), 1000 + i);
+    }
+    TEST_ASSERT_EQUAL_PTR(abuser, rate_client(clients, RATE_CLIENTS, ABUSER, 1010));   // still known, still empty
+    TEST_ASSERT_FALSE(rate_take(abuser, 1010));
+    TEST_ASSERT_EQUAL_PTR(&clients[1], rate_client(clients, RATE_CLIENTS, GOOD + 100, 1020));  // GOOD + 1 was idle longest
+    TEST_ASSERT_EQUAL_UINT32(GOOD + 100, clients[1].ip);
+    TEST_ASSERT_EQUAL_UINT32(RATE_BURST * RATE_TOKEN, clients[1].tokens);
+    TEST_ASSERT_EQUAL_UINT32(0, clients[1].requests);
+}
+
+
+void test_frame_deadlines_under_abusive_load(void){
+    LoadResult      open;
+    LoadResult      guarded;
+    char            msg[192];
+
+    simulate(false, &open);
+    simulate(true, &guarded);
+    snprintf(msg, sizeof(msg), "no admission control: max late %lu us, %lu frames missed; "
+             "with it: max late %lu us, %lu missed, abuser %lu served / %lu 429",
+             (unsigned long)open.maxLate, (unsigned long)open.missed, (unsigned long)guarded.maxLate,
+             (unsigned long)guarded.missed, (unsigned long)guarded.abuserServed, (unsigned long)guarded.abuserThrottled);
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_GREATER_THAN(TEST_DEADLINE, open.maxLate);                      // the load does break an open server
+    TEST_ASSERT_EQUAL_UINT32(0, guarded.missed);
+    TEST_ASSERT_TRUE(guarded.maxLate <= TEST_DEADLINE);
+    TEST_ASSERT_TRUE(guarded.abuserServed <= (RATE_BURST + (RATE_PER_SECOND * TEST_SECONDS)));
+    TEST_ASSERT_GREATER_THAN(0, guarded.abuserThrottled);
+    TEST_ASSERT_EQUAL_UINT32(guarded.goodSent, guarded.goodServed);             // the browser is never throttled
+    TEST_ASSERT_EQUAL_UINT32(0, guarded.goodThrottled);
+    TEST_ASSERT_TRUE(guarded.goodWaitMax <= (uint64_t)(20 + 1) * TEST_FRAME);   // behind one queued burst at most
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_burst_then_sustained_rate);
+    RUN_TEST(test_idle_refill_stops_at_burst);
+    RUN_TEST(test_millis_wrap);
+    RUN_TEST(test_client_table_recycles_least_recent);
+    RUN_TEST(test_frame_deadlines_under_abusive_load);
+    return UNITY_END();
+}
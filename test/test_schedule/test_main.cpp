@@ -0,0 +1,161 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              Schedule next-event computation (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lamp_schedule.h"
+
+
+#define TEST_TZ                         "CET-1CEST,M3.5.0,M10.5.0/3"            // SCHEDULE_TZ
+#define TEST_MAX                        8                                       // SCHEDULE_MAX
+#define EVERY_DAY                       0x7F
+#define MONDAY                          0x02
+
+
+ScheduleEntry       entries[TEST_MAX];
+
+
+void setUp(void){
+    setenv("TZ", TEST_TZ, 1);
+    tzset();
+    memset(entries, 0, sizeof(entries));
+}
+
+
+void tearDown(void){
+}
+
+
+time_t local(int year, int month, int day, int hour, int minute){
+    struct tm       t;
+
+    memset(&t, 0, sizeof(t));
+    t.tm_year = year - 1900;
+    t.tm_mon = month - 1;
+    t.tm_mday = day;
+    t.tm_hour = hour;
+    t.tm_min = minute;
+    t.tm_isdst = -1;
+    return mktime(&t);
+}
+
+
+void entry(uint8_t i, uint8_t hour, uint8_t minute, uint8_t days, uint8_t state){
+    entries[i].enabled = 1;
+    entries[i].hour = hour;
+    entries[i].minute = minute;
+    entries[i].days = days;
+    entries[i].state = state;
+    entries[i].brightness = 200;
+    entries[i].fade = 60;
+}
+
+
+void test_empty_table_has_no_event(void){
+    time_t          when;
+
+    entry(0, 7, 0, 0, 1);                                                       // no days
+    entry(1, 7, 0, EVERY_DAY, 1);
+    entries[1].enabled = 0;
+    TEST_ASSERT_EQUAL_INT8(-1, schedule_next(entries, TEST_MAX, local(2026, 10, 19, 6, 0), -1, &when));
+}
+
+
+void test_daily_entry_today_then_tomorrow(void){
+    time_t          when;
+
+    entry(2, 7, 0, EVERY_DAY, 1);
+    TEST_ASSERT_EQUAL_INT8(2, schedule_next(entries, TEST_MAX, local(2026, 10, 19, 6, 59), -1, &when));
+    TEST_ASSERT_EQUAL_INT64(local(2026, 10, 19, 7, 0), when);
+    TEST_ASSERT_EQUAL_INT8(2, schedule_next(entries, TEST_MAX, local(2026, 10, 19, 7, 1), -1, &when));
+    TEST_ASSERT_EQUAL_INT64(local(2026, 10, 20, 7, 0), when);
+}
+
+
+void test_event_due_now_is_included(void){
+    time_t          when;
+    time_t          at          = local(2026, 10, 19, 7, 0);
+
+    entry(0, 7, 0, EVERY_DAY, 1);
+    TEST_ASSERT_EQUAL_INT8(0, schedule_next(entries, TEST_MAX, at, -1, &when));
+    TEST_ASSERT_EQUAL_INT64(at, when);
+}
+
+
+void test_same_minute_entries_fire_in_order(void){
+    time_t          at          = local(2026, 10, 19, 22, 30);
+    time_t          when;
+    int8_t          next;
+
+    // two entries at 22:30: the second must follow the first, not wait a week
+    entry(1, 22, 30, MONDAY, 0);
+    entry(5, 22, 30, MONDAY, 1);
+    next = schedule_next(entries, TEST_MAX, at - 30, -1, &when);
+    TEST_ASSERT_EQUAL_INT8(1, next);
+    TEST_ASSERT_EQUAL_INT64(at, when);
+    next = schedule_next(entries, TEST_MAX, when, next, &when);
+    TEST_ASSERT_EQUAL_INT8(5, next);
+    TEST_ASSERT_EQUAL_INT64(at, when);
+    next = schedule_next(entries, TEST_MAX, when, next, &when);
+    TEST_ASSERT_EQUAL_INT8(1, next);
+    TEST_ASSERT_EQUAL_INT64(local(2026, 10, 26, 22, 30), when);
+}
+
+
+void test_late_tick_does_not_skip_events(void){
+    time_t          when;
+    int8_t          next;
+
+    // task ran 90s after 07:00, the 07:01 entry is still next after firing 07:00
+    entry(0, 7, 0, EVERY_DAY, 1);
+    entry(1, 7, 1, EVERY_DAY, 0);
+    next = schedule_next(entries, TEST_MAX, local(2026, 10, 19, 7, 0), 0, &when);
+    TEST_ASSERT_EQUAL_INT8(1, next);
+    TEST_ASSERT_EQUAL_INT64(local(2026, 10, 19, 7, 1), when);
+}
+
+
+void test_weekday_mask_wraps_the_week(void){
+    time_t          when;
+
+    entry(3, 7, 0, MONDAY, 1);
+    TEST_ASSERT_EQUAL_INT8(3, schedule_next(entries, TEST_MAX, local(2026, 10, 19, 7, 0), 3, &when));
+    TEST_ASSERT_EQUAL_INT64(local(2026, 10, 26, 7, 0), when);
+    TEST_ASSERT_EQUAL_INT8(3, schedule_next(entries, TEST_MAX, local(2026, 10, 24, 12, 0), -1, &when));
+    TEST_ASSERT_EQUAL_INT64(local(2026, 10, 26, 7, 0), when);
+}
+
+
+void test_dst_days(void){
+    time_t          when;
+    int8_t          next;
+
+    // 02:30 does not exist on 29 March 2026, the event still lands that day, once
+    entry(0, 2, 30, EVERY_DAY, 1);
+    next = schedule_next(entries, TEST_MAX, local(2026, 3, 29, 0, 0), -1, &when);
+    TEST_ASSERT_EQUAL_INT8(0, next);
+    TEST_ASSERT_EQUAL_INT64(local(2026, 3, 29, 0, 0) + 3 * 3600 - 1800, when);  // 01:00 CET + 1.5h wall time
+    next = schedule_next(entries, TEST_MAX, when, next, &when);
+    TEST_ASSERT_EQUAL_INT64(local(2026, 3, 30, 2, 30), when);
+    // 02:30 happens twice on 25 October 2026, the event fires once
+    next = schedule_next(entries, TEST_MAX, local(2026, 10, 25, 0, 0), -1, &when);
+    TEST_ASSERT_EQUAL_INT8(0, next);
+    next = schedule_next(entries, TEST_MAX, when, next, &when);
+    TEST_ASSERT_EQUAL_INT64(local(2026, 10, 26, 2, 30), when);
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_table_has_no_event);
+    RUN_TEST(test_daily_entry_today_then_tomorrow);
+    RUN_TEST(test_event_due_now_is_included);
+    RUN_TEST(test_same_minute_entries_fire_in_order);
+    RUN_TEST(test_late_tick_does_not_skip_events);
+    RUN_TEST(test_weekday_mask_wraps_the_week);
+    RUN_TEST(test_dst_days);
+    return UNITY_END();
+}
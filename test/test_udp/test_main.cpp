@@ -0,0 +1,170 @@
+// *****************************************************************************
+//  Project:            Eperly - Lite
+//  Tests:              UDP control protocol codec (pio test -e native)
+// *****************************************************************************
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "lamp_udp.h"
+
+
+#define TEST_PATTERN_MAX                5                                       // ROTATE
+#define TEST_PALETTE_SIZE               12
+
+
+uint8_t             buf[UDP_PACKET_MAX];
+UdpPacket           packet;
+UdpCommand          cmd;
+
+
+void setUp(void){
+    memset(buf, 0, sizeof(buf));
+    memset(&packet, 0, sizeof(packet));
+    memset(&cmd, 0xAA, sizeof(cmd));
+}
+
+
+void tearDown(void){
+}
+
+
+uint8_t decode(const uint8_t *ops, uint8_t len){
+    return udp_decode(ops, len, TEST_PATTERN_MAX, TEST_PALETTE_SIZE, &cmd);
+}
+
+
+void test_round_trip(void){
+    const uint8_t   ops[]       = {UDP_OP_STATE, 1, UDP_OP_BRIGHTNESS, 200, UDP_OP_RGB, 255, 147, 41, UDP_OP_PATTERN, 3};
+    uint8_t         len         = udp_build(buf, UDP_FLAG_ACK_REQ, 0xBEEF, ops, sizeof(ops));
+
+    TEST_ASSERT_EQUAL_UINT8(UDP_HEADER_SIZE + sizeof(ops), len);
+    TEST_ASSERT_TRUE(udp_parse(buf, len, &packet));
+    TEST_ASSERT_EQUAL_UINT8(UDP_FLAG_ACK_REQ, packet.flags);
+    TEST_ASSERT_EQUAL_UINT16(0xBEEF, packet.seq);
+    TEST_ASSERT_EQUAL_UINT8(sizeof(ops), packet.len);
+    TEST_ASSERT_EQUAL_UINT8(UDP_STATUS_OK, decode(packet.ops, packet.len));
+    TEST_ASSERT_EQUAL_UINT8(UDP_HAS_STATE | UDP_HAS_BRIGHTNESS | UDP_HAS_COLOR | UDP_HAS_PATTERN, cmd.has);
+    TEST_ASSERT_TRUE(cmd.state);
+    TEST_ASSERT_EQUAL_UINT8(200, cmd.brightness);
+    TEST_ASSERT_EQUAL_UINT8(255, cmd.rgb[0]);
+    TEST_ASSERT_EQUAL_UINT8(147, cmd.rgb[1]);
+    TEST_ASSERT_EQUAL_UINT8(41, cmd.rgb[2]);
+    TEST_ASSERT_EQUAL_UINT8(3, cmd.pattern);
+}
+
+
+void test_reply_echoes_header(void){
+    const uint8_t   ops[]       = {UDP_OP_STATE, 0};
+    uint8_t         reply[UDP_REPLY_SIZE];
+
+    udp_build(buf, UDP_FLAG_ACK_REQ, 0x1234, ops, sizeof(ops));
+    udp_reply(buf, UDP_STATUS_STALE, reply);
+    TEST_ASSERT_EQUAL_MEMORY(buf, reply, 3);
+    TEST_ASSERT_EQUAL_UINT8(UDP_FLAG_ACK, reply[3]);
+    TEST_ASSERT_EQUAL_UINT8(0x34, reply[4]);
+    TEST_ASSERT_EQUAL_UINT8(0x12, reply[5]);
+    TEST_ASSERT_EQUAL_UINT8(UDP_STATUS_STALE, reply[6]);
+}
+
+
+void test_rejects_foreign_and_truncated_datagrams(void){
+    const uint8_t   ops[]       = {UDP_OP_STATE, 1};
+    uint8_t         big[UDP_PACKET_MAX];
+    uint8_t         len         = udp_build(buf, 0, 1, ops, sizeof(ops));
+
+    TEST_ASSERT_FALSE(udp_parse(buf, UDP_HEADER_SIZE - 1, &packet));
+    TEST_ASSERT_FALSE(udp_parse(buf, UDP_PACKET_MAX, &packet));                 // filled the buffer: truncated
+    buf[2] = UDP_CTRL_VERSION + 1;
+    TEST_ASSERT_FALSE(udp_parse(buf, len, &packet));
+    buf[2] = UDP_CTRL_VERSION;
+    buf[0] = 'X';
+    TEST_ASSERT_FALSE(udp_parse(buf, len, &packet));
+    memset(big, UDP_OP_STATE, sizeof(big));
+    TEST_ASSERT_EQUAL_UINT8(0, udp_build(buf, 0, 1, big, UDP_PACKET_MAX - UDP_HEADER_SIZE));
+    TEST_ASSERT_TRUE(udp_build(buf, 0, 1, big, UDP_PACKET_MAX - UDP_HEADER_SIZE - 1) > 0);
+}
+
+
+void test_malformed_ops_change_nothing(void){
+    const uint8_t   unknown[]   = {UDP_OP_STATE, 1, 0x7F, 0};
+    const uint8_t   short_rgb[] = {UDP_OP_BRIGHTNESS, 10, UDP_OP_RGB, 1, 2};
+    const uint8_t   pattern[]   = {UDP_OP_STATE, 1, UDP_OP_PATTERN, TEST_PATTERN_MAX + 1};
+    const uint8_t   dangling[]  = {UDP_OP_STATE};
+
+    TEST_ASSERT_EQUAL_UINT8(UDP_STATUS_BAD, decode(unknown, sizeof(unknown)));
+    TEST_ASSERT_EQUAL_UINT8(0, cmd.has);
+    TEST_ASSERT_EQUAL_UINT8(UDP_STATUS_BAD, decode(short_rgb, sizeof(short_rgb)));
+    TEST_ASSERT_EQUAL_UINT8(0, cmd.has);
+    TEST_ASSERT_EQUAL_UINT8(UDP_STATUS_BAD, decode(pattern, sizeof(pattern)));
+    TEST_ASSERT_EQUAL_UINT8(0, cmd.has);
+    TEST_ASSERT_EQUAL_UINT8(UDP_STATUS_BAD, decode(dangling, sizeof(dangling)));
+    TEST_ASSERT_EQUAL_UINT8(UDP_STATUS_OK, decode(dangling, 0));                // empty op list: a ping
+    TEST_ASSERT_EQUAL_UINT8(0, cmd.has);
+}
+
+
+void test_last_color_op_wins(void){
+    const uint8_t   rgbThenPal[]    = {UDP_OP_RGB, 1, 2, 3, UDP_OP_PALETTE_COLOR, 4};
+    const uint8_t   palThenRgb[]    = {UDP_OP_PALETTE_COLOR, 4, UDP_OP_RGB, 1, 2, 3};
+    const uint8_t   badIndex[]      = {UDP_OP_RGB, 1, 2, 3, UDP_OP_PALETTE_COLOR, TEST_PALETTE_SIZE};
+
+    TEST_ASSERT_EQUAL_UINT8(UDP_STATUS_OK, decode(rgbThenPal, sizeof(rgbThenPal)));
+    TEST_ASSERT_EQUAL_UINT8(UDP_HAS_COLOR | UDP_HAS_PALETTE, cmd.has);
+    TEST_ASSERT_EQUAL_UINT8(4, cmd.index);
+    TEST_ASSERT_EQUAL_UINT8(UDP_STATUS_OK, decode(palThenRgb, sizeof(palThenRgb)));
+    TEST_ASSERT_EQUAL_UINT8(UDP_HAS_COLOR, cmd.has);
+    TEST_ASSERT_EQUAL_UINT8(3, cmd.rgb[2]);
+    TEST_ASSERT_EQUAL_UINT8(UDP_STATUS_OK, decode(badIndex, sizeof(badIndex)));  // out of range index is skipped
+    TEST_ASSERT_EQUAL_UINT8(UDP_HAS_COLOR, cmd.has);
+    TEST_ASSERT_EQUAL_UINT8(1, cmd.rgb[0]);
+}
+
+
+void test_sequence_wraps(void){
+    TEST_ASSERT_TRUE(udp_newer(1, 0));
+    TEST_ASSERT_FALSE(udp_newer(0, 0));                                         // repeated
+    TEST_ASSERT_FALSE(udp_newer(9, 10));                                        // reordered
+    TEST_ASSERT_TRUE(udp_newer(0, 0xFFFF));
+    TEST_ASSERT_TRUE(udp_newer(0x7FFF, 0));
+    TEST_ASSERT_FALSE(udp_newer(0x8000, 0));                                    // half a window back
+}
+
+
+void test_benchmark_round_trip(void){
+    const uint32_t  packets     = 1000000;
+    uint8_t         ops[]       = {UDP_OP_BRIGHTNESS, 0, UDP_OP_RGB, 0, 0, 0};
+    uint8_t         reply[UDP_REPLY_SIZE];
+    uint32_t        sum         = 0;
+    char            msg[96];
+    double          ns;
+
+    // slider stream: build, parse, decode and ack every datagram
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < packets; n++){
+        ops[1] = n;
+        ops[3] = n >> 8;
+        uint8_t len = udp_build(buf, UDP_FLAG_ACK_REQ, n, ops, sizeof(ops));
+        if (udp_parse(buf, len, &packet) && (UDP_STATUS_OK == decode(packet.ops, packet.len))){
+            udp_reply(buf, UDP_STATUS_OK, reply);
+            sum += cmd.brightness + cmd.rgb[0] + reply[4];
+        }
+    }
+    ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    snprintf(msg, sizeof(msg), "host codec: %.1f ns per datagram round trip", ns / packets);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_GREATER_THAN(0, sum);                                           // keeps the loop alive
+}
+
+
+int main(int argc, char **argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_reply_echoes_header);
+    RUN_TEST(test_rejects_foreign_and_truncated_datagrams);
+    RUN_TEST(test_malformed_ops_change_nothing);
+    RUN_TEST(test_last_color_op_wins);
+    RUN_TEST(test_sequence_wraps);
+    RUN_TEST(test_benchmark_round_trip);
+    return UNITY_END();
+}
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# *****************************************************************************
+#  Project:            Eperly - Lite
+#  Tool:               Sustained frame upload rate against a running lamp
+# *****************************************************************************
+# usage: tools/frame_stream.py <lamp ip> [seconds per transport]
+#
+# Streams full frames (packed RGB, /stats "leds" pixels) as fast as the lamp
+# takes them, first as HTTP POST /frame over one keep-alive connection, then
+# over the raw TCP stream on FRAME_TCP_PORT. Prints frames/s as sent and as
+# counted by the lamp (/stats frames delta), frame errors and the command
+# latency the LED task reports for the last frame.
+import http.client
+import json
+import socket
+import sys
+import time
+
+FRAME_TCP_PORT = 7777
+
+
+def stats(host):
+    conn = http.client.HTTPConnection(host, 80, timeout=10)
+    conn.request("GET", "/stats", headers={"Connection": "close"})
+    data = json.loads(conn.getresponse().read())
+    conn.close()
+    return data
+
+
+def frame(leds, n):
+    # a moving rainbow-ish ramp, every frame differs
+    return bytes(((i * 7 + n * 3 + c * 85) & 0xFF) for i in range(leds) for c in range(3))
+
+
+def http_frames(host, leds, seconds):
+    conn = http.client.HTTPConnection(host, 80, timeout=10)
+    sent = errors = 0
+    end = time.monotonic() + seconds
+    while time.monotonic() < end:
+        conn.request("POST", "/frame", body=frame(leds, sent), headers={"Content-Type": "application/octet-stream"})
+        response = conn.getresponse()
+        response.read()
+        if response.status == 204:
+            sent += 1
+        else:
+            errors += 1
+            if response.status == 429:
+                time.sleep(0.1)
+    conn.close()
+    return sent, errors
+
+
+def tcp_frames(host, leds, seconds):
+    sent = 0
+    end = time.monotonic() + seconds
+    with socket.create_connection((host, FRAME_TCP_PORT), timeout=10) as s:
+        s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        while time.monotonic() < end:
+            s.sendall(frame(leds, sent))                    # blocks once the lamp's window is full
+            sent += 1
+        time.sleep(0.5)                                     # let the last frames drain
+    return sent, 0
+
+
+def run(host, name, send, leds, seconds):
+    before = stats(host)
+    start = time.monotonic()
+    sent, errors = send(host, leds, seconds)
+    elapsed = time.monotonic() - start
+    after = stats(host)
+    shown = after["frames"] - before["frames"]
+    print("%-5s sent %6d (%6.1f/s)  counted by the lamp %6d (%6.1f/s)  errors %d/%d  cmdLatency %s us" % (
+        name, sent, sent / elapsed, shown, shown / elapsed, errors, after["frameErrors"] - before["frameErrors"],
+        after.get("cmdLatency")))
+    return shown / elapsed
+
+
+def main():
+    host = sys.argv[1]
+    seconds = float(sys.argv[2]) if len(sys.argv) > 2 else 10.0
+    leds = stats(host)["leds"]
+    print("%d pixels, %d byte frames" % (leds, leds * 3))
+    run(host, "http", http_frames, leds, seconds)
+    run(host, "tcp", tcp_frames, leds, seconds)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+# *****************************************************************************
+#  Project:            Eperly - Lite
+#  Tool:               Heap fragmentation soak against a running lamp
+# *****************************************************************************
+# usage: tools/heap_soak.py <lamp ip> [hours] [csv]
+#
+# Replays a day-shaped mix of UI traffic (page loads, color and pattern
+# changes, brightness steps, stats polling, scans, unknown URLs) for the given
+# hours (default 72) and samples /heap once a minute: free heap, largest free
+# block and fragmentation go to the CSV (default heap_soak.csv) and to an SVG
+# chart next to it. Fails when the largest block ends below MIN_BLOCK or more
+# than DRIFT below its first hour, i.e. the heap is still fragmenting.
+import csv
+import http.client
+import json
+import math
+import random
+import sys
+import time
+
+SAMPLE_PERIOD = 60.0                                        # (s)
+MIN_BLOCK = 8192                                            # (bytes) a page render must still fit
+DRIFT = 0.10
+TRAFFIC = [                                                 # (weight, path)
+    (30, "/stats"),
+    (10, "/"),
+    (10, "/brightness/inc"),
+    (10, "/brightness/dec"),
+    (8, "/color/%d"),
+    (6, "/static"),
+    (6, "/rotate"),
+    (4, "/heartbeat"),
+    (4, "/audio"),
+    (4, "/schedule"),
+    (3, "/log"),
+    (3, "/trace"),
+    (2, "/on"),
+    (2, "/off"),
+    (2, "/favicon.ico"),                                    # 404s as browsers and scanners send them
+    (1, "/wp-login.php"),
+    (1, "/wifi/scan"),
+]
+
+
+def get(host, path):
+    conn = http.client.HTTPConnection(host, 80, timeout=10)
+    try:
+        conn.request("GET", path, headers={"Connection": "close"})
+        response = conn.getresponse()
+        body = response.read()
+        return response.status, body
+    finally:
+        conn.close()
+
+
+def rate(elapsed):
+    # requests per second, evening peak and quiet nights
+    hour = (elapsed / 3600.0) % 24.0
+    return 0.2 + 1.8 * max(0.0, math.sin(math.pi * (hour - 6.0) / 18.0)) ** 2
+
+
+def request(host, rng):
+    total = sum(w for w, _ in TRAFFIC)
+    pick = rng.uniform(0, total)
+    for weight, path in TRAFFIC:
+        pick -= weight
+        if pick <= 0:
+            break
+    if "%d" in path:
+        path = path % rng.randrange(0, 29)
+    try:
+        return get(host, path)[0]
+    except (OSError, http.client.HTTPException):
+        return 0
+
+
+def sample(host):
+    status, body = get(host, "/heap")
+    data = json.loads(body) if status == 200 else {}
+    return data.get("free", 0), data.get("maxBlock", 0), data.get("frag", 0), data.get("allocs", 0)
+
+
+def chart(rows, path):
+    width, height, pad = 960, 360, 40
+    hours = max(rows[-1][0], 1.0)
+    top = max(max(r[1] for r in rows), 1)
+    lines = []
+    for column, colour in ((1, "#1f77b4"), (2, "#d62728")):
+        points = " ".join("%.1f,%.1f" % (pad + (r[0] / hours) * (width - 2 * pad),
+                                         height - pad - (r[column] / top) * (height - 2 * pad)) for r in rows)
+        lines.append('<polyline fill="none" stroke="%s" points="%s"/>' % (colour, points))
+    with open(path, "w") as f:
+        f.write('<svg xmlns="http://www.w3.org/2000/svg" width="%d" height="%d">' % (width, height))
+        f.write('<text x="%d" y="20">free heap (blue), largest block (red), %.1f h, top %d bytes</text>' % (pad, hours, top))
+        f.write("".join(lines))
+        f.write("</svg>\n")
+
+
+def main():
+    host = sys.argv[1]
+    hours = float(sys.argv[2]) if len(sys.argv) > 2 else 72.0
+    path = sys.argv[3] if len(sys.argv) > 3 else "heap_soak.csv"
+    rng = random.Random(1)
+    rows = []
+    errors = 0
+    start = time.monotonic()
+    next_sample = start
+    with open(path, "w", newline="") as f:
+        out = csv.writer(f)
+        out.writerow(["hours", "free", "maxBlock", "frag", "allocs", "errors"])
+        while True:
+            now = time.monotonic()
+            elapsed = now - start
+            if elapsed >= hours * 3600.0:
+                break
+            if now >= next_sample:
+                next_sample += SAMPLE_PERIOD
+                try:
+                    row = (elapsed / 3600.0,) + sample(host) + (errors,)
+                except (OSError, http.client.HTTPException, ValueError):
+                    errors += 1
+                    continue
+                rows.append(row)
+                out.writerow(["%.3f" % row[0]] + list(row[1:]))
+                f.flush()
+                print("%7.2f h  free %6d  maxBlock %6d  frag %3d%%  allocs %6d  errors %d" % row)
+            if request(host, rng) not in (200, 404):
+                errors += 1
+            time.sleep(rng.expovariate(rate(elapsed)))
+    if not rows:
+        print("FAIL: no /heap samples")
+        sys.exit(1)
+    chart(rows, path.rsplit(".", 1)[0] + ".svg")
+    first = [r[2] for r in rows if r[0] <= 1.0]
+    baseline = min(first) if first else rows[0][2]
+    last = rows[-1][2]
+    print("largest block: first hour %d, end %d, low %d; %d failed requests" % (baseline, last, min(r[2] for r in rows), errors))
+    if (last < MIN_BLOCK) or (last < baseline * (1.0 - DRIFT)):
+        print("FAIL: the largest free block kept shrinking")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
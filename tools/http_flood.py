@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+# *****************************************************************************
+#  Project:            Eperly - Lite
+#  Tool:               Abusive HTTP client against a running lamp
+# *****************************************************************************
+# usage: tools/http_flood.py <lamp ip> [seconds] [abusers]
+#
+# Each abuser (default 1) sends bursts of 20 pipelined /r/inc and /r/dec
+# requests every 100 ms, the colour nets out unchanged. Meanwhile a polite
+# client fetches /stats once a second. Prints the abusers' 2xx/3xx vs 429
+# counts, the polite client's latency and the /stats deltas: throttled and
+# deferred requests, LED task lateness and missed frames. Fails if the
+# polite client is throttled or the LED task missed a deadline.
+import http.client
+import json
+import socket
+import statistics
+import sys
+import threading
+import time
+
+BURST = 20
+BURST_INTERVAL = 0.1                                        # (s)
+
+
+def stats(host):
+    conn = http.client.HTTPConnection(host, 80, timeout=10)
+    start = time.perf_counter()
+    conn.request("GET", "/stats", headers={"Connection": "close"})
+    response = conn.getresponse()
+    body = response.read()
+    conn.close()
+    elapsed = (time.perf_counter() - start) * 1000.0
+    data = json.loads(body) if response.status == 200 else {}
+    led = next((t for t in data.get("tasks", []) if t.get("name") == "led"), {})
+    return response.status, elapsed, data, led
+
+
+def abuser(host, stop, counts, lock):
+    flip = False
+    while not stop.is_set():
+        started = time.monotonic()
+        request = b""
+        for _ in range(BURST):
+            flip = not flip
+            request += b"GET /%s HTTP/1.1\r\nHost: %s\r\n\r\n" % (b"r/inc" if flip else b"r/dec", host.encode())
+        ok = throttled = 0
+        try:
+            with socket.create_connection((host, 80), timeout=2) as s:
+                s.sendall(request)
+                data = b""
+                while True:                                 # the lamp closes after a 429 or the last request
+                    chunk = s.recv(4096)
+                    if not chunk:
+                        break
+                    data += chunk
+                    if data.count(b"HTTP/1.") >= BURST:
+                        break
+            for line in data.split(b"\r\n"):
+                if line.startswith(b"HTTP/1.") and line[9:12] == b"429":
+                    throttled += 1
+                elif line.startswith(b"HTTP/1."):
+                    ok += 1
+        except OSError:
+            pass
+        with lock:
+            counts["ok"] += ok
+            counts["throttled"] += throttled
+            counts["lost"] += BURST - ok - throttled
+        time.sleep(max(0.0, BURST_INTERVAL - (time.monotonic() - started)))
+
+
+def main():
+    host = sys.argv[1]
+    seconds = float(sys.argv[2]) if len(sys.argv) > 2 else 30.0
+    abusers = int(sys.argv[3]) if len(sys.argv) > 3 else 1
+    _, _, before, led_before = stats(host)
+
+    stop = threading.Event()
+    lock = threading.Lock()
+    counts = {"ok": 0, "throttled": 0, "lost": 0}
+    threads = [threading.Thread(target=abuser, args=(host, stop, counts, lock)) for _ in range(abusers)]
+    for t in threads:
+        t.start()
+    polite = []
+    polite_throttled = 0
+    end = time.monotonic() + seconds
+    while time.monotonic() < end:
+        try:
+            status, elapsed, _, _ = stats(host)
+            polite.append(elapsed)
+            polite_throttled += 1 if status == 429 else 0
+        except (OSError, http.client.HTTPException, ValueError):
+            pass
+        time.sleep(1.0)
+    stop.set()
+    for t in threads:
+        t.join()
+
+    _, _, after, led_after = stats(host)
+    print("abusers: %d answered, %d throttled (429), %d not answered" % (counts["ok"], counts["throttled"], counts["lost"]))
+    if polite:
+        print("polite client: n=%d median %.1f ms max %.1f ms, %d throttled" % (
+            len(polite), statistics.median(polite), max(polite), polite_throttled))
+    for key in ("httpThrottled", "httpDeferred", "httpRequests"):
+        print("%-14s +%d" % (key, after.get(key, 0) - before.get(key, 0)))
+    missed = led_after.get("missed", 0) - led_before.get("missed", 0)
+    print("led task: maxLate %s us, missed +%d, ledJitterMax %s us" % (
+        led_after.get("maxLate"), missed, after.get("ledJitterMax")))
+    if polite_throttled or missed > 0:
+        print("FAIL: the polite client was throttled or LED frames were missed")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
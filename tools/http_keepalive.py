@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+# *****************************************************************************
+#  Project:            Eperly - Lite
+#  Tool:               HTTP keep-alive benchmark against a running lamp
+# *****************************************************************************
+# usage: tools/http_keepalive.py <lamp ip> [requests]
+#
+# 1. requests over one keep-alive connection vs. one connection per request
+# 2. a second client while the first holds an idle keep-alive socket: the
+#    server must drop the idle one within HTTP_MAX_DATA_AVAILABLE_WAIT, not
+#    make the second client wait HTTP_MAX_DATA_WAIT
+# 3. requests pipelined on one socket (all sent before reading) must each be
+#    answered, in order: routes with different status codes tell them apart
+# Prints latencies and the /stats connection counters before and after.
+import http.client
+import json
+import socket
+import statistics
+import sys
+import time
+
+PATH = "/stats"
+PIPELINED = [("/stats", 200), ("/no-such-page", 404), ("/schedule/set", 400)] * 3    # below RATE_BURST, no side effects
+
+
+def stats(host):
+    conn = http.client.HTTPConnection(host, 80, timeout=10)
+    conn.request("GET", PATH, headers={"Connection": "close"})
+    data = json.loads(conn.getresponse().read())
+    conn.close()
+    return {k: data.get(k) for k in ("httpConnections", "httpRequests", "httpIdleClosed", "httpThrottled")}
+
+
+def timed(conn, headers):
+    start = time.perf_counter()
+    conn.request("GET", PATH, headers=headers)
+    conn.getresponse().read()
+    return (time.perf_counter() - start) * 1000.0
+
+
+def report(name, samples):
+    samples = sorted(samples)
+    print("%-22s n=%-4d median %7.1f ms  p95 %7.1f ms  max %7.1f ms" % (
+        name, len(samples), statistics.median(samples), samples[int(len(samples) * 0.95) - 1], samples[-1]))
+
+
+def read_response(stream):
+    # status line, headers, then a Content-Length or chunked body, nothing read past it
+    status = int(stream.readline().split()[1])
+    length = None
+    chunked = False
+    while True:
+        line = stream.readline().strip()
+        if not line:
+            break
+        name, _, value = line.decode().partition(":")
+        if name.lower() == "content-length":
+            length = int(value)
+        elif name.lower() == "transfer-encoding" and "chunked" in value.lower():
+            chunked = True
+    if chunked:
+        while True:
+            size = int(stream.readline().split(b";")[0], 16)
+            stream.read(size + 2)                           # chunk and its CRLF
+            if size == 0:
+                break
+    elif length:
+        stream.read(length)
+    return status
+
+
+def pipelined(host):
+    with socket.create_connection((host, 80), timeout=10) as s:
+        s.sendall(b"".join(b"GET %s HTTP/1.1\r\nHost: %s\r\n\r\n" % (path.encode(), host.encode())
+                           for path, _ in PIPELINED))
+        stream = s.makefile("rb")
+        try:
+            return [read_response(stream) for _ in PIPELINED]
+        except (OSError, ValueError, IndexError):
+            return None
+
+
+def main():
+    host = sys.argv[1]
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 100
+    before = stats(host)
+
+    conn = http.client.HTTPConnection(host, 80, timeout=10)
+    reused = [timed(conn, {}) for _ in range(count)]
+    conn.close()
+    report("keep-alive", reused)
+
+    fresh = []
+    for _ in range(count):
+        conn = http.client.HTTPConnection(host, 80, timeout=10)
+        fresh.append(timed(conn, {"Connection": "close"}))
+        conn.close()
+    report("connection per request", fresh)
+
+    blocked = []
+    for _ in range(10):
+        idle = http.client.HTTPConnection(host, 80, timeout=10)
+        timed(idle, {})                                     # leaves the socket open and idle
+        other = http.client.HTTPConnection(host, 80, timeout=10)
+        blocked.append(timed(other, {"Connection": "close"}))
+        other.close()
+        idle.close()
+    report("behind an idle client", blocked)
+
+    time.sleep(2.0)                                         # refill the rate bucket, RATE_BURST / RATE_PER_SECOND
+    answered = pipelined(host)
+    expected = [code for _, code in PIPELINED]
+    print("pipelined %d requests: %s" % (len(PIPELINED), answered))
+
+    after = stats(host)
+    print("stats delta:", {k: after[k] - before[k] for k in after if after[k] is not None and before[k] is not None})
+    if max(blocked) > 1000.0:
+        print("FAIL: an idle keep-alive socket held up another client")
+        sys.exit(1)
+    if answered != expected:
+        print("FAIL: pipelined requests not answered in order, expected %s" % expected)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+# *****************************************************************************
+#  Project:            Eperly - Lite
+#  Tool:               Request trace download, summary and replay
+# *****************************************************************************
+# usage: tools/trace_replay.py fetch <lamp ip> <trace.bin>
+#        tools/trace_replay.py show <trace.bin>
+#        tools/trace_replay.py replay <trace.bin> <target ip[:port]> [speed]
+#
+# fetch  downloads /trace (TRACE_VERSION 2, see TraceHeader/TraceRecord)
+# show   per route latency profile as recorded in the field: handler
+#        duration, body bytes, heap change and LED show time
+# replay sends the same requests with the recorded spacing (divided by speed,
+#        default 1) to a lamp on the bench or any build serving the same
+#        routes, then prints the recorded and replayed profiles side by side.
+#        Unregistered paths ("other") replay as a 404 probe; routes that
+#        reboot, flash or rescan are skipped.
+import http.client
+import statistics
+import struct
+import sys
+import time
+
+MAGIC = 0x45435254
+VERSION = 2
+HEADER = struct.Struct("<IBBBBHHII")
+RECORD = struct.Struct("<IIIIIHBB")
+ROUTE_OTHER = 0xFF
+OTHER_PATH = "/trace-replay-probe"
+METHODS = ["ANY", "GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS"]
+USAGE = "usage: trace_replay.py fetch <ip> <file> | show <file> | replay <file> <ip[:port]> [speed]"
+SKIP = {"/ota", "/ota/pull", "/wifi", "/wifi/scan", "/trace", "/frame", "/schedule/set", "/mqtt"}
+
+
+def load(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, version, record_size, route_len, route_count, count, _, dropped, uptime = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != VERSION or record_size != RECORD.size:
+        sys.exit("not a version %d trace (magic %08x, version %d, record %d bytes)" % (VERSION, magic, version, record_size))
+    offset = HEADER.size
+    routes = []
+    for _ in range(route_count):
+        routes.append(data[offset:offset + route_len].split(b"\0", 1)[0].decode("ascii", "replace"))
+        offset += route_len
+    records = []
+    for _ in range(count):
+        stamp, duration, sent, before, after, show, route, method = RECORD.unpack_from(data, offset)
+        offset += RECORD.size
+        records.append({
+            "stamp": stamp, "duration": duration, "bytes": sent, "heap": after - before, "show": show,
+            "path": routes[route] if route < len(routes) else "other",
+            "route": routes[route] if route < len(routes) else OTHER_PATH,
+            "method": METHODS[method] if method < len(METHODS) else "GET",
+        })
+    print("%d records, %d dropped, %d routes, recorded up to %.1f s uptime" % (count, dropped, route_count, uptime / 1000.0))
+    return records
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p))]
+
+
+def profile(records, replayed=None):
+    paths = sorted({r["path"] for r in records})
+    print("%-16s %5s %9s %9s %8s %7s %7s%s" % ("route", "n", "p50 ms", "p95 ms", "bytes", "heap", "show us",
+                                              "  replay p50/p95 ms" if replayed is not None else ""))
+    for path in paths:
+        rows = [r for r in records if r["path"] == path]
+        durations = [r["duration"] / 1000.0 for r in rows]
+        line = "%-16s %5d %9.2f %9.2f %8d %7d %7d" % (
+            path, len(rows), statistics.median(durations), percentile(durations, 0.95),
+            statistics.median(r["bytes"] for r in rows), min(r["heap"] for r in rows), max(r["show"] for r in rows))
+        if replayed is not None and replayed.get(path):
+            line += "  %8.2f / %.2f" % (statistics.median(replayed[path]), percentile(replayed[path], 0.95))
+        print(line)
+
+
+def fetch(host, path):
+    conn = http.client.HTTPConnection(host, 80, timeout=10)
+    conn.request("GET", "/trace", headers={"Connection": "close"})
+    response = conn.getresponse()
+    data = response.read()
+    conn.close()
+    if response.status != 200:
+        sys.exit("/trace answered %d" % response.status)
+    with open(path, "wb") as f:
+        f.write(data)
+    print("%d bytes written to %s" % (len(data), path))
+
+
+def replay(records, target, speed):
+    host, _, port = target.partition(":")
+    replayed = {}
+    start = time.monotonic()
+    first = records[0]["stamp"] if records else 0
+    for r in records:
+        if r["path"] in SKIP or r["method"] not in ("GET", "POST", "ANY"):
+            continue
+        due = start + ((r["stamp"] - first) / 1000.0) / speed
+        time.sleep(max(0.0, due - time.monotonic()))
+        sent = time.perf_counter()
+        try:
+            conn = http.client.HTTPConnection(host, int(port or 80), timeout=10)
+            conn.request("POST" if r["method"] == "POST" else "GET", r["route"], headers={"Connection": "close"})
+            conn.getresponse().read()
+            conn.close()
+        except (OSError, http.client.HTTPException):
+            continue
+        replayed.setdefault(r["path"], []).append((time.perf_counter() - sent) * 1000.0)
+    return replayed
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(USAGE)
+    if sys.argv[1] == "fetch" and len(sys.argv) == 4:
+        fetch(sys.argv[2], sys.argv[3])
+    elif sys.argv[1] == "show":
+        profile(load(sys.argv[2]))
+    elif sys.argv[1] == "replay" and len(sys.argv) >= 4:
+        records = load(sys.argv[2])
+        profile(records, replay(records, sys.argv[3], float(sys.argv[4]) if len(sys.argv) > 4 else 1.0))
+    else:
+        sys.exit(USAGE)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+# *****************************************************************************
+#  Project:            Eperly - Lite
+#  Tool:               UDP control vs. HTTP command round trips against a running lamp
+# *****************************************************************************
+# usage: tools/udp_latency.py <lamp ip> [ops per transport]
+#
+# Sends the same sequence of absolute ops (on/off, palette color n) twice:
+# as UDP control datagrams on UDP_CTRL_PORT with UDP_FLAG_ACK_REQ, timed to
+# the matching ack, and as HTTP GET /on, /off, /color/<n> over one
+# keep-alive connection, timed to the 303. Both are paced below the
+# per-client web server rate (RATE_PER_SECOND) so neither sees 429s.
+# Prints p50/p99/max round trip per transport, lost acks and non-303s.
+import http.client
+import random
+import socket
+import struct
+import sys
+import time
+
+UDP_CTRL_PORT = 7778
+UDP_CTRL_VERSION = 1
+UDP_FLAG_ACK_REQ = 0x01
+UDP_FLAG_ACK = 0x80
+UDP_OP_STATE = 0x01
+UDP_OP_PALETTE_COLOR = 0x05
+UDP_STATUS_OK = 0
+PACE = 0.12                                                 # (s) between ops, RATE_PER_SECOND is 10
+ACK_TIMEOUT = 0.5                                           # (s)
+COLORS = 4                                                  # palette entries used, every palette has them
+USAGE = "usage: tools/udp_latency.py <lamp ip> [ops per transport]"
+
+
+def ops(count):
+    # (UDP op bytes, HTTP path) pairs, the same absolute state either way
+    sequence = []
+    for n in range(count):
+        if n % 4 == 0:
+            sequence.append((bytes([UDP_OP_STATE, 1]), "/on"))
+        elif n % 4 == 3:
+            sequence.append((bytes([UDP_OP_STATE, 0]), "/off"))
+        else:
+            index = n % COLORS
+            sequence.append((bytes([UDP_OP_PALETTE_COLOR, index]), "/color/%d" % index))
+    return sequence
+
+
+def udp_round_trips(host, sequence):
+    samples = []
+    lost = errors = 0
+    seq = random.randrange(0x10000)
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        s.settimeout(ACK_TIMEOUT)
+        for op, _ in sequence:
+            seq = (seq + 1) & 0xFFFF
+            packet = b"EP" + struct.pack("<BBH", UDP_CTRL_VERSION, UDP_FLAG_ACK_REQ, seq) + op
+            start = time.perf_counter()
+            s.sendto(packet, (host, UDP_CTRL_PORT))
+            while True:
+                try:
+                    reply = s.recv(64)
+                except socket.timeout:
+                    lost += 1
+                    break
+                if len(reply) < 7 or reply[:2] != b"EP" or struct.unpack("<H", reply[4:6])[0] != seq:
+                    continue                                # a late ack of an earlier op
+                samples.append((time.perf_counter() - start) * 1000.0)
+                if not (reply[3] & UDP_FLAG_ACK) or reply[6] != UDP_STATUS_OK:
+                    errors += 1
+                break
+            time.sleep(PACE)
+    return samples, lost, errors
+
+
+def http_round_trips(host, sequence):
+    samples = []
+    errors = 0
+    conn = http.client.HTTPConnection(host, 80, timeout=10)
+    for _, path in sequence:
+        start = time.perf_counter()
+        conn.request("GET", path)
+        response = conn.getresponse()
+        response.read()
+        samples.append((time.perf_counter() - start) * 1000.0)
+        if response.status != 303:
+            errors += 1
+        time.sleep(PACE)
+    conn.close()
+    return samples, 0, errors
+
+
+def percentile(samples, p):
+    return samples[min(len(samples) - 1, int(len(samples) * p / 100.0))]
+
+
+def report(name, samples, lost, errors):
+    samples = sorted(samples)
+    if not samples:
+        print("%-5s no replies, %d lost" % (name, lost))
+        return None
+    print("%-5s n=%-4d p50 %7.1f ms  p99 %7.1f ms  max %7.1f ms  lost %d  errors %d" % (
+        name, len(samples), percentile(samples, 50), percentile(samples, 99), samples[-1], lost, errors))
+    return percentile(samples, 50)
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(USAGE)
+        sys.exit(2)
+    host = sys.argv[1]
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+    sequence = ops(count)
+
+    udp = report("udp", *udp_round_trips(host, sequence))
+    http = report("http", *http_round_trips(host, sequence))
+    if udp is None:
+        print("FAIL: no UDP acks, is the control port %d open?" % UDP_CTRL_PORT)
+        sys.exit(1)
+    if http:
+        print("udp p50 is %.1fx faster than http" % (http / udp))
+
+
+if __name__ == "__main__":
+    main()